@@ -0,0 +1,125 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#ifndef IIWA_CONTROL_COMMAND_BUFFER_H
+#define IIWA_CONTROL_COMMAND_BUFFER_H
+
+// ROS headers
+#include <ros/time.h>
+
+// std headers
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace iiwa_control {
+    // One command of the controller (plain data, copied without allocation)
+    struct CommandFrame {
+        static constexpr unsigned int MAX_SIZE = 64;
+
+        double data[MAX_SIZE];
+        unsigned int size;
+        ros::Time stamp; // when the command was received
+        uint64_t sequence; // 0 for the initial command, then incremented with every received one
+    };
+
+    // Lock-free triple buffer between one writer and one reader: the writer never waits for the reader,
+    // and the reader always gets the latest complete frame.
+    template <typename T>
+    class TripleBuffer {
+    public:
+        TripleBuffer() : front_(0), middle_(1), back_(2) {}
+
+        // Writer: fill writable(), then publish() it
+        T& writable() { return buffers_[back_]; }
+        void publish() { back_ = middle_.exchange(back_ | FRESH, std::memory_order_acq_rel) & INDEX; }
+
+        // Reader: switches to the latest published frame; returns false if there was none since the last call
+        bool update()
+        {
+            if (!(middle_.load(std::memory_order_relaxed) & FRESH))
+                return false;
+            front_ = middle_.exchange(front_, std::memory_order_acq_rel) & INDEX;
+            return true;
+        }
+        const T& readable() const { return buffers_[front_]; }
+
+    protected:
+        static constexpr unsigned int INDEX = 3;
+        static constexpr unsigned int FRESH = 4;
+
+        T buffers_[3];
+        unsigned int front_; // reader only
+        std::atomic<unsigned int> middle_; // index of the shared frame, with the FRESH bit
+        unsigned int back_; // writer only
+    };
+
+    using CommandBuffer = TripleBuffer<CommandFrame>;
+
+    // Lock-free bounded queue between one writer and one reader (the storage is allocated once in reserve())
+    template <typename T>
+    class SpscQueue {
+    public:
+        SpscQueue() : head_(0), tail_(0) {}
+
+        // Not thread-safe, call before the writer and the reader start
+        void reserve(size_t capacity)
+        {
+            buffer_.resize(capacity + 1);
+            head_ = 0;
+            tail_ = 0;
+        }
+
+        // Writer: false if the queue is full
+        bool push(const T& item)
+        {
+            size_t tail = tail_.load(std::memory_order_relaxed);
+            size_t next = nextIndex(tail);
+            if (next == head_.load(std::memory_order_acquire))
+                return false;
+            buffer_[tail] = item;
+            tail_.store(next, std::memory_order_release);
+            return true;
+        }
+
+        // Reader: the oldest item (nullptr if empty), valid until pop()
+        T* front()
+        {
+            size_t head = head_.load(std::memory_order_relaxed);
+            if (head == tail_.load(std::memory_order_acquire))
+                return nullptr;
+            return &buffer_[head];
+        }
+        void pop() { head_.store(nextIndex(head_.load(std::memory_order_relaxed)), std::memory_order_release); }
+
+    protected:
+        size_t nextIndex(size_t index) const { return (index + 1) % buffer_.size(); }
+
+        std::vector<T> buffer_;
+        std::atomic<size_t> head_, tail_;
+    };
+} // namespace iiwa_control
+
+#endif
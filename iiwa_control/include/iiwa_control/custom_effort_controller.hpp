@@ -32,17 +32,31 @@
 #include <hardware_interface/joint_command_interface.h>
 
 // realtime tools
-#include <realtime_tools/realtime_buffer.h>
 #include <realtime_tools/realtime_publisher.h>
 
 // msgs
 #include <std_msgs/Float64MultiArray.h>
+#include <trajectory_msgs/JointTrajectory.h>
 
 // URDF
 #include <urdf/model.h>
 
+// Eigen
+#include <Eigen/Dense>
+
+// std headers
+#include <array>
+#include <atomic>
+#include <limits>
+
+// Commands
+#include <iiwa_control/command_buffer.hpp>
+#include <iiwa_control/trajectory_interpolator.hpp>
+
 // Iiwa tools
+#include <iiwa_tools/collision_model.h>
 #include <iiwa_tools/iiwa_tools.h>
+#include <iiwa_tools/joint_acceleration_interface.h>
 
 // RobotControllers
 #include <robot_controllers/AbstractController.hpp>
@@ -52,6 +66,38 @@ namespace iiwa_control {
     public:
         using ControllerPtr = Corrade::Containers::Pointer<robot_controllers::AbstractController>;
 
+        // The workspace has a compile-time maximum size (the iiwa's 7 joints), so it lives inside the controller
+        static constexpr int MAX_JOINTS = 7;
+        using JointVector = Eigen::Matrix<double, Eigen::Dynamic, 1, 0, MAX_JOINTS, 1>;
+        using JointMatrix = Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, 0, MAX_JOINTS, MAX_JOINTS>;
+        using Jacobian = Eigen::Matrix<double, 6, Eigen::Dynamic, 0, 6, MAX_JOINTS>;
+        using JacobianTranspose = Eigen::Matrix<double, Eigen::Dynamic, 6, 0, MAX_JOINTS, 6>;
+        // Thin U and V need a dynamic number of columns (they stay bounded by the maximum sizes)
+        using JacobianSVD = Eigen::JacobiSVD<Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, 0, 6, MAX_JOINTS>>;
+        using MassLDLT = Eigen::LDLT<JointMatrix>;
+        using TaskLDLT = Eigen::LDLT<Eigen::Matrix<double, 6, 6>>;
+        using Vector6d = Eigen::Matrix<double, 6, 1>;
+
+        enum class OperationSpace {
+            Joint,
+            Task
+        };
+
+        // What the collision check does when links get close to each other or to a keep-out zone
+        enum class CollisionMode {
+            Repulsion, // adds joint torques pushing the pairs within the activation distance apart
+            Stop // holds the current state below the stop distance, until a new command arrives
+        };
+
+        // How the (generalized) inverse of J^T is computed in task space
+        enum class PseudoInverseMethod {
+            SVD, // thin SVD of J, singular values below the tolerance are dropped
+            DLS, // damped least squares through an LDLT of J J^T + damping^2 I
+            DynamicallyConsistent // mass-weighted, (J M^-1 J^T + damping^2 I)^-1 J M^-1
+        };
+
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
         CustomEffortController();
         ~CustomEffortController();
 
@@ -59,16 +105,42 @@ namespace iiwa_control {
 
         void update(const ros::Time& /*time*/, const ros::Duration& /*period*/);
 
+        // Same as a message on the command topic (for in-process users, e.g. the lockstep simulation); false if the size is wrong
+        bool setCommand(const double* data, unsigned int size, const ros::Time& stamp);
+        unsigned int commandSize() const { return cmd_dim_; }
+
         std::vector<hardware_interface::JointHandle> joints_;
+        std::vector<iiwa_tools::JointAccelerationHandle> accelerations_; // empty if the hardware does not estimate them
 
-        realtime_tools::RealtimeBuffer<std::vector<double>> commands_buffer_;
+        CommandBuffer commands_buffer_;
 
         unsigned int n_joints_;
 
         std::vector<std::string> joint_names_;
 
     protected:
+        // Looks up the (optional) acceleration interface before the regular initialization
+        bool initRequest(hardware_interface::RobotHW* robot_hw, ros::NodeHandle& root_nh, ros::NodeHandle& controller_nh, ClaimedResources& claimed_resources) override;
+
         ros::Subscriber sub_command_;
+        uint64_t command_sequence_; // of the latest received command (setCommand() only, update() reads the one of the frame)
+        double command_timeout_; // in seconds, 0 to never consider the commands stale
+        bool holding_; // the latest command is stale, hold_command_ is used instead
+        CommandFrame hold_command_;
+
+        // Transitions of update(), logged by reportEvents() on a timer (no ROS output in the control cycle)
+        ros::Timer report_timer_;
+        std::atomic<bool> report_hold_, report_resume_;
+        std::atomic<bool> report_collision_stop_, report_collision_release_;
+        std::atomic<double> report_collision_distance_; // at the latest collision stop
+
+        // Trajectory input: batches of waypoints interpolated in update() instead of single commands
+        ros::Subscriber sub_trajectory_;
+        bool trajectory_input_;
+        TrajectoryInterpolator trajectory_;
+        CommandFrame trajectory_command_;
+        std::atomic<uint64_t> trajectory_sequence_; // of the latest trajectory with queued points
+        iiwa_tools::JointAccelerationInterface* acceleration_hw_;
 
         // Controller
         ControllerPtr controller_;
@@ -80,22 +152,84 @@ namespace iiwa_control {
         unsigned int cmd_dim_;
         bool has_orientation_, null_space_control_;
         std::string operation_space_, gravity_comp_;
+        OperationSpace space_;
+
+        // Where each part of the command goes in the desired state of the controller
+        struct CommandSlice {
+            Eigen::VectorXd robot_controllers::RobotState::*field;
+            unsigned int offset, size;
+        };
+        std::array<CommandSlice, 8> command_slices_; // one per IOType at most
+        unsigned int num_command_slices_;
 
         // Iiwa tools
         iiwa_tools::IiwaTools tools_;
-
-        // URDF
-        std::vector<urdf::JointConstSharedPtr> joint_urdfs_;
+        std::unique_ptr<iiwa_tools::IiwaTools::Context> tools_context_; // owned by the control thread
+        iiwa_tools::RobotState tools_state_;
+        iiwa_tools::ModelState model_state_;
+
+        // Workspace of update(), sized once in init() so that the control cycle does not allocate
+        robot_controllers::RobotState joint_state_, task_state_, desired_state_;
+        Jacobian jac_, jac_deriv_, jac_t_pinv_;
+        JacobianTranspose minv_jac_t_;
+        JacobianSVD jac_svd_;
+        MassLDLT mass_ldlt_;
+        TaskLDLT task_ldlt_;
+        Vector6d eef_, eef_vel_, eef_acc_, eef_force_, task_output_, null_space_task_;
+        JointVector effort_, null_space_signal_, null_space_force_;
+
+        // Pseudo-inverse settings
+        PseudoInverseMethod pinv_method_;
+        double pinv_tolerance_, pinv_damping_; // SVD cutoff, DLS/dynamically consistent damping
+
+        // Effort limits of the joints (from the URDF, infinite if none)
+        JointVector effort_limits_;
 
         // Null-space control
         Eigen::VectorXd null_space_joint_config_;
         double null_space_Kp_, null_space_Kd_, null_space_max_torque_;
 
+        // Collision check (self-collisions and keep-out zones) on the measured joint positions
+        bool collision_check_;
+        CollisionMode collision_mode_;
+        double collision_activation_, collision_stop_distance_, collision_gain_, collision_max_torque_;
+        iiwa_tools::CollisionModel collision_model_;
+        std::unique_ptr<iiwa_tools::CollisionModel::Workspace> collision_ws_;
+        double collision_distance_; // smallest distance of the current cycle
+        bool collision_stopped_; // hold_command_ is used until a command newer than collision_stop_sequence_
+        uint64_t collision_stop_sequence_;
+        double collision_release_distance_; // the robot stops again if it gets closer than when it was released
+        JointVector collision_gradient_, collision_force_;
+
         // Command callback
         void commandCB(const std_msgs::Float64MultiArrayConstPtr& msg);
+        void trajectoryCB(const trajectory_msgs::JointTrajectoryConstPtr& msg);
+
+        // Control cycle, without the branches of the other operation space
+        template <OperationSpace Space>
+        void updateImpl(const ros::Time& time);
+
+        // Logs the transitions update() latched since the previous call
+        void reportEvents(const ros::TimerEvent& event);
+
+        // Sizes the workspace of update() (once the controller is set up)
+        void allocateWorkspace();
+
+        // Computes the command slices (and cmd_dim_) from the controller's input type
+        void parseCommandLayout();
+
+        // Stays where the robot is: the positions/orientations of the command are the current ones, the rest is zero
+        // (sequence is the one of the command it replaces)
+        void holdCommand(const robot_controllers::RobotState& curr_state, uint64_t sequence);
+
+        // Whether the robot must hold its state (stop mode), given the distance and the sequence of the current command
+        bool collisionStop(uint64_t sequence);
+
+        // Repulsion torques of the pairs within the activation distance (in collision_force_, not clamped)
+        void collisionRepulsion();
 
-        // Enforce effort limits
-        void enforceJointLimits(double& command, unsigned int index);
+        // Enforce effort limits (on effort_, in one pass)
+        void enforceJointLimits();
     };
 } // namespace iiwa_control
 
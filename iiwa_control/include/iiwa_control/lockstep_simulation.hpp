@@ -0,0 +1,156 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#ifndef IIWA_CONTROL_LOCKSTEP_SIMULATION_H
+#define IIWA_CONTROL_LOCKSTEP_SIMULATION_H
+
+// ROS headers
+#include <ros/node_handle.h>
+
+// ros control
+#include <hardware_interface/joint_command_interface.h>
+#include <hardware_interface/joint_state_interface.h>
+#include <hardware_interface/robot_hw.h>
+
+// Eigen
+#include <Eigen/Dense>
+
+// std headers
+#include <memory>
+#include <string>
+#include <vector>
+
+// Iiwa tools
+#include <iiwa_tools/iiwa_tools.h>
+#include <iiwa_tools/joint_acceleration_interface.h>
+#include <iiwa_tools/thread_pool.h>
+
+#include <iiwa_control/custom_effort_controller.hpp>
+
+namespace iiwa_control {
+    struct SimulationSettings {
+        double duration; // of an episode, in seconds
+        double control_period; // in seconds
+        unsigned int substeps; // physics steps per control period
+        Eigen::Vector3d gravity; // of the world
+        bool gravity_compensation; // added to the commands as GravityCompensationHWSim does
+        double joint_damping; // viscous, in Nms/rad
+        unsigned int record_every; // control periods between two recorded samples
+    };
+
+    // Robot of the lockstep simulation: RBDyn forward dynamics behind the ros_control interfaces of the real one
+    class SimulatedRobot : public hardware_interface::RobotHW {
+    public:
+        // The models are the ones shared by all the instances (iiwa_tools::ModelLoader)
+        bool init(const urdf::Model& urdf, const mc_rbdyn_urdf::URDFParserResult& rbdyn_urdf, const std::string& end_effector, const SimulationSettings& settings);
+
+        // Joint positions (with zero velocity), in the order of jointNames()
+        void reset(const Eigen::VectorXd& positions);
+
+        // One control period: read(), the controller's update, applyCommands() and integrate()
+        void read(); // end-effector pose and gravity compensation of the current state
+        void applyCommands(); // the commands (plus compensation) clamped to the effort limits
+        void integrate(); // the dynamics over one control period, with the applied efforts
+
+        const std::vector<std::string>& jointNames() const { return joint_names_; }
+        unsigned int numJoints() const { return n_joints_; }
+        const Eigen::VectorXd& positions() const { return position_; }
+        const Eigen::VectorXd& velocities() const { return velocity_; }
+        const Eigen::VectorXd& efforts() const { return effort_; } // applied in the last control period
+        const iiwa_tools::EefState& endEffector() const { return model_state_.ee_state; } // as of the last read()
+        unsigned int saturated() const { return saturated_; } // joints at their effort limit in the last applyCommands()
+
+    protected:
+        SimulationSettings settings_;
+        unsigned int n_joints_;
+        std::vector<std::string> joint_names_;
+        Eigen::VectorXd effort_limits_, lower_limits_, upper_limits_;
+
+        // State and commands, the handles point into them
+        Eigen::VectorXd position_, velocity_, effort_, acceleration_, effort_command_;
+        unsigned int saturated_;
+
+        hardware_interface::JointStateInterface joint_state_interface_;
+        hardware_interface::EffortJointInterface effort_joint_interface_;
+        iiwa_tools::JointAccelerationInterface joint_acceleration_interface_;
+
+        // Dynamics
+        iiwa_tools::IiwaTools tools_;
+        std::unique_ptr<iiwa_tools::IiwaTools::Context> tools_context_;
+        iiwa_tools::RobotState tools_state_;
+        iiwa_tools::ModelState model_state_, dynamics_state_;
+        Eigen::LDLT<Eigen::MatrixXd> mass_ldlt_;
+        Eigen::Vector3d rbd_gravity_; // RBDyn's convention (the opposite of the world's gravity)
+    };
+
+    struct EpisodeMetrics {
+        bool diverged; // the state became non-finite
+        double duration; // simulated
+        double rms_effort, max_effort, saturation_ratio; // efforts over all the joints and control periods
+        double final_velocity; // norm of the joint velocities
+        double path_length; // of the end-effector
+        // With a target only (joint positions, or end-effector position with 3 values)
+        double final_error, rms_error, settling_time; // settling_time: since when the error stays within the tolerance, -1 if it does not
+        double update_time; // mean wall time of the controller update, in microseconds
+    };
+
+    // One robot/controller pair with its own parameter namespace
+    struct SimulationInstance {
+        std::string name;
+        SimulatedRobot robot;
+        std::unique_ptr<CustomEffortController> controller;
+        std::vector<double> command;
+        Eigen::VectorXd target;
+        double settling_tolerance;
+
+        std::vector<double> samples; // recorded rows: time, positions, velocities, efforts and end-effector position
+        EpisodeMetrics metrics;
+    };
+
+    // Headless lockstep harness: runs independent episodes of CustomEffortController, as fast as they compute,
+    // in parallel (one instance per worker at a time)
+    class LockstepSimulation {
+    public:
+        LockstepSimulation(ros::NodeHandle nh);
+
+        bool init();
+        void run();
+        bool writeResults() const;
+
+    protected:
+        bool initInstance(SimulationInstance& instance, const urdf::Model& urdf, const mc_rbdyn_urdf::URDFParserResult& rbdyn_urdf);
+        void runInstance(SimulationInstance& instance);
+        void record(SimulationInstance& instance, double time);
+
+        ros::NodeHandle nh_;
+        SimulationSettings settings_;
+        std::string end_effector_, output_dir_;
+        int num_threads_;
+
+        std::vector<std::unique_ptr<SimulationInstance>> instances_;
+        std::unique_ptr<iiwa_tools::ThreadPool> pool_;
+    };
+} // namespace iiwa_control
+
+#endif
@@ -0,0 +1,83 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#ifndef IIWA_CONTROL_TRAJECTORY_INTERPOLATOR_H
+#define IIWA_CONTROL_TRAJECTORY_INTERPOLATOR_H
+
+// ROS headers
+#include <ros/time.h>
+
+// Commands
+#include <iiwa_control/command_buffer.hpp>
+
+namespace iiwa_control {
+    // A time-stamped command of a trajectory (same layout as the commands)
+    struct Waypoint {
+        ros::Time time;
+        unsigned int size;
+        bool has_velocity, has_acceleration;
+        double position[CommandFrame::MAX_SIZE];
+        double velocity[CommandFrame::MAX_SIZE];
+        double acceleration[CommandFrame::MAX_SIZE];
+    };
+
+    // Interpolates the commands of a stream of waypoints. push() is called from the (single) ROS callback thread,
+    // sample() from the control loop; the waypoints are exchanged through a preallocated queue.
+    class TrajectoryInterpolator {
+    public:
+        enum class Interpolation {
+            Cubic,
+            Quintic
+        };
+
+        TrajectoryInterpolator();
+
+        // Not real-time safe; orientation_offset is the index of the (axis-angle) orientation in the command, -1 if none
+        void init(unsigned int size, size_t capacity, Interpolation interpolation, int orientation_offset, const double* initial_command);
+
+        // Queues a waypoint; it is dropped if it is not after the last queued one or if the queue is full
+        bool push(const Waypoint& waypoint);
+
+        // Command at the given time (the last waypoint is held once the trajectory is over)
+        void sample(const ros::Time& time, CommandFrame& command);
+
+    protected:
+        // Starts the segment towards the waypoint at the front of the queue
+        void startSegment(const ros::Time& time);
+
+        SpscQueue<Waypoint> queue_;
+        ros::Time last_queued_time_; // writer only
+
+        // Reader only
+        unsigned int size_;
+        Interpolation interpolation_;
+        int orientation_offset_;
+        bool idle_; // holding the end of the last segment
+        Waypoint start_, end_;
+        double duration_;
+        double coefficients_[6][CommandFrame::MAX_SIZE]; // polynomial of each command entry, in the time since the segment start
+    };
+} // namespace iiwa_control
+
+#endif
@@ -28,29 +28,69 @@
 
 #include <iiwa_control/custom_effort_controller.hpp>
 
+#include <iiwa_tools/model_loader.h>
+#include <iiwa_tools/param_tree.h>
+
 #include <Corrade/Containers/PointerStl.h>
 
 #include <robot_controllers/CascadeController.hpp>
 #include <robot_controllers/SumController.hpp>
 
+// With CHECK_RT_MALLOC (cmake option), Eigen asserts on any heap allocation in our part of update()
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+#define IIWA_CONTROL_RT_BEGIN() Eigen::internal::set_is_malloc_allowed(false)
+#define IIWA_CONTROL_RT_END() Eigen::internal::set_is_malloc_allowed(true)
+#else
+#define IIWA_CONTROL_RT_BEGIN()
+#define IIWA_CONTROL_RT_END()
+#endif
+
 namespace iiwa_control {
-    template <class MatT>
-    Eigen::Matrix<typename MatT::Scalar, MatT::ColsAtCompileTime, MatT::RowsAtCompileTime> pseudo_inverse(const MatT& mat, typename MatT::Scalar tolerance = typename MatT::Scalar{1e-4}) // choose appropriately
+    // The decompositions and the results are provided by the caller, so that fixed (maximum) size types do not allocate.
+    // All of them compute the (generalized) inverse of J^T from the 6xN Jacobian J.
+
+    // pinv(J^T) = U S^-1 V^T from the thin SVD of J; singular values below the tolerance are dropped
+    template <class JacT, class SvdT, class ResultT>
+    void jacobian_transpose_pinv_svd(const JacT& jac, SvdT& svd, ResultT& result, double tolerance)
     {
-        typedef typename MatT::Scalar Scalar;
-        auto svd = mat.jacobiSvd(Eigen::ComputeFullU | Eigen::ComputeFullV);
+        svd.compute(jac, Eigen::ComputeThinU | Eigen::ComputeThinV);
         const auto& singularValues = svd.singularValues();
-        Eigen::Matrix<Scalar, MatT::ColsAtCompileTime, MatT::RowsAtCompileTime> singularValuesInv(mat.cols(), mat.rows());
-        singularValuesInv.setZero();
+        Eigen::Matrix<double, Eigen::Dynamic, 1, 0, SvdT::MaxDiagSizeAtCompileTime, 1> singularValuesInv(singularValues.size());
         for (unsigned int i = 0; i < singularValues.size(); ++i) {
             if (singularValues(i) > tolerance) {
-                singularValuesInv(i, i) = Scalar{1} / singularValues(i);
+                singularValuesInv(i) = 1. / singularValues(i);
             }
             else {
-                singularValuesInv(i, i) = Scalar{0};
+                singularValuesInv(i) = 0.;
             }
         }
-        return svd.matrixV() * singularValuesInv * svd.matrixU().adjoint();
+        result.noalias() = svd.matrixU() * singularValuesInv.asDiagonal() * svd.matrixV().transpose();
+    }
+
+    // Damped least squares: (J J^T + damping^2 I)^-1 J
+    template <class JacT, class LdltT, class ResultT>
+    void jacobian_transpose_pinv_dls(const JacT& jac, LdltT& ldlt, ResultT& result, double damping)
+    {
+        typename LdltT::MatrixType jjt;
+        jjt.noalias() = jac * jac.transpose();
+        jjt.diagonal().array() += damping * damping;
+        ldlt.compute(jjt);
+        result = ldlt.solve(jac);
+    }
+
+    // Dynamically consistent inverse: Lambda J M^-1 with Lambda = (J M^-1 J^T + damping^2 I)^-1
+    template <class JacT, class MassT, class MassLdltT, class JacTransposeT, class LdltT, class ResultT>
+    void jacobian_transpose_pinv_dynamic(const JacT& jac, const MassT& mass, MassLdltT& mass_ldlt, JacTransposeT& minv_jac_t, LdltT& ldlt, ResultT& result, double damping)
+    {
+        mass_ldlt.compute(mass);
+        minv_jac_t = mass_ldlt.solve(jac.transpose());
+
+        typename LdltT::MatrixType lambda_inv;
+        lambda_inv.noalias() = jac * minv_jac_t;
+        lambda_inv.diagonal().array() += damping * damping;
+        ldlt.compute(lambda_inv);
+        // M is symmetric, so (M^-1 J^T)^T = J M^-1
+        result = ldlt.solve(minv_jac_t.transpose());
     }
 
     std::vector<std::vector<std::string>> get_types(const std::string& input, const std::string& output)
@@ -169,15 +209,31 @@ namespace iiwa_control {
         ctrl->SetParams(params);
     }
 
-    CustomEffortController::CustomEffortController() {}
+    CustomEffortController::CustomEffortController() : acceleration_hw_(nullptr), command_sequence_(0), command_timeout_(0.), holding_(false), report_hold_(false), report_resume_(false), report_collision_stop_(false), report_collision_release_(false), report_collision_distance_(0.), trajectory_input_(false), trajectory_sequence_(0), collision_check_(false), collision_mode_(CollisionMode::Repulsion), collision_distance_(std::numeric_limits<double>::infinity()), collision_stopped_(false), collision_stop_sequence_(0), collision_release_distance_(std::numeric_limits<double>::infinity()) {}
 
-    CustomEffortController::~CustomEffortController() { sub_command_.shutdown(); }
+    CustomEffortController::~CustomEffortController()
+    {
+        sub_command_.shutdown();
+        sub_trajectory_.shutdown();
+        report_timer_.stop();
+    }
+
+    bool CustomEffortController::initRequest(hardware_interface::RobotHW* robot_hw, ros::NodeHandle& root_nh, ros::NodeHandle& controller_nh, ClaimedResources& claimed_resources)
+    {
+        acceleration_hw_ = robot_hw->get<iiwa_tools::JointAccelerationInterface>();
+
+        return controller_interface::Controller<hardware_interface::EffortJointInterface>::initRequest(robot_hw, root_nh, controller_nh, claimed_resources);
+    }
 
     bool CustomEffortController::init(hardware_interface::EffortJointInterface* hw, ros::NodeHandle& n)
     {
+        // All the settings of the controller in one round trip to the parameter server
+        iiwa_tools::ParamTree config;
+        config.load(n);
+
         // List of controlled joints
         std::string param_name = "joints";
-        if (!n.getParam(param_name, joint_names_)) {
+        if (!config.get(param_name, joint_names_)) {
             ROS_ERROR_STREAM("Failed to getParam '" << param_name << "' (namespace: " << n.getNamespace() << ").");
             return false;
         }
@@ -188,70 +244,87 @@ namespace iiwa_control {
             return false;
         }
 
-        // Get URDF
-        urdf::Model urdf;
-        if (!urdf.initParam("robot_description")) {
+        if (n_joints_ > MAX_JOINTS) {
+            ROS_ERROR_STREAM("Too many joints (" << n_joints_ << "), at most " << static_cast<int>(MAX_JOINTS) << " are supported.");
+            return false;
+        }
+
+        // Get URDF (parsed once per process, shared with the hardware interface and the other controllers)
+        std::string robot_description = "robot_description", full_param;
+
+        // gets the location of the robot description on the parameter server
+        if (!n.searchParam(robot_description, full_param)) {
+            ROS_ERROR("Could not find parameter %s on parameter server", robot_description.c_str());
+            return false;
+        }
+
+        std::shared_ptr<const urdf::Model> urdf = iiwa_tools::ModelLoader::instance().urdf_model(n, full_param);
+        if (!urdf) {
             ROS_ERROR("Failed to parse urdf file");
             return false;
         }
 
         // Get basic parameters
-        n.param<std::string>("params/space", operation_space_, "joint"); // Default operation space is task-space
+        config.param<std::string>("params/space", operation_space_, "joint"); // Default operation space is task-space
+        space_ = (operation_space_ == "task") ? OperationSpace::Task : OperationSpace::Joint;
 
         // Check the operational space
-        if (operation_space_ == "task") {
-            space_dim_ = 3;
+        space_dim_ = (space_ == OperationSpace::Task) ? 3 : n_joints_;
 
-            // Get the URDF XML from the parameter server
-            std::string urdf_string, full_param;
-            std::string robot_description = "robot_description";
-            std::string end_effector;
+        // Collision check (needs the model in joint space too)
+        config.param<bool>("params/collision/enabled", collision_check_, false);
 
-            // gets the location of the robot description on the parameter server
-            if (!n.searchParam(robot_description, full_param)) {
-                ROS_ERROR("Could not find parameter %s on parameter server", robot_description.c_str());
+        if (space_ == OperationSpace::Task || collision_check_) {
+            // The RBDyn model of the same URDF (usually already parsed by the hardware interface in the background)
+            std::shared_ptr<const mc_rbdyn_urdf::URDFParserResult> rbdyn_urdf = iiwa_tools::ModelLoader::instance().rbdyn_model(n, full_param);
+            if (!rbdyn_urdf) {
+                ROS_ERROR("Failed to convert the urdf file to RBDyn");
                 return false;
             }
 
-            // search and wait for robot_description on param server
-            while (urdf_string.empty()) {
-                ROS_INFO_ONCE_NAMED("CustomEffortController", "CustomEffortController is waiting for model"
-                                                              " URDF in parameter [%s] on the ROS param server.",
-                    robot_description.c_str());
+            // Get the end-effector
+            std::string end_effector;
+            config.param<std::string>("params/end_effector", end_effector, "iiwa_link_ee");
 
-                n.getParam(full_param, urdf_string);
+            // Initialize iiwa tools
+            tools_.init_rbdyn(*rbdyn_urdf, end_effector);
+            tools_context_ = tools_.create_context();
+
+            if (collision_check_) {
+                iiwa_tools::CollisionSettings settings;
+                if (!iiwa_tools::load_collision_settings(config.subtree("params/collision"), settings)
+                    || !collision_model_.init(tools_.get_multibody(), tools_.get_indices(), iiwa_tools::ModelLoader::instance().urdf_string(n, full_param), settings)) {
+                    ROS_ERROR("Could not initialize the collision model");
+                    return false;
+                }
+                collision_ws_ = collision_model_.create_workspace();
 
-                usleep(100000);
-            }
-            ROS_INFO_STREAM_NAMED("CustomEffortController", "Received urdf from param server, parsing...");
+                std::string mode;
+                config.param<std::string>("params/collision/mode", mode, "repulsion");
+                config.param<double>("params/collision/activation_distance", collision_activation_, 0.05);
+                config.param<double>("params/collision/stop_distance", collision_stop_distance_, 0.01);
+                config.param<double>("params/collision/gain", collision_gain_, 100.);
+                config.param<double>("params/collision/max_torque", collision_max_torque_, 10.);
 
-            // Get the end-effector
-            n.param<std::string>("params/end_effector", end_effector, "iiwa_link_ee");
+                collision_mode_ = (mode == "stop") ? CollisionMode::Stop : CollisionMode::Repulsion;
+                if (mode != "stop" && mode != "repulsion")
+                    ROS_WARN_STREAM("Unknown collision mode '" << mode << "'. Using 'repulsion'!");
 
-            // Initialize iiwa tools
-            tools_.init_rbdyn(urdf_string, end_effector);
+                ROS_INFO_STREAM_NAMED("CustomEffortController", "Checking " << collision_model_.num_pairs() << " collision pair(s) between " << collision_model_.num_capsules() << " capsule(s)");
+            }
         }
-        else
-            space_dim_ = n_joints_;
 
         // Read Controllers from Params
         std::map<std::string, ControllerPtr> controllers;
         std::vector<std::string> ctrl_names;
 
-        XmlRpc::XmlRpcValue symbols;
-
-        n.getParam("controllers", symbols);
-
-        assert(symbols.getType() == XmlRpc::XmlRpcValue::TypeStruct);
-        for (XmlRpc::XmlRpcValue::iterator i = symbols.begin(); i != symbols.end(); ++i) {
-            // ROS_WARN_STREAM(i->first << ": " << i->second.getType());
-            std::string name = i->first;
+        for (const std::string& name : config.members("controllers")) {
             std::string type, input, output;
             std::vector<double> param_values;
-            n.getParam("controllers/" + name + "/type", type);
-            n.getParam("controllers/" + name + "/params", param_values);
-            n.getParam("controllers/" + name + "/input", input);
-            n.getParam("controllers/" + name + "/output", output);
+            config.get("controllers/" + name + "/type", type);
+            config.get("controllers/" + name + "/params", param_values);
+            config.get("controllers/" + name + "/input", input);
+            config.get("controllers/" + name + "/output", output);
 
             if (type.size() == 0) {
                 ROS_WARN_STREAM("Could not find type of controller '" << name << "'. Skipping this controller!");
@@ -285,56 +358,66 @@ namespace iiwa_control {
             }
         }
 
-        XmlRpc::XmlRpcValue symbols_structure;
-        n.getParam("structure", symbols_structure);
+        for (const std::string& name : config.members("structure")) {
+            std::vector<std::string> sub;
+            config.get("structure/" + name, sub);
+            bool is_sum = false;
+            if (name.find("Add") == 0) {
+                controllers[name] = ControllerPtr(new robot_controllers::SumController);
+                is_sum = true;
+            }
+            else if (name.find("Cascade") == 0) {
+                controllers[name] = ControllerPtr(new robot_controllers::CascadeController);
+            }
+            else {
+                ROS_WARN_STREAM("Cannot identify the type of the controller by the name: '" << name << "'. Ignoring!");
+                continue;
+            }
+            // std::cout << sub.size() << std::endl;
+            for (size_t k = 0; k < sub.size(); k++) {
+                // ROS_WARN_STREAM("    " << sub[k]);
+                if (is_sum)
+                    static_cast<robot_controllers::SumController*>(controllers[name].get())->AddController(std::move(controllers[sub[k]]));
+                else
+                    static_cast<robot_controllers::CascadeController*>(controllers[name].get())->AddController(std::move(controllers[sub[k]]));
+                ctrl_names.erase(std::remove(ctrl_names.begin(), ctrl_names.end(), sub[k]), ctrl_names.end());
+                controllers.erase(sub[k]);
+            }
 
-        if (symbols_structure.getType() == XmlRpc::XmlRpcValue::TypeStruct) {
-            for (XmlRpc::XmlRpcValue::iterator i = symbols_structure.begin(); i != symbols_structure.end(); ++i) {
-                // ROS_WARN_STREAM(i->first << ": " << i->second.getType());
-                std::string name = i->first;
-                std::vector<std::string> sub;
-                n.getParam("structure/" + name, sub);
-                bool is_sum = false;
-                if (name.find("Add") == 0) {
-                    controllers[name] = ControllerPtr(new robot_controllers::SumController);
-                    is_sum = true;
-                }
-                else if (name.find("Cascade") == 0) {
-                    controllers[name] = ControllerPtr(new robot_controllers::CascadeController);
-                }
-                else {
-                    ROS_WARN_STREAM("Cannot identify the type of the controller by the name: '" << name << "'. Ignoring!");
-                    continue;
-                }
-                // std::cout << sub.size() << std::endl;
-                for (size_t k = 0; k < sub.size(); k++) {
-                    // ROS_WARN_STREAM("    " << sub[k]);
-                    if (is_sum)
-                        static_cast<robot_controllers::SumController*>(controllers[name].get())->AddController(std::move(controllers[sub[k]]));
-                    else
-                        static_cast<robot_controllers::CascadeController*>(controllers[name].get())->AddController(std::move(controllers[sub[k]]));
-                    ctrl_names.erase(std::remove(ctrl_names.begin(), ctrl_names.end(), sub[k]), ctrl_names.end());
-                    controllers.erase(sub[k]);
-                }
+            // Initialize parameters
+            robot_controllers::RobotParams params;
+            params.input_dim_ = space_dim_;
+            params.output_dim_ = space_dim_;
 
-                // Initialize parameters
-                robot_controllers::RobotParams params;
-                params.input_dim_ = space_dim_;
-                params.output_dim_ = space_dim_;
+            params.time_step_ = 0.01; // TO-DO: Get this from controller manager or yaml
+            controllers[name]->SetParams(params);
 
-                params.time_step_ = 0.01; // TO-DO: Get this from controller manager or yaml
-                controllers[name]->SetParams(params);
+            set_input_space(controllers[name], space_dim_);
 
-                set_input_space(controllers[name], space_dim_);
+            ctrl_names.push_back(name);
+        }
 
-                ctrl_names.push_back(name);
-            }
+        pinv_method_ = PseudoInverseMethod::SVD;
+        pinv_tolerance_ = 1e-4;
+        pinv_damping_ = 1e-2;
+        if (space_ == OperationSpace::Task) {
+            std::string method;
+            config.param<std::string>("params/pseudo_inverse/method", method, "svd");
+            config.param<double>("params/pseudo_inverse/tolerance", pinv_tolerance_, 1e-4);
+            config.param<double>("params/pseudo_inverse/damping", pinv_damping_, 1e-2);
+
+            if (method == "dls")
+                pinv_method_ = PseudoInverseMethod::DLS;
+            else if (method == "dynamically_consistent")
+                pinv_method_ = PseudoInverseMethod::DynamicallyConsistent;
+            else if (method != "svd")
+                ROS_WARN_STREAM("Unknown pseudo-inverse method '" << method << "'. Using 'svd'!");
         }
 
         null_space_control_ = false;
-        if (operation_space_ == "task") {
+        if (space_ == OperationSpace::Task) {
             std::vector<double> joints;
-            n.getParam("params/null_space/joints", joints);
+            config.get("params/null_space/joints", joints);
             null_space_control_ = (joints.size() == n_joints_);
 
             if (null_space_control_) {
@@ -344,9 +427,9 @@ namespace iiwa_control {
                 null_space_Kd_ = 0.1;
                 null_space_max_torque_ = 10.;
 
-                n.getParam("params/null_space/Kp", null_space_Kp_);
-                n.getParam("params/null_space/Kp", null_space_Kd_);
-                n.getParam("params/null_space/max_torque", null_space_max_torque_);
+                config.get("params/null_space/Kp", null_space_Kp_);
+                config.get("params/null_space/Kd", null_space_Kd_);
+                config.get("params/null_space/max_torque", null_space_max_torque_);
             }
         }
 
@@ -377,6 +460,7 @@ namespace iiwa_control {
             return false;
         }
 
+        effort_limits_ = JointVector::Constant(n_joints_, std::numeric_limits<double>::infinity());
         for (unsigned int i = 0; i < n_joints_; i++) {
             try {
                 joints_.push_back(hw->getHandle(joint_names_[i]));
@@ -386,45 +470,34 @@ namespace iiwa_control {
                 return false;
             }
 
-            urdf::JointConstSharedPtr joint_urdf = urdf.getJoint(joint_names_[i]);
+            urdf::JointConstSharedPtr joint_urdf = urdf->getJoint(joint_names_[i]);
             if (!joint_urdf) {
                 ROS_ERROR("Could not find joint '%s' in urdf", joint_names_[i].c_str());
                 return false;
             }
-            joint_urdfs_.push_back(joint_urdf);
+            if (joint_urdf->limits)
+                effort_limits_(i) = joint_urdf->limits->effort;
         }
 
-        // Get controller command size
-        cmd_dim_ = 0;
-
-        if (controller_->GetInput().GetType() & robot_controllers::IOType::Position) {
-            cmd_dim_ += space_dim_;
-        }
-        if (controller_->GetInput().GetType() & robot_controllers::IOType::Orientation) {
-            cmd_dim_ += 3; // This is fixed to 3D
-        }
-        if (controller_->GetInput().GetType() & robot_controllers::IOType::Velocity) {
-            cmd_dim_ += space_dim_;
-        }
-        if (controller_->GetInput().GetType() & robot_controllers::IOType::AngularVelocity) {
-            cmd_dim_ += 3; // This is fixed to 3D
-        }
-        if (controller_->GetInput().GetType() & robot_controllers::IOType::Acceleration) {
-            cmd_dim_ += space_dim_;
-        }
-        if (controller_->GetInput().GetType() & robot_controllers::IOType::AngularAcceleration) {
-            cmd_dim_ += 3; // This is fixed to 3D
-        }
-        if (controller_->GetInput().GetType() & robot_controllers::IOType::Force) {
-            cmd_dim_ += space_dim_;
-        }
-        if (controller_->GetInput().GetType() & robot_controllers::IOType::Torque) {
-            cmd_dim_ += 3; // This is fixed to 3D
+        // Use the estimated accelerations only if all joints have one
+        accelerations_.clear();
+        if (acceleration_hw_) {
+            try {
+                for (unsigned int i = 0; i < n_joints_; i++)
+                    accelerations_.push_back(acceleration_hw_->getHandle(joint_names_[i]));
+            }
+            catch (const hardware_interface::HardwareInterfaceException& e) {
+                ROS_WARN_STREAM("Joint accelerations are not available: " << e.what());
+                accelerations_.clear();
+            }
         }
 
+        // Get controller command layout (and size)
+        parseCommandLayout();
+
         std::vector<double> init_cmd(cmd_dim_, 0.0);
         has_orientation_ = false;
-        if (operation_space_ == "task") {
+        if (space_ == OperationSpace::Task) {
             has_orientation_ = ((controller_->GetInput().GetType() & robot_controllers::IOType::Orientation)) ? true : false;
             bool has_position = ((controller_->GetInput().GetType() & robot_controllers::IOType::Position)) ? true : false;
             if (has_position || has_orientation_) {
@@ -438,7 +511,7 @@ namespace iiwa_control {
                     robot_state.velocity[i] = joints_[i].getVelocity();
                 }
 
-                auto ee_state = tools_.perform_fk(robot_state);
+                const iiwa_tools::EefState& ee_state = tools_.perform_fk(*tools_context_, robot_state);
                 Eigen::AngleAxisd aa(ee_state.orientation);
                 Eigen::VectorXd o = aa.axis() * aa.angle();
                 Eigen::VectorXd p = ee_state.translation;
@@ -458,184 +531,456 @@ namespace iiwa_control {
 
         ROS_INFO_STREAM("Initial command: " << Eigen::VectorXd::Map(init_cmd.data(), init_cmd.size()).transpose());
 
-        commands_buffer_.writeFromNonRT(init_cmd);
+        if (cmd_dim_ > CommandFrame::MAX_SIZE) {
+            ROS_ERROR_STREAM("Command size (" << cmd_dim_ << ") is above the maximum of " << static_cast<unsigned int>(CommandFrame::MAX_SIZE) << "!");
+            return false;
+        }
+
+        CommandFrame& frame = commands_buffer_.writable();
+        std::copy(init_cmd.begin(), init_cmd.end(), frame.data);
+        frame.size = cmd_dim_;
+        frame.stamp = ros::Time::now();
+        frame.sequence = 0;
+        commands_buffer_.publish();
+
+        allocateWorkspace();
+
+        // Streaming commands: hold the robot if none arrived for command_timeout seconds
+        config.param<double>("params/command_timeout", command_timeout_, 0.);
+        command_sequence_ = 0;
+        holding_ = false;
+        collision_stopped_ = false;
+        collision_release_distance_ = std::numeric_limits<double>::infinity();
+
+        bool tcp_no_delay;
+        config.param<bool>("params/tcp_no_delay", tcp_no_delay, false);
+        ros::TransportHints hints;
+        if (tcp_no_delay)
+            hints = hints.tcpNoDelay();
+
+        // Input: single commands ("command") or trajectories ("trajectory")
+        std::string input;
+        config.param<std::string>("params/input", input, "command");
+        trajectory_input_ = (input == "trajectory");
+
+        if (trajectory_input_) {
+            std::string interpolation;
+            int capacity;
+            config.param<std::string>("params/trajectory/interpolation", interpolation, "cubic");
+            config.param<int>("params/trajectory/capacity", capacity, 256);
+
+            if (interpolation != "cubic" && interpolation != "quintic")
+                ROS_WARN_STREAM("Unknown interpolation '" << interpolation << "'. Using 'cubic'!");
+
+            int orientation_offset = -1;
+            for (unsigned int i = 0; i < num_command_slices_; i++) {
+                if (command_slices_[i].field == &robot_controllers::RobotState::orientation_)
+                    orientation_offset = command_slices_[i].offset;
+            }
+
+            trajectory_.init(cmd_dim_, std::max(capacity, 1), (interpolation == "quintic") ? TrajectoryInterpolator::Interpolation::Quintic : TrajectoryInterpolator::Interpolation::Cubic, orientation_offset, init_cmd.data());
+
+            sub_trajectory_ = n.subscribe<trajectory_msgs::JointTrajectory>("trajectory", 10, &CustomEffortController::trajectoryCB, this, hints);
+        }
+        else
+            sub_command_ = n.subscribe<std_msgs::Float64MultiArray>("command", 1, &CustomEffortController::commandCB, this, hints);
 
-        sub_command_ = n.subscribe<std_msgs::Float64MultiArray>("command", 1, &CustomEffortController::commandCB, this);
+        report_timer_ = n.createTimer(ros::Duration(0.1), &CustomEffortController::reportEvents, this);
 
         return true;
     }
 
     void CustomEffortController::update(const ros::Time& time, const ros::Duration& period)
     {
-        std::vector<double>& commands = *commands_buffer_.readFromRT();
+        if (space_ == OperationSpace::Task)
+            updateImpl<OperationSpace::Task>(time);
+        else
+            updateImpl<OperationSpace::Joint>(time);
+    }
 
-        Eigen::MatrixXd jac(6, n_joints_);
-        Eigen::MatrixXd jac_deriv(6, n_joints_);
-        Eigen::MatrixXd jac_t_pinv(n_joints_, 6);
-        Eigen::VectorXd eef(6);
+    template <CustomEffortController::OperationSpace Space>
+    void CustomEffortController::updateImpl(const ros::Time& time)
+    {
+        IIWA_CONTROL_RT_BEGIN();
 
-        if (operation_space_ == "task") {
-            iiwa_tools::RobotState robot_state;
-            robot_state.position.resize(n_joints_);
-            robot_state.velocity.resize(n_joints_);
+        commands_buffer_.update();
+        const CommandFrame* command = &commands_buffer_.readable();
 
-            for (size_t i = 0; i < n_joints_; i++) {
-                robot_state.position[i] = joints_[i].getPosition();
-                robot_state.velocity[i] = joints_[i].getVelocity();
+        for (unsigned int i = 0; i < n_joints_; i++) {
+            joint_state_.position_(i) = joints_[i].getPosition();
+            joint_state_.velocity_(i) = joints_[i].getVelocity();
+            if (!accelerations_.empty())
+                joint_state_.acceleration_(i) = accelerations_[i].getAcceleration();
+            joint_state_.force_(i) = joints_[i].getEffort();
+        }
+
+        if (Space == OperationSpace::Task) {
+            tools_state_.position = joint_state_.position_;
+            tools_state_.velocity = joint_state_.velocity_;
+
+            unsigned int flags = iiwa_tools::COMPUTE_FK | iiwa_tools::COMPUTE_JACOBIAN | iiwa_tools::COMPUTE_JACOBIAN_DERIV;
+            if (pinv_method_ == PseudoInverseMethod::DynamicallyConsistent)
+                flags |= iiwa_tools::COMPUTE_MASS_MATRIX;
+
+            tools_.compute(*tools_context_, tools_state_, flags, model_state_);
+            jac_ = model_state_.jacobian;
+            jac_deriv_ = model_state_.jacobian_deriv;
+
+            switch (pinv_method_) {
+            case PseudoInverseMethod::SVD:
+                jacobian_transpose_pinv_svd(jac_, jac_svd_, jac_t_pinv_, pinv_tolerance_);
+                break;
+            case PseudoInverseMethod::DLS:
+                jacobian_transpose_pinv_dls(jac_, task_ldlt_, jac_t_pinv_, pinv_damping_);
+                break;
+            case PseudoInverseMethod::DynamicallyConsistent:
+                jacobian_transpose_pinv_dynamic(jac_, model_state_.mass_matrix, mass_ldlt_, minv_jac_t_, task_ldlt_, jac_t_pinv_, pinv_damping_);
+                break;
             }
 
-            std::tie(jac, jac_deriv) = tools_.jacobians(robot_state);
-            jac_t_pinv = pseudo_inverse(Eigen::MatrixXd(jac.transpose()));
-            auto ee_state = tools_.perform_fk(robot_state);
+            const iiwa_tools::EefState& ee_state = model_state_.ee_state;
             Eigen::AngleAxisd aa(ee_state.orientation);
-            eef.head(3) = aa.axis() * aa.angle();
-            eef.tail(3) = ee_state.translation;
-        }
-
-        Eigen::VectorXd cmd(n_joints_);
-
-        cmd = Eigen::VectorXd::Map(commands.data(), commands.size());
-
-        robot_controllers::RobotState curr_state, robot_state;
-        curr_state.position_ = Eigen::VectorXd::Zero(n_joints_);
-        curr_state.velocity_ = Eigen::VectorXd::Zero(n_joints_);
-        curr_state.acceleration_ = Eigen::VectorXd::Zero(n_joints_);
-        curr_state.force_ = Eigen::VectorXd::Zero(n_joints_);
+            eef_.head(3) = aa.axis() * aa.angle();
+            eef_.tail(3) = ee_state.translation;
 
-        for (unsigned int i = 0; i < n_joints_; i++) {
-            curr_state.position_(i) = joints_[i].getPosition();
-            curr_state.velocity_(i) = joints_[i].getVelocity();
-            // curr_state.acceleration_(i) = joints_[i].getAcceleration();
-            // TO-DO: Fill acceleration
-            curr_state.force_(i) = joints_[i].getEffort();
-        }
-
-        if (operation_space_ == "task") {
-            if (null_space_control_)
-                robot_state = curr_state;
+            eef_vel_.noalias() = jac_ * joint_state_.velocity_;
+            eef_acc_.noalias() = jac_ * joint_state_.acceleration_;
+            eef_acc_.noalias() += jac_deriv_ * joint_state_.velocity_;
+            eef_force_.noalias() = jac_t_pinv_ * joint_state_.force_; // TO-DO: This is not perfect, but should be enough
 
-            Eigen::VectorXd pos = eef;
-            Eigen::VectorXd vel = jac * curr_state.velocity_;
-            Eigen::VectorXd acc = jac * curr_state.acceleration_ + jac_deriv * curr_state.velocity_;
-            Eigen::VectorXd f = jac_t_pinv * curr_state.force_; // TO-DO: This is not perfect, but should be enough
-
-            curr_state.position_ = pos.tail(3);
-            curr_state.velocity_ = vel.tail(3);
-            curr_state.acceleration_ = acc.tail(3);
-            curr_state.force_ = f.tail(3);
+            task_state_.position_ = eef_.tail(3);
+            task_state_.velocity_ = eef_vel_.tail(3);
+            task_state_.acceleration_ = eef_acc_.tail(3);
+            task_state_.force_ = eef_force_.tail(3);
 
             if (has_orientation_) {
-                curr_state.orientation_ = pos.head(3);
-                curr_state.angular_velocity_ = vel.head(3);
-                curr_state.angular_acceleration_ = acc.head(3);
-                curr_state.torque_ = f.head(3);
+                task_state_.orientation_ = eef_.head(3);
+                task_state_.angular_velocity_ = eef_vel_.head(3);
+                task_state_.angular_acceleration_ = eef_acc_.head(3);
+                task_state_.torque_ = eef_force_.head(3);
             }
         }
+        const robot_controllers::RobotState& curr_state = (Space == OperationSpace::Task) ? task_state_ : joint_state_;
 
-        // Update desired state in controller
-        robot_controllers::RobotState desired_state;
-        unsigned int size = curr_state.position_.size();
-        unsigned int index = 0;
-        if (controller_->GetInput().GetType() & robot_controllers::IOType::Orientation) {
-            desired_state.orientation_ = cmd.segment(index, 3);
-            index += 3;
-        }
-        if (controller_->GetInput().GetType() & robot_controllers::IOType::Position) {
-            desired_state.position_ = cmd.segment(index, size);
-            index += size;
+        if (collision_check_) {
+            // The task space update already set the positions
+            if (Space == OperationSpace::Joint)
+                tools_state_.position = joint_state_.position_;
+            collision_distance_ = collision_model_.compute(tools_.body_poses(*tools_context_, tools_state_), *collision_ws_);
         }
-        if (controller_->GetInput().GetType() & robot_controllers::IOType::AngularVelocity) {
-            desired_state.angular_velocity_ = cmd.segment(index, 3);
-            index += 3;
-        }
-        if (controller_->GetInput().GetType() & robot_controllers::IOType::Velocity) {
-            desired_state.velocity_ = cmd.segment(index, size);
-            index += size;
+
+        // The initial command (sequence 0) already holds the robot
+        bool stale = (command_timeout_ > 0. && command->sequence > 0 && (time - command->stamp).toSec() > command_timeout_);
+        if (trajectory_input_) {
+            trajectory_.sample(time, trajectory_command_);
+            trajectory_command_.sequence = trajectory_sequence_.load(std::memory_order_acquire);
+            command = &trajectory_command_;
         }
-        if (controller_->GetInput().GetType() & robot_controllers::IOType::AngularAcceleration) {
-            desired_state.angular_acceleration_ = cmd.segment(index, 3);
-            index += 3;
+        else if (stale) {
+            if (!holding_) {
+                holdCommand(curr_state, command->sequence);
+                holding_ = true;
+                report_hold_.store(true, std::memory_order_relaxed);
+            }
+            command = &hold_command_;
         }
-        if (controller_->GetInput().GetType() & robot_controllers::IOType::Acceleration) {
-            desired_state.acceleration_ = cmd.segment(index, size);
-            index += size;
+        else if (holding_) {
+            holding_ = false;
+            report_resume_.store(true, std::memory_order_relaxed);
         }
-        if (controller_->GetInput().GetType() & robot_controllers::IOType::Torque) {
-            desired_state.torque_ = cmd.segment(index, 3);
-            index += 3;
+
+        // Stop mode: hold the current state when too close, until a new command releases the robot
+        if (collision_check_ && collision_mode_ == CollisionMode::Stop) {
+            bool stopped = collision_stopped_;
+            if (collisionStop(command->sequence)) {
+                if (!stopped) {
+                    holdCommand(curr_state, command->sequence);
+                    report_collision_distance_.store(collision_distance_, std::memory_order_relaxed);
+                    report_collision_stop_.store(true, std::memory_order_release);
+                }
+                command = &hold_command_;
+            }
+            else if (stopped)
+                report_collision_release_.store(true, std::memory_order_relaxed);
         }
-        if (controller_->GetInput().GetType() & robot_controllers::IOType::Force) {
-            desired_state.force_ = cmd.segment(index, size);
-            // index += size;
+
+        Eigen::Map<const Eigen::VectorXd> cmd(command->data, command->size);
+
+        // Update desired state in controller
+        for (unsigned int i = 0; i < num_command_slices_; i++) {
+            const CommandSlice& slice = command_slices_[i];
+            desired_state_.*slice.field = cmd.segment(slice.offset, slice.size);
         }
 
-        controller_->SetInput(desired_state);
+        // The controllers are plugins, their allocations are not ours to check
+        IIWA_CONTROL_RT_END();
+
+        controller_->SetInput(desired_state_);
 
         // Update control torques given current velocity
         controller_->Update(curr_state);
 
-        Eigen::VectorXd output; // = Eigen::VectorXd::Zero(space_dim_);
-        if (operation_space_ == "task") {
-            output = Eigen::VectorXd::Zero(2 * space_dim_);
+        IIWA_CONTROL_RT_BEGIN();
+
+        if (Space == OperationSpace::Task) {
+            task_output_.setZero();
             if (controller_->GetOutput().GetType() & robot_controllers::IOType::Force)
-                output.tail(3) = controller_->GetOutput().desired_.force_;
+                task_output_.tail(3) = controller_->GetOutput().desired_.force_;
             if (controller_->GetOutput().GetType() & robot_controllers::IOType::Torque)
-                output.head(3) = controller_->GetOutput().desired_.torque_;
-        }
-        else // regular controller
-            output = controller_->GetOutput().desired_.force_;
+                task_output_.head(3) = controller_->GetOutput().desired_.torque_;
 
-        if (operation_space_ == "task") {
-            // output.head(3) = Eigen::VectorXd::Zero(3);
-            output = jac.transpose() * output;
+            // task_output_.head(3) = Eigen::VectorXd::Zero(3);
+            effort_.noalias() = jac_.transpose() * task_output_;
 
             // Add null-space signal if wanted
             if (null_space_control_) {
-                Eigen::VectorXd null_space_signal = null_space_Kp_ * (null_space_joint_config_ - robot_state.position_) - null_space_Kd_ * robot_state.velocity_;
-                Eigen::VectorXd null_space_force = (Eigen::MatrixXd::Identity(n_joints_, n_joints_) - jac.transpose() * jac_t_pinv) * null_space_signal;
-                for (int i = 0; i < null_space_force.size(); i++) {
-                    if (null_space_force(i) > null_space_max_torque_)
-                        null_space_force(i) = null_space_max_torque_;
-                    else if (null_space_force(i) < -null_space_max_torque_)
-                        null_space_force(i) = -null_space_max_torque_;
+                null_space_signal_ = null_space_Kp_ * (null_space_joint_config_ - joint_state_.position_) - null_space_Kd_ * joint_state_.velocity_;
+                // (I - J^T pinv(J^T)) * signal, without forming the NxN projector
+                null_space_task_.noalias() = jac_t_pinv_ * null_space_signal_;
+                null_space_force_ = null_space_signal_;
+                null_space_force_.noalias() -= jac_.transpose() * null_space_task_;
+                for (int i = 0; i < null_space_force_.size(); i++) {
+                    if (null_space_force_(i) > null_space_max_torque_)
+                        null_space_force_(i) = null_space_max_torque_;
+                    else if (null_space_force_(i) < -null_space_max_torque_)
+                        null_space_force_(i) = -null_space_max_torque_;
                 }
-                output = output + null_space_force;
+                effort_ += null_space_force_;
+            }
+        }
+        else // regular controller
+            effort_ = controller_->GetOutput().desired_.force_;
+
+        if (collision_check_ && collision_mode_ == CollisionMode::Repulsion && collision_distance_ < collision_activation_) {
+            collisionRepulsion();
+            if (Space == OperationSpace::Task) {
+                // Only in the null-space of the task, like the null-space control
+                null_space_task_.noalias() = jac_t_pinv_ * collision_force_;
+                collision_force_.noalias() -= jac_.transpose() * null_space_task_;
             }
+            effort_ += collision_force_.cwiseMin(collision_max_torque_).cwiseMax(-collision_max_torque_);
         }
 
-        // ROS_INFO_STREAM("Effort: " << output.transpose());
+        // ROS_INFO_STREAM("Effort: " << effort_.transpose());
 
-        std::vector<double> commanded_effort(n_joints_, 0.);
+        enforceJointLimits();
+        for (unsigned int i = 0; i < n_joints_; i++)
+            joints_[i].setCommand(effort_(i));
 
-        Eigen::VectorXd::Map(commanded_effort.data(), commanded_effort.size()) = output;
+        IIWA_CONTROL_RT_END();
+    }
 
-        for (unsigned int i = 0; i < n_joints_; i++) {
-            enforceJointLimits(commanded_effort[i], i);
-            joints_[i].setCommand(commanded_effort[i]);
+    void CustomEffortController::allocateWorkspace()
+    {
+        joint_state_.position_ = Eigen::VectorXd::Zero(n_joints_);
+        joint_state_.velocity_ = Eigen::VectorXd::Zero(n_joints_);
+        joint_state_.acceleration_ = Eigen::VectorXd::Zero(n_joints_);
+        joint_state_.force_ = Eigen::VectorXd::Zero(n_joints_);
+
+        effort_ = JointVector::Zero(n_joints_);
+
+        if (space_ == OperationSpace::Task) {
+            tools_state_.position = Eigen::VectorXd::Zero(n_joints_);
+            tools_state_.velocity = Eigen::VectorXd::Zero(n_joints_);
+
+            model_state_.jacobian = Eigen::MatrixXd::Zero(6, n_joints_);
+            model_state_.jacobian_deriv = Eigen::MatrixXd::Zero(6, n_joints_);
+
+            jac_ = Jacobian::Zero(6, n_joints_);
+            jac_deriv_ = Jacobian::Zero(6, n_joints_);
+            jac_t_pinv_ = Jacobian::Zero(6, n_joints_);
+            jac_svd_ = JacobianSVD(6, n_joints_, Eigen::ComputeThinU | Eigen::ComputeThinV);
+            if (pinv_method_ == PseudoInverseMethod::DynamicallyConsistent) {
+                model_state_.mass_matrix = Eigen::MatrixXd::Zero(n_joints_, n_joints_);
+                minv_jac_t_ = JacobianTranspose::Zero(n_joints_, 6);
+                mass_ldlt_ = MassLDLT(n_joints_);
+            }
+
+            task_state_.position_ = Eigen::VectorXd::Zero(3);
+            task_state_.velocity_ = Eigen::VectorXd::Zero(3);
+            task_state_.acceleration_ = Eigen::VectorXd::Zero(3);
+            task_state_.force_ = Eigen::VectorXd::Zero(3);
+            if (has_orientation_) {
+                task_state_.orientation_ = Eigen::VectorXd::Zero(3);
+                task_state_.angular_velocity_ = Eigen::VectorXd::Zero(3);
+                task_state_.angular_acceleration_ = Eigen::VectorXd::Zero(3);
+                task_state_.torque_ = Eigen::VectorXd::Zero(3);
+            }
+
+            null_space_signal_ = JointVector::Zero(n_joints_);
+            null_space_force_ = JointVector::Zero(n_joints_);
+        }
+
+        if (collision_check_) {
+            tools_state_.position = Eigen::VectorXd::Zero(n_joints_);
+            collision_gradient_ = JointVector::Zero(n_joints_);
+            collision_force_ = JointVector::Zero(n_joints_);
+        }
+
+        // Only the fields of the controller's input are set in update()
+        for (unsigned int i = 0; i < num_command_slices_; i++)
+            desired_state_.*command_slices_[i].field = Eigen::VectorXd::Zero(command_slices_[i].size);
+    }
+
+    void CustomEffortController::parseCommandLayout()
+    {
+        // Order of the command entries (same as the IOType flags)
+        static const std::pair<robot_controllers::IOType, Eigen::VectorXd robot_controllers::RobotState::*> layout[] = {
+            {robot_controllers::IOType::Orientation, &robot_controllers::RobotState::orientation_},
+            {robot_controllers::IOType::Position, &robot_controllers::RobotState::position_},
+            {robot_controllers::IOType::AngularVelocity, &robot_controllers::RobotState::angular_velocity_},
+            {robot_controllers::IOType::Velocity, &robot_controllers::RobotState::velocity_},
+            {robot_controllers::IOType::AngularAcceleration, &robot_controllers::RobotState::angular_acceleration_},
+            {robot_controllers::IOType::Acceleration, &robot_controllers::RobotState::acceleration_},
+            {robot_controllers::IOType::Torque, &robot_controllers::RobotState::torque_},
+            {robot_controllers::IOType::Force, &robot_controllers::RobotState::force_}};
+
+        robot_controllers::IOTypes input_type = controller_->GetInput().GetType();
+
+        num_command_slices_ = 0;
+        cmd_dim_ = 0;
+        for (const auto& entry : layout) {
+            if (!(input_type & entry.first))
+                continue;
+
+            bool rotational = (entry.first == robot_controllers::IOType::Orientation || entry.first == robot_controllers::IOType::AngularVelocity
+                || entry.first == robot_controllers::IOType::AngularAcceleration || entry.first == robot_controllers::IOType::Torque);
+
+            CommandSlice& slice = command_slices_[num_command_slices_++];
+            slice.field = entry.second;
+            slice.offset = cmd_dim_;
+            slice.size = rotational ? 3 : space_dim_; // rotational quantities are fixed to 3D
+
+            cmd_dim_ += slice.size;
         }
     }
 
     void CustomEffortController::commandCB(const std_msgs::Float64MultiArrayConstPtr& msg)
     {
-        if (msg->data.size() != cmd_dim_) {
-            ROS_ERROR_STREAM("Dimension of command (" << msg->data.size() << ") is not correct! Not executing!");
-            return;
+        setCommand(msg->data.data(), msg->data.size(), ros::Time::now());
+    }
+
+    bool CustomEffortController::setCommand(const double* data, unsigned int size, const ros::Time& stamp)
+    {
+        if (size != cmd_dim_) {
+            ROS_ERROR_STREAM("Dimension of command (" << size << ") is not correct! Not executing!");
+            return false;
         }
 
-        commands_buffer_.writeFromNonRT(msg->data);
+        CommandFrame& frame = commands_buffer_.writable();
+        std::copy(data, data + size, frame.data);
+        frame.size = cmd_dim_;
+        frame.stamp = stamp;
+        frame.sequence = ++command_sequence_;
+        commands_buffer_.publish();
+
+        return true;
     }
 
-    void CustomEffortController::enforceJointLimits(double& command, unsigned int index)
+    void CustomEffortController::trajectoryCB(const trajectory_msgs::JointTrajectoryConstPtr& msg)
     {
-        // Check that this joint has applicable limits
-        if (command > joint_urdfs_[index]->limits->effort) // above upper limit
-        {
-            command = joint_urdfs_[index]->limits->effort;
+        // The positions of a point follow the layout of the command topic, velocities and accelerations are optional
+        for (auto& point : msg->points) {
+            if (point.positions.size() != cmd_dim_ || (!point.velocities.empty() && point.velocities.size() != cmd_dim_) || (!point.accelerations.empty() && point.accelerations.size() != cmd_dim_)) {
+                ROS_ERROR_STREAM("Dimension of trajectory point (" << point.positions.size() << ") is not correct! Not executing!");
+                return;
+            }
         }
-        else if (command < -joint_urdfs_[index]->limits->effort) // below lower limit
-        {
-            command = -joint_urdfs_[index]->limits->effort;
+
+        ros::Time start = msg->header.stamp.isZero() ? ros::Time::now() : msg->header.stamp;
+
+        size_t queued = 0;
+        Waypoint waypoint;
+        waypoint.size = cmd_dim_;
+        for (auto& point : msg->points) {
+            waypoint.time = start + point.time_from_start;
+            waypoint.has_velocity = !point.velocities.empty();
+            waypoint.has_acceleration = !point.accelerations.empty();
+            std::copy(point.positions.begin(), point.positions.end(), waypoint.position);
+            std::copy(point.velocities.begin(), point.velocities.end(), waypoint.velocity);
+            std::copy(point.accelerations.begin(), point.accelerations.end(), waypoint.acceleration);
+
+            if (trajectory_.push(waypoint))
+                queued++;
         }
+
+        if (queued > 0)
+            trajectory_sequence_.fetch_add(1, std::memory_order_release);
+
+        if (queued < msg->points.size())
+            ROS_WARN_STREAM("Dropped " << (msg->points.size() - queued) << " trajectory point(s) that were not after the queued ones or did not fit in the queue.");
+    }
+
+    void CustomEffortController::reportEvents(const ros::TimerEvent& event)
+    {
+        if (report_hold_.exchange(false, std::memory_order_relaxed))
+            ROS_WARN_STREAM_NAMED("CustomEffortController", "No command for more than " << command_timeout_ << "s, holding the current state.");
+        if (report_resume_.exchange(false, std::memory_order_relaxed))
+            ROS_INFO_STREAM_NAMED("CustomEffortController", "Receiving commands again.");
+        if (report_collision_stop_.exchange(false, std::memory_order_acquire))
+            ROS_WARN_STREAM_NAMED("CustomEffortController", "Collision distance " << report_collision_distance_.load(std::memory_order_relaxed) << "m is below " << collision_stop_distance_ << "m, holding the current state until a new command.");
+        if (report_collision_release_.exchange(false, std::memory_order_relaxed))
+            ROS_INFO_STREAM_NAMED("CustomEffortController", "New command, releasing the collision stop.");
+    }
+
+    void CustomEffortController::holdCommand(const robot_controllers::RobotState& curr_state, uint64_t sequence)
+    {
+        hold_command_.size = cmd_dim_;
+        hold_command_.stamp = ros::Time::now();
+        hold_command_.sequence = sequence;
+        std::fill(hold_command_.data, hold_command_.data + cmd_dim_, 0.);
+
+        for (unsigned int i = 0; i < num_command_slices_; i++) {
+            const CommandSlice& slice = command_slices_[i];
+            if (slice.field == &robot_controllers::RobotState::position_ || slice.field == &robot_controllers::RobotState::orientation_)
+                Eigen::VectorXd::Map(hold_command_.data + slice.offset, slice.size) = curr_state.*slice.field;
+        }
+    }
+
+    bool CustomEffortController::collisionStop(uint64_t sequence)
+    {
+        if (collision_stopped_) {
+            if (sequence <= collision_stop_sequence_)
+                return true;
+
+            // Released: the new command may move the robot away, but not any closer
+            collision_stopped_ = false;
+            collision_release_distance_ = collision_distance_;
+            return false;
+        }
+
+        if (collision_distance_ >= collision_stop_distance_) {
+            collision_release_distance_ = std::numeric_limits<double>::infinity();
+            return false;
+        }
+
+        // 1mm closer than at the release, so that the measurement noise does not stop it again
+        if (collision_distance_ < collision_release_distance_ - 1e-3) {
+            collision_stopped_ = true;
+            collision_stop_sequence_ = sequence;
+            return true;
+        }
+
+        return false;
+    }
+
+    void CustomEffortController::collisionRepulsion()
+    {
+        // Each pair within the activation distance pushes along its distance gradient, proportionally to the penetration
+        collision_force_.setZero();
+        const std::vector<sva::PTransformd>& body_poses = tools_context_->mbc.bodyPosW;
+        for (const iiwa_tools::Proximity& proximity : collision_ws_->pairs) {
+            if (proximity.distance >= collision_activation_)
+                continue;
+
+            collision_model_.gradient(body_poses, proximity, collision_gradient_);
+            collision_force_ += collision_gain_ * (collision_activation_ - proximity.distance) * collision_gradient_;
+        }
+    }
+
+    void CustomEffortController::enforceJointLimits()
+    {
+        effort_ = effort_.cwiseMin(effort_limits_).cwiseMax(-effort_limits_);
     }
 } // namespace iiwa_control
 
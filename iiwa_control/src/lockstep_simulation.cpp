@@ -0,0 +1,458 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#include <iiwa_control/lockstep_simulation.hpp>
+
+// URDF
+#include <urdf/model.h>
+
+#include <iiwa_tools/model_loader.h>
+
+// std headers
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <thread>
+
+// mkdir
+#include <sys/stat.h>
+
+namespace iiwa_control {
+    bool SimulatedRobot::init(const urdf::Model& urdf, const mc_rbdyn_urdf::URDFParserResult& rbdyn_urdf, const std::string& end_effector, const SimulationSettings& settings)
+    {
+        settings_ = settings;
+
+        tools_.init_rbdyn(rbdyn_urdf, end_effector);
+        tools_context_ = tools_.create_context();
+
+        joint_names_ = tools_.get_joint_names();
+        n_joints_ = joint_names_.size();
+
+        // Limits, as Gazebo enforces them (0: none)
+        effort_limits_ = Eigen::VectorXd::Zero(n_joints_);
+        lower_limits_ = Eigen::VectorXd::Zero(n_joints_);
+        upper_limits_ = Eigen::VectorXd::Zero(n_joints_);
+        for (unsigned int i = 0; i < n_joints_; i++) {
+            urdf::JointConstSharedPtr joint = urdf.getJoint(joint_names_[i]);
+            if (!joint || !joint->limits)
+                continue;
+            effort_limits_[i] = joint->limits->effort;
+            if (joint->type != urdf::Joint::CONTINUOUS) {
+                lower_limits_[i] = joint->limits->lower;
+                upper_limits_[i] = joint->limits->upper;
+            }
+        }
+
+        position_ = Eigen::VectorXd::Zero(n_joints_);
+        velocity_ = Eigen::VectorXd::Zero(n_joints_);
+        effort_ = Eigen::VectorXd::Zero(n_joints_);
+        acceleration_ = Eigen::VectorXd::Zero(n_joints_);
+        effort_command_ = Eigen::VectorXd::Zero(n_joints_);
+
+        for (unsigned int i = 0; i < n_joints_; i++) {
+            hardware_interface::JointStateHandle state_handle(joint_names_[i], &position_[i], &velocity_[i], &effort_[i]);
+            joint_state_interface_.registerHandle(state_handle);
+            effort_joint_interface_.registerHandle(hardware_interface::JointHandle(state_handle, &effort_command_[i]));
+            joint_acceleration_interface_.registerHandle(iiwa_tools::JointAccelerationHandle(joint_names_[i], &acceleration_[i]));
+        }
+
+        registerInterface(&joint_state_interface_);
+        registerInterface(&effort_joint_interface_);
+        registerInterface(&joint_acceleration_interface_);
+
+        tools_state_.position = position_;
+        tools_state_.velocity = velocity_;
+        mass_ldlt_ = Eigen::LDLT<Eigen::MatrixXd>(n_joints_);
+        rbd_gravity_ = -settings_.gravity;
+
+        reset(position_);
+
+        return true;
+    }
+
+    void SimulatedRobot::reset(const Eigen::VectorXd& positions)
+    {
+        position_ = positions;
+        velocity_.setZero();
+        effort_.setZero();
+        acceleration_.setZero();
+        effort_command_.setZero();
+        saturated_ = 0;
+
+        read();
+    }
+
+    void SimulatedRobot::read()
+    {
+        // End-effector pose and the compensation of GravityCompensationHWSim (IiwaTools' gravity with the world's gravity)
+        tools_state_.position = position_;
+        tools_state_.velocity = velocity_;
+        tools_.compute(*tools_context_, tools_state_, iiwa_tools::COMPUTE_FK | iiwa_tools::COMPUTE_GRAVITY, model_state_, settings_.gravity);
+    }
+
+    void SimulatedRobot::applyCommands()
+    {
+        saturated_ = 0;
+        for (unsigned int i = 0; i < n_joints_; i++) {
+            double effort = effort_command_[i];
+            if (settings_.gravity_compensation)
+                effort += model_state_.gravity[i];
+
+            if (effort_limits_[i] > 0. && std::abs(effort) >= effort_limits_[i]) {
+                effort = std::min(std::max(effort, -effort_limits_[i]), effort_limits_[i]);
+                saturated_++;
+            }
+            effort_[i] = effort;
+        }
+    }
+
+    void SimulatedRobot::integrate()
+    {
+        double dt = settings_.control_period / settings_.substeps;
+
+        for (unsigned int s = 0; s < settings_.substeps; s++) {
+            tools_state_.position = position_;
+            tools_state_.velocity = velocity_;
+            tools_.compute(*tools_context_, tools_state_, iiwa_tools::COMPUTE_GRAVITY | iiwa_tools::COMPUTE_MASS_MATRIX, dynamics_state_, rbd_gravity_);
+
+            // H qdd + C = tau, where C (gravity and Coriolis) is the opposite of the computed compensation
+            mass_ldlt_.compute(dynamics_state_.mass_matrix);
+            acceleration_ = mass_ldlt_.solve(effort_ + dynamics_state_.gravity - settings_.joint_damping * velocity_);
+
+            // Semi-implicit Euler
+            velocity_ += dt * acceleration_;
+            position_ += dt * velocity_;
+
+            // The joints stop at their position limits
+            for (unsigned int i = 0; i < n_joints_; i++) {
+                if (lower_limits_[i] >= upper_limits_[i])
+                    continue;
+                if (position_[i] < lower_limits_[i]) {
+                    position_[i] = lower_limits_[i];
+                    velocity_[i] = std::max(velocity_[i], 0.);
+                }
+                else if (position_[i] > upper_limits_[i]) {
+                    position_[i] = upper_limits_[i];
+                    velocity_[i] = std::min(velocity_[i], 0.);
+                }
+            }
+        }
+    }
+
+    LockstepSimulation::LockstepSimulation(ros::NodeHandle nh) : nh_(nh) {}
+
+    bool LockstepSimulation::init()
+    {
+        nh_.param<double>("duration", settings_.duration, 5.);
+        nh_.param<double>("control_period", settings_.control_period, 0.001);
+        int substeps, record_every;
+        nh_.param<int>("substeps", substeps, 1);
+        nh_.param<int>("record_every", record_every, 10);
+        settings_.substeps = std::max(substeps, 1);
+        settings_.record_every = std::max(record_every, 1);
+        nh_.param<bool>("gravity_compensation", settings_.gravity_compensation, true);
+        nh_.param<double>("joint_damping", settings_.joint_damping, 0.);
+
+        std::vector<double> gravity;
+        nh_.param<std::vector<double>>("gravity", gravity, std::vector<double>{0., 0., -9.81});
+        if (gravity.size() != 3) {
+            ROS_ERROR_STREAM("The gravity should have 3 elements!");
+            return false;
+        }
+        settings_.gravity = Eigen::Vector3d::Map(gravity.data());
+
+        if (settings_.duration <= 0. || settings_.control_period <= 0.) {
+            ROS_ERROR_STREAM("The duration and the control period should be positive!");
+            return false;
+        }
+
+        nh_.param<std::string>("end_effector", end_effector_, "iiwa_link_ee");
+        nh_.param<std::string>("output_dir", output_dir_, "");
+        nh_.param<int>("num_threads", num_threads_, 0);
+
+        // The robot description, as the controllers get it (parsed once for all the instances and their controllers)
+        std::string robot_description, full_param;
+        nh_.param<std::string>("robot_description", robot_description, "robot_description");
+        std::shared_ptr<const urdf::Model> urdf;
+        std::shared_ptr<const mc_rbdyn_urdf::URDFParserResult> rbdyn_urdf;
+        if (nh_.searchParam(robot_description, full_param)) {
+            iiwa_tools::ModelLoader::instance().prefetch(nh_, full_param, 0.);
+            urdf = iiwa_tools::ModelLoader::instance().urdf_model(nh_, full_param, 0.);
+            rbdyn_urdf = iiwa_tools::ModelLoader::instance().rbdyn_model(nh_, full_param, 0.);
+        }
+        if (!urdf || !rbdyn_urdf) {
+            ROS_ERROR_STREAM("Could not find the robot description in parameter [" << robot_description << "].");
+            return false;
+        }
+
+        std::vector<std::string> names;
+        if (!nh_.getParam("instances", names) || names.empty()) {
+            ROS_ERROR_STREAM("Failed to getParam 'instances' (namespace: " << nh_.getNamespace() << ").");
+            return false;
+        }
+
+        instances_.clear();
+        for (const std::string& name : names) {
+            std::unique_ptr<SimulationInstance> instance(new SimulationInstance);
+            instance->name = name;
+            if (!initInstance(*instance, *urdf, *rbdyn_urdf)) {
+                ROS_ERROR_STREAM("Could not set up the instance '" << name << "'.");
+                return false;
+            }
+            instances_.push_back(std::move(instance));
+        }
+
+        size_t num_threads = (num_threads_ > 0) ? num_threads_ : std::max(1u, std::thread::hardware_concurrency());
+        pool_.reset(new iiwa_tools::ThreadPool(std::min(num_threads, instances_.size())));
+
+        ROS_INFO_STREAM("Simulating " << instances_.size() << " instance(s) for " << settings_.duration << "s on " << pool_->size() << " thread(s)");
+
+        return true;
+    }
+
+    bool LockstepSimulation::initInstance(SimulationInstance& instance, const urdf::Model& urdf, const mc_rbdyn_urdf::URDFParserResult& rbdyn_urdf)
+    {
+        // Controller parameters, and the episode in simulation/
+        ros::NodeHandle instance_nh(nh_, instance.name);
+
+        if (!instance.robot.init(urdf, rbdyn_urdf, end_effector_, settings_))
+            return false;
+
+        unsigned int n_joints = instance.robot.numJoints();
+
+        std::vector<double> initial_positions;
+        instance_nh.param<std::vector<double>>("simulation/initial_positions", initial_positions, std::vector<double>());
+        if (!initial_positions.empty() && initial_positions.size() != n_joints) {
+            ROS_ERROR_STREAM("simulation/initial_positions should have " << n_joints << " elements!");
+            return false;
+        }
+        Eigen::VectorXd q0 = Eigen::VectorXd::Zero(n_joints);
+        if (!initial_positions.empty())
+            q0 = Eigen::VectorXd::Map(initial_positions.data(), n_joints);
+        instance.robot.reset(q0);
+
+        // The controller gets the same interfaces as on the robot (or in Gazebo)
+        instance.controller.reset(new CustomEffortController);
+        controller_interface::ControllerBase* controller = instance.controller.get();
+        controller_interface::ControllerBase::ClaimedResources claimed_resources;
+        if (!controller->initRequest(&instance.robot, nh_, instance_nh, claimed_resources))
+            return false;
+
+        // Without a command, the controller keeps its initial one (the initial pose)
+        instance_nh.param<std::vector<double>>("simulation/command", instance.command, std::vector<double>());
+        if (!instance.command.empty() && instance.command.size() != instance.controller->commandSize()) {
+            ROS_ERROR_STREAM("simulation/command should have " << instance.controller->commandSize() << " elements!");
+            return false;
+        }
+
+        std::vector<double> target;
+        instance_nh.param<std::vector<double>>("simulation/target", target, std::vector<double>());
+        if (!target.empty() && target.size() != n_joints && target.size() != 3) {
+            ROS_ERROR_STREAM("simulation/target should have " << n_joints << " (joint positions) or 3 (end-effector position) elements!");
+            return false;
+        }
+        instance.target = Eigen::VectorXd::Map(target.data(), target.size());
+        instance_nh.param<double>("simulation/settling_tolerance", instance.settling_tolerance, 0.01);
+
+        // Recorded rows, allocated once
+        size_t steps = std::llround(settings_.duration / settings_.control_period);
+        instance.samples.clear();
+        instance.samples.reserve((steps / settings_.record_every + 1) * (1 + 3 * n_joints + 3));
+
+        return true;
+    }
+
+    void LockstepSimulation::run()
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        pool_->parallel_for(instances_.size(), [&](size_t i, size_t) {
+            runInstance(*instances_[i]);
+        });
+
+        double wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double simulated = 0.;
+        for (auto& instance : instances_)
+            simulated += instance->metrics.duration;
+
+        ROS_INFO_STREAM("Simulated " << simulated << "s in " << wall_time << "s (" << (simulated / wall_time) << "x real-time)");
+
+        for (auto& instance : instances_) {
+            const EpisodeMetrics& m = instance->metrics;
+            ROS_INFO_STREAM(instance->name << ": " << (m.diverged ? "DIVERGED, " : "") << "rms effort " << m.rms_effort << ", max effort " << m.max_effort
+                                           << ", saturation " << m.saturation_ratio << ", final velocity " << m.final_velocity
+                                           << ", final error " << m.final_error << ", rms error " << m.rms_error << ", settling time " << m.settling_time
+                                           << ", update " << m.update_time << "us");
+        }
+    }
+
+    void LockstepSimulation::runInstance(SimulationInstance& instance)
+    {
+        SimulatedRobot& robot = instance.robot;
+        CustomEffortController& controller = *instance.controller;
+        controller_interface::ControllerBase& controller_base = controller;
+
+        EpisodeMetrics& m = instance.metrics;
+        m = EpisodeMetrics();
+
+        // Simulated time: the episodes are reproducible whatever the wall time
+        ros::Time start(1.);
+        ros::Duration period(settings_.control_period);
+        size_t steps = std::llround(settings_.duration / settings_.control_period);
+
+        controller_base.startRequest(start);
+        if (!instance.command.empty())
+            controller.setCommand(instance.command.data(), instance.command.size(), start);
+
+        double effort_sq = 0., update_time = 0., error_sq = 0.;
+        size_t saturated = 0, cycles = 0;
+        bool has_target = (instance.target.size() > 0);
+        bool joint_target = (instance.target.size() == robot.numJoints());
+        double unsettled = -1.; // last time the error was above the tolerance
+        Eigen::Vector3d last_ee = robot.endEffector().translation;
+
+        for (size_t k = 0; k < steps; k++) {
+            ros::Time time = start + ros::Duration(k * settings_.control_period);
+
+            robot.read();
+
+            auto update_start = std::chrono::steady_clock::now();
+            controller_base.updateRequest(time, period);
+            update_time += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - update_start).count();
+
+            robot.applyCommands();
+
+            // Metrics and samples of the state at this time, with the efforts applied from it
+            const Eigen::Vector3d& ee = robot.endEffector().translation;
+            if (k > 0)
+                m.path_length += (ee - last_ee).norm();
+            last_ee = ee;
+
+            effort_sq += robot.efforts().squaredNorm();
+            m.max_effort = std::max(m.max_effort, robot.efforts().cwiseAbs().maxCoeff());
+            saturated += robot.saturated();
+
+            if (has_target) {
+                double error = joint_target ? (robot.positions() - instance.target).norm() : (ee - instance.target).norm();
+                error_sq += error * error;
+                m.final_error = error;
+                if (error > instance.settling_tolerance)
+                    unsettled = (time - start).toSec();
+            }
+
+            if (k % settings_.record_every == 0)
+                record(instance, (time - start).toSec());
+
+            robot.integrate();
+            cycles++;
+
+            if (!robot.positions().allFinite() || !robot.velocities().allFinite()) {
+                ROS_WARN_STREAM(instance.name << ": the simulation diverged at " << (time - start).toSec() << "s.");
+                m.diverged = true;
+                break;
+            }
+        }
+
+        controller_base.stopRequest(start + ros::Duration(cycles * settings_.control_period));
+
+        m.duration = cycles * settings_.control_period;
+        if (cycles > 0) {
+            m.rms_effort = std::sqrt(effort_sq / (cycles * robot.numJoints()));
+            m.saturation_ratio = static_cast<double>(saturated) / (cycles * robot.numJoints());
+            m.rms_error = std::sqrt(error_sq / cycles);
+            m.update_time = update_time / cycles;
+        }
+        m.final_velocity = robot.velocities().norm();
+        if (has_target)
+            m.settling_time = (m.final_error > instance.settling_tolerance || m.diverged) ? -1. : unsettled + settings_.control_period;
+    }
+
+    void LockstepSimulation::record(SimulationInstance& instance, double time)
+    {
+        const SimulatedRobot& robot = instance.robot;
+        std::vector<double>& samples = instance.samples;
+
+        samples.push_back(time);
+        samples.insert(samples.end(), robot.positions().data(), robot.positions().data() + robot.numJoints());
+        samples.insert(samples.end(), robot.velocities().data(), robot.velocities().data() + robot.numJoints());
+        samples.insert(samples.end(), robot.efforts().data(), robot.efforts().data() + robot.numJoints());
+        samples.insert(samples.end(), robot.endEffector().translation.data(), robot.endEffector().translation.data() + 3);
+    }
+
+    bool LockstepSimulation::writeResults() const
+    {
+        if (output_dir_.empty())
+            return true;
+
+        if (mkdir(output_dir_.c_str(), 0755) != 0 && errno != EEXIST) {
+            ROS_ERROR_STREAM("Could not create the output directory " << output_dir_ << ".");
+            return false;
+        }
+
+        // Trajectories: one file per instance
+        for (auto& instance : instances_) {
+            std::string file_name = instance->name;
+            std::replace(file_name.begin(), file_name.end(), '/', '_');
+            std::ofstream file(output_dir_ + "/" + file_name + ".csv");
+            if (!file) {
+                ROS_ERROR_STREAM("Could not write the trajectory of " << instance->name << ".");
+                return false;
+            }
+
+            const std::vector<std::string>& joints = instance->robot.jointNames();
+            file << "time";
+            for (const char* prefix : {"position_", "velocity_", "effort_"})
+                for (const std::string& joint : joints)
+                    file << "," << prefix << joint;
+            file << ",ee_x,ee_y,ee_z\n";
+
+            size_t cols = 1 + 3 * joints.size() + 3;
+            for (size_t row = 0; row + cols <= instance->samples.size(); row += cols) {
+                for (size_t c = 0; c < cols; c++)
+                    file << (c > 0 ? "," : "") << instance->samples[row + c];
+                file << "\n";
+            }
+        }
+
+        // Metrics: one row per instance
+        std::ofstream file(output_dir_ + "/metrics.csv");
+        if (!file) {
+            ROS_ERROR_STREAM("Could not write the metrics.");
+            return false;
+        }
+
+        file << "instance,diverged,duration,rms_effort,max_effort,saturation_ratio,final_velocity,path_length,final_error,rms_error,settling_time,update_time_us\n";
+        for (auto& instance : instances_) {
+            const EpisodeMetrics& m = instance->metrics;
+            file << instance->name << "," << m.diverged << "," << m.duration << "," << m.rms_effort << "," << m.max_effort << "," << m.saturation_ratio << ","
+                 << m.final_velocity << "," << m.path_length << "," << m.final_error << "," << m.rms_error << "," << m.settling_time << "," << m.update_time << "\n";
+        }
+
+        ROS_INFO_STREAM("Results written to " << output_dir_);
+
+        return true;
+    }
+} // namespace iiwa_control
@@ -0,0 +1,41 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#include <ros/ros.h>
+
+#include <iiwa_control/lockstep_simulation.hpp>
+
+int main(int argc, char** argv)
+{
+    ros::init(argc, argv, "lockstep_simulation");
+    ros::NodeHandle nh("~");
+
+    iiwa_control::LockstepSimulation simulation(nh);
+    if (!simulation.init())
+        return 1;
+
+    simulation.run();
+
+    return simulation.writeResults() ? 0 : 1;
+}
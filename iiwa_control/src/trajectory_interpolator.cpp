@@ -0,0 +1,167 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#include <iiwa_control/trajectory_interpolator.hpp>
+
+#include <Eigen/Geometry>
+
+#include <algorithm>
+
+namespace iiwa_control {
+    namespace {
+        Eigen::Quaterniond from_axis_angle(const double* v)
+        {
+            Eigen::Map<const Eigen::Vector3d> r(v);
+            double angle = r.norm();
+            if (angle < 1e-12)
+                return Eigen::Quaterniond::Identity();
+            return Eigen::Quaterniond(Eigen::AngleAxisd(angle, r / angle));
+        }
+    } // namespace
+
+    TrajectoryInterpolator::TrajectoryInterpolator() : size_(0), interpolation_(Interpolation::Cubic), orientation_offset_(-1), idle_(true), duration_(0.) {}
+
+    void TrajectoryInterpolator::init(unsigned int size, size_t capacity, Interpolation interpolation, int orientation_offset, const double* initial_command)
+    {
+        queue_.reserve(capacity);
+        last_queued_time_ = ros::Time(0);
+
+        size_ = size;
+        interpolation_ = interpolation;
+        orientation_offset_ = orientation_offset;
+
+        // Hold the initial command until the first waypoint arrives
+        end_.time = ros::Time(0);
+        end_.size = size;
+        end_.has_velocity = false;
+        end_.has_acceleration = false;
+        std::copy(initial_command, initial_command + size, end_.position);
+        std::fill(end_.velocity, end_.velocity + size, 0.);
+        std::fill(end_.acceleration, end_.acceleration + size, 0.);
+        start_ = end_;
+        duration_ = 0.;
+        idle_ = true;
+    }
+
+    bool TrajectoryInterpolator::push(const Waypoint& waypoint)
+    {
+        if (waypoint.size != size_ || waypoint.time <= last_queued_time_)
+            return false;
+
+        if (!queue_.push(waypoint))
+            return false;
+
+        last_queued_time_ = waypoint.time;
+        return true;
+    }
+
+    void TrajectoryInterpolator::sample(const ros::Time& time, CommandFrame& command)
+    {
+        // Move to the segment that contains the time
+        while (idle_ || time >= end_.time) {
+            if (!queue_.front()) {
+                idle_ = true;
+                break;
+            }
+            startSegment(time);
+        }
+
+        command.size = size_;
+        command.stamp = time;
+
+        if (idle_) {
+            std::copy(end_.position, end_.position + size_, command.data);
+            return;
+        }
+
+        double t = (time - start_.time).toSec();
+        for (unsigned int i = 0; i < size_; i++) {
+            // Horner's scheme
+            double p = coefficients_[5][i];
+            for (int k = 4; k >= 0; k--)
+                p = p * t + coefficients_[k][i];
+            command.data[i] = p;
+        }
+
+        if (orientation_offset_ >= 0) {
+            Eigen::Quaterniond q = from_axis_angle(start_.position + orientation_offset_).slerp(t / duration_, from_axis_angle(end_.position + orientation_offset_));
+            Eigen::AngleAxisd aa(q);
+            Eigen::Vector3d::Map(command.data + orientation_offset_) = aa.axis() * aa.angle();
+        }
+    }
+
+    void TrajectoryInterpolator::startSegment(const ros::Time& time)
+    {
+        // The segment starts where the previous one ended (or now, at rest, after a pause)
+        start_ = end_;
+        if (idle_) {
+            start_.time = time;
+            std::fill(start_.velocity, start_.velocity + size_, 0.);
+            std::fill(start_.acceleration, start_.acceleration + size_, 0.);
+        }
+
+        end_ = *queue_.front();
+        queue_.pop();
+        idle_ = false;
+
+        // Missing velocities come from the waypoints around (Catmull-Rom), the trajectory stops at its last waypoint
+        if (!end_.has_velocity) {
+            const Waypoint* after = queue_.front();
+            double dt = after ? (after->time - start_.time).toSec() : 0.;
+            for (unsigned int i = 0; i < size_; i++)
+                end_.velocity[i] = (dt > 0.) ? (after->position[i] - start_.position[i]) / dt : 0.;
+        }
+        if (!end_.has_acceleration || interpolation_ == Interpolation::Cubic)
+            std::fill(end_.acceleration, end_.acceleration + size_, 0.);
+
+        duration_ = (end_.time - start_.time).toSec();
+        if (duration_ <= 0.) {
+            // Late waypoint: reached immediately
+            duration_ = 0.;
+            return;
+        }
+
+        double T = duration_, T2 = T * T, T3 = T2 * T;
+        for (unsigned int i = 0; i < size_; i++) {
+            double p0 = start_.position[i], v0 = start_.velocity[i], a0 = start_.acceleration[i];
+            double p1 = end_.position[i], v1 = end_.velocity[i], a1 = end_.acceleration[i];
+
+            coefficients_[0][i] = p0;
+            coefficients_[1][i] = v0;
+            if (interpolation_ == Interpolation::Quintic) {
+                double T4 = T3 * T, T5 = T4 * T;
+                coefficients_[2][i] = a0 / 2.;
+                coefficients_[3][i] = (20. * (p1 - p0) - (8. * v1 + 12. * v0) * T - (3. * a0 - a1) * T2) / (2. * T3);
+                coefficients_[4][i] = (30. * (p0 - p1) + (14. * v1 + 16. * v0) * T + (3. * a0 - 2. * a1) * T2) / (2. * T4);
+                coefficients_[5][i] = (12. * (p1 - p0) - 6. * (v1 + v0) * T - (a0 - a1) * T2) / (2. * T5);
+            }
+            else {
+                coefficients_[2][i] = (3. * (p1 - p0) - (2. * v0 + v1) * T) / T2;
+                coefficients_[3][i] = (2. * (p0 - p1) + (v0 + v1) * T) / T3;
+                coefficients_[4][i] = 0.;
+                coefficients_[5][i] = 0.;
+            }
+        }
+    }
+} // namespace iiwa_control
@@ -0,0 +1,135 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#ifndef IIWA_DRIVER_FRI_TRANSPORT_H
+#define IIWA_DRIVER_FRI_TRANSPORT_H
+
+// FRI Headers
+#include <kuka/fri/UdpConnection.h>
+
+// std headers
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace iiwa_ros {
+    // Where the FRI messages come from and go to (same semantics as kuka::fri::UdpConnection)
+    class FriTransport {
+    public:
+        virtual ~FriTransport() {}
+
+        virtual bool open(int port, const char* remote_host) = 0;
+        virtual void close() = 0;
+        virtual bool is_open() const = 0;
+        // Size of the received message, or <= 0 on timeout/failure
+        virtual int receive(char* buffer, int max_size) = 0;
+        virtual bool send(const char* buffer, int size) = 0;
+        // No message will ever come again (e.g. the end of a replay)
+        virtual bool finished() const { return false; }
+    };
+
+    // The robot, over UDP
+    class UdpTransport : public FriTransport {
+    public:
+        UdpTransport(int receive_timeout) : _connection(receive_timeout) {}
+
+        bool open(int port, const char* remote_host) override { return _connection.open(port, remote_host); }
+        void close() override { _connection.close(); }
+        bool is_open() const override { return _connection.isOpen(); }
+        int receive(char* buffer, int max_size) override { return _connection.receive(buffer, max_size); }
+        bool send(const char* buffer, int size) override { return _connection.send(buffer, size); }
+
+    protected:
+        kuka::fri::UdpConnection _connection;
+    };
+
+    // Capture files: an 8-byte magic followed by records of
+    // [int64 nanoseconds since the first message][int32 size][size bytes of monitoring message]
+    constexpr char FRI_CAPTURE_MAGIC[8] = {'I', 'I', 'W', 'A', 'F', 'R', 'I', '1'};
+
+    // Forwards to another transport and records every received monitoring message.
+    // The records are kept in a buffer reserved upfront and written out on destruction (at shutdown), so that capturing does no I/O
+    // in the control loop; the buffer keeps filling across close()/open() (reconnections).
+    class CaptureTransport : public FriTransport {
+    public:
+        CaptureTransport(std::unique_ptr<FriTransport> transport, const std::string& file_name, size_t max_size);
+        ~CaptureTransport();
+
+        bool open(int port, const char* remote_host) override { return _transport->open(port, remote_host); }
+        void close() override;
+        bool is_open() const override { return _transport->is_open(); }
+        int receive(char* buffer, int max_size) override;
+        bool send(const char* buffer, int size) override { return _transport->send(buffer, size); }
+
+        size_t dropped() const { return _dropped; }
+
+    protected:
+        void _flush();
+
+        std::unique_ptr<FriTransport> _transport;
+        std::ofstream _file;
+        std::vector<char> _buffer;
+        size_t _size, _dropped; // bytes in the buffer, messages that did not fit
+        bool _started;
+        std::chrono::steady_clock::time_point _start;
+    };
+
+    // Plays a capture file back instead of the robot; the commands are encoded as usual and discarded.
+    // The whole file is loaded on construction, receive() only copies.
+    class ReplayTransport : public FriTransport {
+    public:
+        // realtime: deliver the messages with their recorded timing (otherwise as fast as they are asked for)
+        // loops: how many times the capture is played
+        // start_delay: in seconds after open() before the first message (e.g. to leave time for the controllers to be spawned)
+        ReplayTransport(const std::string& file_name, bool realtime, int loops, double start_delay, int receive_timeout);
+
+        bool valid() const { return !_offsets.empty(); }
+
+        bool open(int, const char*) override;
+        void close() override { _open = false; }
+        bool is_open() const override { return _open; }
+        int receive(char* buffer, int max_size) override;
+        bool send(const char*, int) override;
+        bool finished() const override { return _loop >= _loops; }
+
+        size_t received() const { return _received; }
+        size_t sent() const { return _sent; }
+
+    protected:
+        std::vector<char> _data;
+        std::vector<size_t> _offsets; //!< start of the messages in _data
+        std::vector<int> _sizes;
+        std::vector<int64_t> _times; //!< in ns since the first message
+        size_t _next, _received, _sent;
+        int _loop, _loops, _receive_timeout;
+        bool _open, _realtime;
+        std::chrono::nanoseconds _start_delay;
+        std::chrono::steady_clock::time_point _start;
+    };
+} // namespace iiwa_ros
+
+#endif
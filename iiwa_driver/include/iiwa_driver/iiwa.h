@@ -29,29 +29,48 @@
 #include <ros/ros.h>
 #include <std_msgs/Bool.h>
 
-#include <realtime_tools/realtime_publisher.h>
-
 #include <iiwa_driver/AdditionalOutputs.h>
+#include <iiwa_driver/fri_transport.h>
+#include <iiwa_driver/realtime.h>
+#include <iiwa_driver/session_recorder.h>
+#include <iiwa_driver/telemetry.h>
+#include <iiwa_driver/velocity_estimator.h>
 #include <std_msgs/Float64MultiArray.h>
 
+#include <diagnostic_msgs/DiagnosticArray.h>
+
 #include <hardware_interface/joint_command_interface.h>
 #include <hardware_interface/joint_state_interface.h>
 #include <hardware_interface/robot_hw.h>
 
+#include <iiwa_tools/joint_acceleration_interface.h>
+#include <iiwa_tools/joint_limit_table.h>
+
 #include <joint_limits_interface/joint_limits.h>
-#include <joint_limits_interface/joint_limits_interface.h>
 #include <joint_limits_interface/joint_limits_rosparam.h>
 #include <joint_limits_interface/joint_limits_urdf.h>
 
 // FRI Headers
 #include <kuka/fri/LBRCommand.h>
 #include <kuka/fri/LBRState.h>
-#include <kuka/fri/UdpConnection.h>
+
+// std headers
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
 namespace controller_manager {
     class ControllerManager;
 }
 
+namespace urdf {
+    class Model;
+}
+
 namespace kuka {
     namespace fri {
         class ClientData;
@@ -73,6 +92,72 @@ namespace kuka {
 } // namespace kuka
 
 namespace iiwa_ros {
+    /// Joint state and commands exposed to ros_control; the hardware handles point straight into it.
+    /// The size is a compile-time constant so that the per-joint loops of the control cycle unroll.
+    template <int N>
+    struct JointBlock {
+        static constexpr int NUMBER_OF_JOINTS = N;
+
+        double position[N];
+        double velocity[N];
+        double effort[N];
+        double acceleration[N]; //!< estimated, exposed via iiwa_tools::JointAccelerationInterface
+        double position_command[N];
+        double velocity_command[N];
+        double effort_command[N];
+    };
+
+    /// Everything that belongs to one FRI session, i.e. one robot arm
+    struct FriArm {
+        static constexpr int NUM_JOINTS = kuka::fri::LBRState::NUMBER_OF_JOINTS;
+
+        FriArm();
+        ~FriArm();
+
+        // Configuration
+        std::string name; //!< namespace of the arm's topics (empty with a single arm)
+        int port;
+        std::string remote_host;
+        std::vector<std::string> joint_names;
+        std::vector<int> cpu_set; //!< CPUs the receive thread is pinned to (multiple arms only)
+        std::string capture_file; //!< record the received monitoring messages (empty: no capture)
+        std::string replay_file; //!< play a capture back instead of connecting to the robot (empty: UDP)
+        int receive_timeout; // in ms (0: blocking receive, a lost connection cannot be detected)
+        double reconnect_timeout; // in seconds without any message before the connection is reopened
+
+        // FRI connection
+        std::unique_ptr<FriTransport> connection;
+        kuka::fri::ClientData* fri_message_data;
+        kuka::fri::DummyState robot_state; //!< wrapper class for the FRI monitoring message
+        kuka::fri::DummyCommand robot_command; //!< wrapper class for the FRI command message
+        int message_size;
+
+        // Written by whoever receives (the arm's receive thread, or the control thread with a single arm)
+        bool received; //!< the pending message is valid
+        std::chrono::steady_clock::time_point receive_time, last_message_time;
+        FriErrorCounters errors;
+        std::atomic<bool> finished; //!< the transport has no more messages (end of a replay), read by the control thread
+
+        // Hand-over to the control thread (guarded by Iiwa::_sync_mutex with multiple arms)
+        bool pending; //!< a receive finished and was not consumed by the control thread yet
+        bool in_cycle; //!< the control thread owns the arm in the current cycle
+
+        // Control thread only
+        bool idle, commanding;
+        int64_t last_fri_stamp; // in nanoseconds, taken from the monitoring message
+        std::chrono::steady_clock::time_point last_cycle_time, last_receive_time;
+        JointBlock<NUM_JOINTS> joints;
+        iiwa_tools::JointLimitTable limits; //!< enforced on the commands of the active FRI command mode only
+        std::unique_ptr<VelocityEstimator> velocity_estimator;
+
+        // Telemetry thread only
+        iiwa_driver::AdditionalOutputs additional_msg;
+        std_msgs::Bool commanding_msg;
+        ros::Publisher additional_pub, commanding_status_pub;
+        FriErrorCounters published_errors; //!< as of the latest snapshot of this arm
+        int published_state; //!< session state of the latest snapshot of this arm
+    };
+
     class Iiwa : public hardware_interface::RobotHW {
     public:
         Iiwa(ros::NodeHandle& nh);
@@ -83,67 +168,97 @@ namespace iiwa_ros {
         bool initialized();
 
     protected:
-        void _init();
+        static constexpr int NUM_JOINTS = FriArm::NUM_JOINTS;
+
+        bool _init();
+        bool _init_arm(FriArm& arm, const urdf::Model* urdf_model);
         void _ctrl_loop();
-        void _load_params();
-        void _read(ros::Duration elapsed_time);
-        void _write(ros::Duration elapsed_time);
-        bool _init_fri();
-        bool _connect_fri();
-        void _disconnect_fri();
-        bool _read_fri(kuka::fri::ESessionState& current_state);
-        bool _write_fri();
-        void _publish();
-        void _on_fri_state_change(kuka::fri::ESessionState old_state, kuka::fri::ESessionState current_state) {}
-
-        // External torque publisher
-        realtime_tools::RealtimePublisher<iiwa_driver::AdditionalOutputs> _additional_pub;
+        void _receive_loop(FriArm& arm);
+        void _collect_arms();
+        void _release_arms();
+        bool _load_params();
+        bool _load_arms(ros::NodeHandle& n_p);
+        void _read(FriArm& arm, ros::Duration& elapsed_time);
+        ros::Duration _elapsed_time(FriArm& arm);
+        void _enforce_limits(ros::Duration elapsed_time);
+        void _write(FriArm& arm);
+        bool _init_fri(FriArm& arm);
+        std::unique_ptr<FriTransport> _create_transport(const FriArm& arm);
+        bool _replay_finished() const;
+        bool _connect_fri(FriArm& arm);
+        void _disconnect_fri(FriArm& arm);
+        bool _reconnect_fri(FriArm& arm);
+        bool _receive(FriArm& arm);
+        bool _read_fri(FriArm& arm);
+        bool _write_fri(FriArm& arm);
+        void _fill_snapshot(CycleSnapshot& snapshot, const FriArm& arm, ros::Duration elapsed_time, bool overrun);
+        void _telemetry_loop();
+        void _publish(FriArm& arm, const CycleSnapshot& snapshot);
+        void _record_statistics(const CycleSnapshot& snapshot);
+        void _report_events(FriArm& arm, const CycleSnapshot& snapshot);
+        void _publish_diagnostics(const FriErrorCounters& errors);
+        void _dump_statistics(const FriErrorCounters& errors);
+        void _write_statistics(const FriErrorCounters& errors);
+        FriErrorCounters _published_errors() const;
+        void _on_fri_state_change(FriArm& arm, kuka::fri::ESessionState old_state, kuka::fri::ESessionState current_state);
+
+        // Robots: one FRI session each, all updated by a single controller manager
+        std::vector<std::unique_ptr<FriArm>> _arms;
+        std::mutex _sync_mutex;
+        std::condition_variable _sync_cv;
+        ros::Duration _sync_window; //!< how long the control thread waits for the other arms after the first one
+
+        // Telemetry: the control thread pushes snapshots, the telemetry thread publishes them
+        std::unique_ptr<SpscRing<CycleSnapshot>> _telemetry;
+        std::atomic<bool> _running;
+        double _publish_rate;
+
+        // Instrumentation: distributions over the current diagnostics period and over the whole run
+        std::unique_ptr<CycleStatistics> _window_stats, _total_stats;
+        FriErrorCounters _reported_errors; //!< errors at the last diagnostics report
+        size_t _reported_dropped;
+        bool _reported_holding;
+        double _diagnostics_rate;
+        std::string _statistics_file, _statistics_label; //!< CSV the statistics of the run are appended to (empty: none)
+
+        // Full-rate binary log of all snapshots, written by the telemetry thread
+        std::unique_ptr<SessionRecorder> _recorder;
+        std::string _recorder_file;
+        int _recorder_capacity;
+        diagnostic_msgs::DiagnosticArray _diagnostics_msg;
+        ros::Publisher _diagnostics_pub;
 
         // Interfaces
         hardware_interface::JointStateInterface _joint_state_interface;
         hardware_interface::PositionJointInterface _position_joint_interface;
         hardware_interface::VelocityJointInterface _velocity_joint_interface;
         hardware_interface::EffortJointInterface _effort_joint_interface;
-
-        joint_limits_interface::EffortJointSaturationInterface _effort_joint_saturation_interface;
-        joint_limits_interface::EffortJointSoftLimitsInterface _effort_joint_limits_interface;
-        joint_limits_interface::PositionJointSaturationInterface _position_joint_saturation_interface;
-        joint_limits_interface::PositionJointSoftLimitsInterface _position_joint_limits_interface;
-        joint_limits_interface::VelocityJointSaturationInterface _velocity_joint_saturation_interface;
-        joint_limits_interface::VelocityJointSoftLimitsInterface _velocity_joint_limits_interface;
+        iiwa_tools::JointAccelerationInterface _joint_acceleration_interface;
 
         // Shared memory
-        int _num_joints;
         int _joint_mode; // position, velocity, or effort
-        std::vector<std::string> _joint_names;
         std::vector<int> _joint_types;
-        std::vector<double> _joint_position, _joint_position_prev;
-        std::vector<double> _joint_velocity;
-        std::vector<double> _joint_effort;
-        std::vector<double> _joint_position_command;
-        std::vector<double> _joint_velocity_command;
-        std::vector<double> _joint_effort_command;
+        EstimatorSettings _estimator_settings;
 
         // Controller manager
         std::shared_ptr<controller_manager::ControllerManager> _controller_manager;
 
-        // FRI Connection
-        kuka::fri::UdpConnection _fri_connection;
-        kuka::fri::ClientData* _fri_message_data;
-        kuka::fri::DummyState _robot_state; //!< wrapper class for the FRI monitoring message
-        kuka::fri::DummyCommand _robot_command; //!< wrapper class for the FRI command message
-        int _message_size;
-        bool _idle, _commanding;
+        // FRI Connection (settings shared by all arms)
+        size_t _capture_size; // in bytes, reserved for the messages of every captured arm
+        bool _replay_realtime; // replay the messages with their recorded timing
+        double _replay_delay; // in seconds before the first replayed message
+        int _replay_loops;
 
-        int _port;
-        std::string _remote_host;
+        // Session handling: controllers are not updated while a session is lost and restarted when all are back
+        bool _hold_controllers, _reset_controllers;
 
         // ROS communication/timing related
         ros::NodeHandle _nh;
         std::string _robot_description;
         ros::Duration _control_period;
-        ros::Publisher _commanding_status_pub;
         double _control_freq;
+        bool _packet_clocked; // if true, the FRI monitoring messages are the only clock of the control loop
+        RealtimeSettings _realtime_settings; //!< applied to the control thread (and the receive threads)
         bool _initialized;
     };
 } // namespace iiwa_ros
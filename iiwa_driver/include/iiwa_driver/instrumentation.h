@@ -0,0 +1,173 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#ifndef IIWA_DRIVER_INSTRUMENTATION_H
+#define IIWA_DRIVER_INSTRUMENTATION_H
+
+// std headers
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+namespace iiwa_ros {
+    // Timed stages of a control cycle
+    enum CycleStage {
+        STAGE_READ = 0, // decoding and reading the monitoring message (after reception)
+        STAGE_UPDATE, // controller manager update
+        STAGE_LIMITS, // joint limits enforcement
+        STAGE_WRITE, // writing, encoding and sending the command message
+        NUM_STAGES
+    };
+
+    inline const char* stage_name(int stage)
+    {
+        static const char* names[NUM_STAGES] = {"read", "update", "limits", "write"};
+        return (stage >= 0 && stage < NUM_STAGES) ? names[stage] : "unknown";
+    }
+
+    // Cumulative failure counters of the FRI communication
+    struct FriErrorCounters {
+        FriErrorCounters() : receive(0), decode(0), encode(0), send(0), reconnect(0) {}
+
+        void add(const FriErrorCounters& other)
+        {
+            receive += other.receive;
+            decode += other.decode;
+            encode += other.encode;
+            send += other.send;
+            reconnect += other.reconnect;
+        }
+
+        uint64_t receive, decode, encode, send;
+        uint64_t reconnect; //!< times the connection was reopened after a loss
+    };
+
+    // HDR-style histogram of durations in nanoseconds: values are bucketed by their power of two
+    // and every power of two is split in SUB_BUCKETS linear sub-buckets (i.e. ~6% relative precision).
+    // Fixed-size storage; recording is a few integer operations.
+    class LatencyHistogram {
+    public:
+        static constexpr int SUB_BUCKET_BITS = 4;
+        static constexpr int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+        static constexpr int MAX_BITS = 40; // ~18 minutes, larger values are clamped
+        static constexpr int NUM_BUCKETS = (MAX_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+        LatencyHistogram() { reset(); }
+
+        void reset()
+        {
+            std::memset(_counts, 0, sizeof(_counts));
+            _count = 0;
+            _sum = 0;
+            _min = std::numeric_limits<int64_t>::max();
+            _max = 0;
+        }
+
+        void record(int64_t value)
+        {
+            if (value < 0)
+                value = 0;
+            _counts[_index(value)]++;
+            _count++;
+            _sum += value;
+            if (value < _min)
+                _min = value;
+            if (value > _max)
+                _max = value;
+        }
+
+        uint64_t count() const { return _count; }
+        int64_t min() const { return (_count > 0) ? _min : 0; }
+        int64_t max() const { return _max; }
+        double mean() const { return (_count > 0) ? static_cast<double>(_sum) / _count : 0.; }
+
+        // Value below which the given fraction (in [0, 1]) of the recorded values lies (upper bucket bound)
+        int64_t percentile(double p) const
+        {
+            if (_count == 0)
+                return 0;
+
+            uint64_t target = static_cast<uint64_t>(p * _count + 0.5);
+            if (target < 1)
+                target = 1;
+
+            uint64_t seen = 0;
+            for (int i = 0; i < NUM_BUCKETS; i++) {
+                seen += _counts[i];
+                if (seen >= target) {
+                    int64_t upper = _lower_bound(i + 1) - 1;
+                    return (upper < _max) ? upper : _max;
+                }
+            }
+            return _max;
+        }
+
+    protected:
+        static int _index(int64_t value)
+        {
+            if (value < SUB_BUCKETS)
+                return static_cast<int>(value);
+
+            int bits = 63 - __builtin_clzll(static_cast<unsigned long long>(value)); // floor(log2(value))
+            if (bits >= MAX_BITS)
+                return NUM_BUCKETS - 1;
+
+            int shift = bits - SUB_BUCKET_BITS;
+            return (shift + 1) * SUB_BUCKETS + static_cast<int>((value >> shift) & (SUB_BUCKETS - 1));
+        }
+
+        static int64_t _lower_bound(int index)
+        {
+            if (index < SUB_BUCKETS)
+                return index;
+
+            int block = index / SUB_BUCKETS;
+            int sub = index % SUB_BUCKETS;
+            return static_cast<int64_t>(SUB_BUCKETS + sub) << (block - 1);
+        }
+
+        uint64_t _counts[NUM_BUCKETS];
+        uint64_t _count;
+        int64_t _sum, _min, _max;
+    };
+
+    // Distributions of one control loop
+    struct CycleStatistics {
+        void reset()
+        {
+            dt.reset();
+            receive_jitter.reset();
+            for (int i = 0; i < NUM_STAGES; i++)
+                stages[i].reset();
+            overruns = 0;
+        }
+
+        LatencyHistogram dt;
+        LatencyHistogram receive_jitter;
+        LatencyHistogram stages[NUM_STAGES];
+        uint64_t overruns;
+    };
+} // namespace iiwa_ros
+
+#endif
@@ -0,0 +1,46 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#ifndef IIWA_DRIVER_REALTIME_H
+#define IIWA_DRIVER_REALTIME_H
+
+// std headers
+#include <string>
+#include <vector>
+
+namespace iiwa_ros {
+    struct RealtimeSettings {
+        RealtimeSettings() : priority(0), lock_memory(false), prefault_stack(false) {}
+
+        int priority; //!< SCHED_FIFO priority (0: keep the default scheduler)
+        std::vector<int> cpu_set; //!< CPUs the thread is pinned to (empty: no pinning)
+        bool lock_memory; //!< lock all current and future pages of the process in RAM
+        bool prefault_stack; //!< touch the stack once so that it does not page-fault later
+    };
+
+    // Apply the settings to the calling thread. Returns false if any of them was refused.
+    bool setup_realtime(const RealtimeSettings& settings, const std::string& thread_name = "control");
+} // namespace iiwa_ros
+
+#endif
@@ -0,0 +1,93 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#ifndef IIWA_DRIVER_SESSION_RECORDER_H
+#define IIWA_DRIVER_SESSION_RECORDER_H
+
+// std headers
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <iiwa_driver/telemetry.h>
+
+namespace iiwa_ros {
+    // On-disk layout of the session logs: a SessionLogHeader followed by `capacity` fixed-size SessionRecords,
+    // used as a ring (record i is at slot i % capacity). All values are in the byte order of the recording machine.
+    constexpr char SESSION_LOG_MAGIC[8] = {'I', 'I', 'W', 'A', 'L', 'O', 'G', '1'};
+    constexpr int SESSION_LOG_JOINTS = CycleSnapshot::MAX_JOINTS;
+
+    struct SessionLogHeader {
+        char magic[8];
+        uint32_t record_size; //!< sizeof(SessionRecord), to detect incompatible files
+        uint32_t num_joints;
+        uint64_t capacity; //!< number of record slots
+        uint64_t count; //!< records written so far (the latest min(count, capacity) are in the file)
+        int64_t start_stamp; //!< wall time of the creation of the log in nanoseconds
+        uint8_t reserved[24];
+    };
+
+    // One cycle of one robot (see CycleSnapshot), times in nanoseconds
+    struct SessionRecord {
+        int64_t stamp;
+        int64_t fri_stamp;
+        int64_t elapsed;
+        int64_t stage_latency[NUM_STAGES];
+        int64_t receive_jitter;
+        int32_t arm;
+        int32_t session_state;
+        uint8_t commanding, received, overrun;
+        uint8_t reserved[5];
+
+        double measured_position[SESSION_LOG_JOINTS];
+        double commanded_position[SESSION_LOG_JOINTS];
+        double measured_torque[SESSION_LOG_JOINTS];
+        double commanded_torque[SESSION_LOG_JOINTS];
+        double external_torque[SESSION_LOG_JOINTS];
+    };
+
+    // Appends the snapshots to a preallocated, memory-mapped ring file.
+    // Meant for the telemetry thread: record() only copies into the mapping, the kernel writes the pages back,
+    // so the log survives a crash of the driver.
+    class SessionRecorder {
+    public:
+        SessionRecorder();
+        ~SessionRecorder();
+
+        // Creates (or overwrites) the file with room for `capacity` records
+        bool open(const std::string& file_name, size_t capacity);
+        void close();
+        bool is_open() const { return _header != nullptr; }
+
+        void record(const CycleSnapshot& snapshot);
+
+    protected:
+        int _fd;
+        size_t _size;
+        SessionLogHeader* _header;
+        SessionRecord* _records;
+    };
+} // namespace iiwa_ros
+
+#endif
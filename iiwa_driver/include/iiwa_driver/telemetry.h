@@ -0,0 +1,121 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#ifndef IIWA_DRIVER_TELEMETRY_H
+#define IIWA_DRIVER_TELEMETRY_H
+
+// std headers
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// FRI Headers
+#include <kuka/fri/LBRState.h>
+
+#include <iiwa_driver/instrumentation.h>
+
+namespace iiwa_ros {
+    // Snapshot of the state of one robot at one control cycle.
+    // Plain data only: it is filled by the control thread without allocating.
+    struct CycleSnapshot {
+        static constexpr int MAX_JOINTS = kuka::fri::LBRState::NUMBER_OF_JOINTS;
+
+        int arm; //!< index of the robot (FRI session) the snapshot belongs to
+        bool primary; //!< first snapshot of the cycle: only this one counts for the cycle-level statistics
+        int64_t stamp; //!< (wall) time of the cycle in nanoseconds
+        int64_t fri_stamp; //!< timestamp of the monitoring message in nanoseconds
+        int64_t elapsed; //!< elapsed time since the previous cycle in nanoseconds
+        int session_state;
+        bool commanding;
+        bool received; //!< a new monitoring message was received in this cycle
+        bool overrun; //!< the cycle took much longer than expected
+        bool holding; //!< the controllers are held because a session is lost
+        bool connected; //!< the FRI connection is open (false if it could not be reopened)
+
+        // Timing of the cycle in nanoseconds
+        int64_t stage_latency[NUM_STAGES];
+        int64_t receive_jitter; //!< deviation of the reception interval from the FRI sample time
+        FriErrorCounters errors; //!< cumulative since the start of the driver
+
+        double measured_position[MAX_JOINTS];
+        double commanded_position[MAX_JOINTS];
+        double measured_torque[MAX_JOINTS];
+        double commanded_torque[MAX_JOINTS];
+        double external_torque[MAX_JOINTS];
+    };
+
+    // Lock-free single-producer/single-consumer ring buffer.
+    // The storage is allocated once at construction; push() and pop() never allocate.
+    template <typename T>
+    class SpscRing {
+    public:
+        SpscRing(size_t capacity) : _head(0), _tail(0), _dropped(0)
+        {
+            // round up to a power of two so that wrapping is a mask
+            size_t size = 2;
+            while (size < capacity + 1)
+                size <<= 1;
+            _buffer.resize(size);
+            _mask = size - 1;
+        }
+
+        // Producer side. Returns false (and counts the item as dropped) if the ring is full.
+        bool push(const T& item)
+        {
+            size_t head = _head.load(std::memory_order_relaxed);
+            size_t next = (head + 1) & _mask;
+            if (next == _tail.load(std::memory_order_acquire)) {
+                _dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+
+            _buffer[head] = item;
+            _head.store(next, std::memory_order_release);
+            return true;
+        }
+
+        // Consumer side. Returns false if the ring is empty.
+        bool pop(T& item)
+        {
+            size_t tail = _tail.load(std::memory_order_relaxed);
+            if (tail == _head.load(std::memory_order_acquire))
+                return false;
+
+            item = _buffer[tail];
+            _tail.store((tail + 1) & _mask, std::memory_order_release);
+            return true;
+        }
+
+        size_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+    protected:
+        std::vector<T> _buffer;
+        size_t _mask;
+        std::atomic<size_t> _head, _tail;
+        std::atomic<size_t> _dropped;
+    };
+} // namespace iiwa_ros
+
+#endif
@@ -0,0 +1,64 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#ifndef IIWA_DRIVER_VELOCITY_ESTIMATOR_H
+#define IIWA_DRIVER_VELOCITY_ESTIMATOR_H
+
+// FRI Headers
+#include <kuka/fri/LBRState.h>
+
+// std headers
+#include <memory>
+#include <string>
+
+namespace iiwa_ros {
+    struct EstimatorSettings {
+        EstimatorSettings() : type("exponential"), alpha(0.2), window(15), jerk_noise(1e2), position_noise(1e-5) {}
+
+        std::string type; //!< "exponential", "savitzky_golay" or "kalman"
+        double alpha; //!< exponential: smoothing factor in (0, 1]
+        int window; //!< savitzky_golay: number of samples in the quadratic fit
+        double jerk_noise; //!< kalman: spectral density of the joint jerk [rad^2/s^5]
+        double position_noise; //!< kalman: standard deviation of the measured position [rad]
+    };
+
+    // Estimates the joint velocities and accelerations from the measured positions and
+    // the measured time between two consecutive samples (not the nominal control period).
+    class VelocityEstimator {
+    public:
+        static constexpr int NUMBER_OF_JOINTS = kuka::fri::LBRState::NUMBER_OF_JOINTS;
+
+        virtual ~VelocityEstimator() {}
+
+        // Forget the history; the next sample is treated as the first one
+        virtual void reset() = 0;
+        // Consume positions measured dt seconds after the previous ones and write the estimates
+        virtual void update(const double* position, double dt, double* velocity, double* acceleration) = 0;
+    };
+
+    // Returns nullptr if the settings are invalid
+    std::unique_ptr<VelocityEstimator> create_velocity_estimator(const EstimatorSettings& settings);
+} // namespace iiwa_ros
+
+#endif
@@ -0,0 +1,172 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#include <iiwa_driver/fri_transport.h>
+
+// ROS Headers
+#include <ros/ros.h>
+
+// std headers
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <thread>
+
+namespace iiwa_ros {
+    namespace {
+        constexpr size_t RECORD_HEADER_SIZE = sizeof(int64_t) + sizeof(int32_t);
+    } // namespace
+
+    CaptureTransport::CaptureTransport(std::unique_ptr<FriTransport> transport, const std::string& file_name, size_t max_size) : _transport(std::move(transport)), _file(file_name, std::ios::binary | std::ios::trunc), _size(0), _dropped(0), _started(false)
+    {
+        if (!_file)
+            ROS_ERROR_STREAM_NAMED("Iiwa", "Could not open the FRI capture file '" << file_name << "'. Nothing will be captured.");
+        else
+            _file.write(FRI_CAPTURE_MAGIC, sizeof(FRI_CAPTURE_MAGIC));
+        _buffer.resize(_file ? max_size : 0);
+    }
+
+    CaptureTransport::~CaptureTransport()
+    {
+        _flush();
+        if (_dropped > 0)
+            ROS_WARN_STREAM_NAMED("Iiwa", _dropped << " FRI message(s) did not fit in the capture buffer.");
+    }
+
+    void CaptureTransport::close()
+    {
+        // Called on the receive path when reconnecting: the records stay in the buffer until the destructor
+        _transport->close();
+    }
+
+    int CaptureTransport::receive(char* buffer, int max_size)
+    {
+        int size = _transport->receive(buffer, max_size);
+        if (size <= 0)
+            return size;
+
+        auto now = std::chrono::steady_clock::now();
+        if (!_started) {
+            _start = now;
+            _started = true;
+        }
+
+        if (_size + RECORD_HEADER_SIZE + size > _buffer.size()) {
+            _dropped++;
+            return size;
+        }
+
+        int64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(now - _start).count();
+        int32_t record_size = size;
+        std::memcpy(&_buffer[_size], &time, sizeof(time));
+        std::memcpy(&_buffer[_size + sizeof(time)], &record_size, sizeof(record_size));
+        std::memcpy(&_buffer[_size + RECORD_HEADER_SIZE], buffer, size);
+        _size += RECORD_HEADER_SIZE + size;
+
+        return size;
+    }
+
+    void CaptureTransport::_flush()
+    {
+        if (!_file || _size == 0)
+            return;
+        _file.write(_buffer.data(), _size);
+        _file.flush();
+        _size = 0;
+    }
+
+    ReplayTransport::ReplayTransport(const std::string& file_name, bool realtime, int loops, double start_delay, int receive_timeout) : _next(0), _received(0), _sent(0), _loop(0), _loops(std::max(loops, 1)), _receive_timeout(receive_timeout), _open(false), _realtime(realtime), _start_delay(static_cast<int64_t>(std::max(start_delay, 0.) * 1e9))
+    {
+        std::ifstream file(file_name, std::ios::binary);
+        if (!file) {
+            ROS_ERROR_STREAM_NAMED("Iiwa", "Could not open the FRI replay file '" << file_name << "'.");
+            return;
+        }
+        _data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+        if (_data.size() < sizeof(FRI_CAPTURE_MAGIC) || std::memcmp(_data.data(), FRI_CAPTURE_MAGIC, sizeof(FRI_CAPTURE_MAGIC)) != 0) {
+            ROS_ERROR_STREAM_NAMED("Iiwa", "'" << file_name << "' is not an FRI capture file.");
+            _data.clear();
+            return;
+        }
+
+        size_t offset = sizeof(FRI_CAPTURE_MAGIC);
+        while (offset + RECORD_HEADER_SIZE <= _data.size()) {
+            int64_t time;
+            int32_t size;
+            std::memcpy(&time, &_data[offset], sizeof(time));
+            std::memcpy(&size, &_data[offset + sizeof(time)], sizeof(size));
+            if (size <= 0 || offset + RECORD_HEADER_SIZE + size > _data.size())
+                break;
+            _offsets.push_back(offset + RECORD_HEADER_SIZE);
+            _sizes.push_back(size);
+            _times.push_back(time);
+            offset += RECORD_HEADER_SIZE + size;
+        }
+
+        if (_offsets.empty())
+            ROS_ERROR_STREAM_NAMED("Iiwa", "The FRI replay file '" << file_name << "' does not contain any message.");
+        else
+            ROS_INFO_STREAM_NAMED("Iiwa", "Replaying " << _offsets.size() << " FRI message(s) from '" << file_name << "' " << _loops << " time(s)" << (_realtime ? " with their recorded timing." : " as fast as possible."));
+    }
+
+    bool ReplayTransport::open(int, const char*)
+    {
+        _open = valid();
+        _start = std::chrono::steady_clock::now() + _start_delay;
+        return _open;
+    }
+
+    int ReplayTransport::receive(char* buffer, int max_size)
+    {
+        if (!_open || finished()) {
+            // Behave like a silent robot
+            std::this_thread::sleep_for(std::chrono::milliseconds(std::max(_receive_timeout, 1)));
+            return 0;
+        }
+
+        if (_realtime)
+            std::this_thread::sleep_until(_start + std::chrono::nanoseconds(_times[_next]));
+        else if (_received == 0)
+            std::this_thread::sleep_until(_start);
+
+        int size = std::min(_sizes[_next], max_size);
+        std::memcpy(buffer, &_data[_offsets[_next]], size);
+        _received++;
+
+        if (++_next == _offsets.size()) {
+            _next = 0;
+            _loop++;
+            _start = std::chrono::steady_clock::now();
+        }
+
+        return size;
+    }
+
+    bool ReplayTransport::send(const char*, int)
+    {
+        _sent++;
+        return _open;
+    }
+} // namespace iiwa_ros
@@ -25,17 +25,87 @@
 #include <iiwa_driver/iiwa.h>
 
 // ROS Headers
-#include <control_toolbox/filters.h>
 #include <controller_manager/controller_manager.h>
 
 #include <urdf/model.h>
 
+#include <iiwa_tools/model_loader.h>
+
 // FRI Headers
 #include <kuka/fri/ClientData.h>
 
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
 #include <thread>
 
 namespace iiwa_ros {
+    namespace {
+        int64_t to_ns(std::chrono::steady_clock::duration duration)
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+        }
+
+        void add_histogram(diagnostic_msgs::DiagnosticStatus& status, const std::string& name, const LatencyHistogram& histogram)
+        {
+            // all values in microseconds
+            std::ostringstream str;
+            str << std::fixed << std::setprecision(1)
+                << "mean: " << histogram.mean() * 1e-3
+                << ", p50: " << histogram.percentile(0.5) * 1e-3
+                << ", p99: " << histogram.percentile(0.99) * 1e-3
+                << ", p99.9: " << histogram.percentile(0.999) * 1e-3
+                << ", max: " << histogram.max() * 1e-3;
+
+            diagnostic_msgs::KeyValue kv;
+            kv.key = name + " [us]";
+            kv.value = str.str();
+            status.values.push_back(kv);
+        }
+
+        void add_value(diagnostic_msgs::DiagnosticStatus& status, const std::string& name, uint64_t value)
+        {
+            diagnostic_msgs::KeyValue kv;
+            kv.key = name;
+            kv.value = std::to_string(value);
+            status.values.push_back(kv);
+        }
+
+        const char* session_state_name(kuka::fri::ESessionState state)
+        {
+            switch (state) {
+            case kuka::fri::IDLE:
+                return "IDLE";
+            case kuka::fri::MONITORING_WAIT:
+                return "MONITORING_WAIT";
+            case kuka::fri::MONITORING_READY:
+                return "MONITORING_READY";
+            case kuka::fri::COMMANDING_WAIT:
+                return "COMMANDING_WAIT";
+            case kuka::fri::COMMANDING_ACTIVE:
+                return "COMMANDING_ACTIVE";
+            }
+            return "UNKNOWN";
+        }
+
+        std::string arm_label(const FriArm& arm)
+        {
+            return arm.name.empty() ? std::string("") : " (" + arm.name + ")";
+        }
+    } // namespace
+
+    FriArm::FriArm() : port(30200), remote_host("192.170.10.2"), receive_timeout(100), reconnect_timeout(1.), fri_message_data(nullptr), message_size(0), received(false), finished(false), pending(false), in_cycle(false), idle(true), commanding(false), last_fri_stamp(0), published_state(kuka::fri::IDLE) {}
+
+    FriArm::~FriArm()
+    {
+        // Delete FRI message data
+        if (fri_message_data)
+            delete fri_message_data;
+    }
+
     Iiwa::Iiwa(ros::NodeHandle& nh)
     {
         init(nh);
@@ -43,26 +113,30 @@ namespace iiwa_ros {
 
     Iiwa::~Iiwa()
     {
-        // Disconnect from robot
-        _disconnect_fri();
-
-        // Delete FRI message data
-        if (_fri_message_data)
-            delete _fri_message_data;
+        // Disconnect from robots
+        for (auto& arm : _arms)
+            _disconnect_fri(*arm);
     }
 
     void Iiwa::init(ros::NodeHandle& nh)
     {
         _nh = nh;
-        _load_params(); // load parameters
-        _init(); // initialize
-        _commanding_status_pub = _nh.advertise<std_msgs::Bool>("commanding_status", 100);
-        _controller_manager.reset(new controller_manager::ControllerManager(this, _nh));
+        _running = false;
+        // Nothing to control before the first sessions
+        _hold_controllers = true;
+        _reset_controllers = false;
 
-        if (_init_fri())
-            _initialized = true;
-        else
+        if (!_load_params() || !_init()) { // load parameters and initialize
             _initialized = false;
+            return;
+        }
+        _controller_manager.reset(new controller_manager::ControllerManager(this, _nh));
+
+        _initialized = true;
+        for (auto& arm : _arms) {
+            if (!_init_fri(*arm))
+                _initialized = false;
+        }
     }
 
     void Iiwa::run()
@@ -72,8 +146,27 @@ namespace iiwa_ros {
             return;
         }
 
+        _running = true;
+        std::thread telemetry(&Iiwa::_telemetry_loop, this);
+
+        // With several arms, every one of them receives in its own thread; a single arm is received inline
+        std::vector<std::thread> receivers;
+        if (_arms.size() > 1) {
+            for (auto& arm : _arms)
+                receivers.emplace_back(&Iiwa::_receive_loop, this, std::ref(*arm));
+        }
+
         std::thread t1(&Iiwa::_ctrl_loop, this);
         t1.join();
+
+        {
+            std::lock_guard<std::mutex> lock(_sync_mutex);
+            _running = false;
+        }
+        _sync_cv.notify_all();
+        for (auto& receiver : receivers)
+            receiver.join();
+        telemetry.join();
     }
 
     bool Iiwa::initialized()
@@ -81,45 +174,89 @@ namespace iiwa_ros {
         return _initialized;
     }
 
-    void Iiwa::_init()
+    bool Iiwa::_init()
     {
-        // Get joint names
-        _num_joints = _joint_names.size();
+        // Get the URDF from the parameter server (waits for it); the RBDyn model is parsed in the background
+        // meanwhile, for the controllers of this process that need it
+        iiwa_tools::ModelLoader::instance().prefetch(_nh, _robot_description);
+        std::shared_ptr<const urdf::Model> urdf_model = iiwa_tools::ModelLoader::instance().urdf_model(_nh, _robot_description);
+
+        const urdf::Model* const urdf_model_ptr = urdf_model.get();
+        if (urdf_model_ptr == nullptr)
+            ROS_WARN_STREAM_NAMED("Iiwa", "Could not read URDF from '" << _robot_description << "' parameters. Joint limits will not work.");
+
+        // All arms share the interfaces, so that one controller manager (and one controller) can command all of them
+        for (auto& arm : _arms) {
+            if (!_init_arm(*arm, urdf_model_ptr))
+                return false;
+        }
 
-        // Resize vectors
-        _joint_position.resize(_num_joints);
-        _joint_velocity.resize(_num_joints);
-        _joint_effort.resize(_num_joints);
-        _joint_position_command.resize(_num_joints);
-        _joint_velocity_command.resize(_num_joints);
-        _joint_effort_command.resize(_num_joints);
+        registerInterface(&_joint_state_interface);
+        registerInterface(&_position_joint_interface);
+        registerInterface(&_effort_joint_interface);
+        registerInterface(&_velocity_joint_interface);
+        registerInterface(&_joint_acceleration_interface);
+
+        // Enough for one second of snapshots at 1kHz
+        _telemetry.reset(new SpscRing<CycleSnapshot>(1000 * _arms.size()));
+
+        _window_stats.reset(new CycleStatistics);
+        _total_stats.reset(new CycleStatistics);
+        _window_stats->reset();
+        _total_stats->reset();
+        _reported_dropped = 0;
+        _reported_holding = _hold_controllers;
+        // The aggregator (and rqt_robot_monitor) only listen to the global topic, whatever the namespace of the driver
+        _diagnostics_pub = _nh.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 10);
+
+        if (!_recorder_file.empty()) {
+            // "{stamp}" in the file name is replaced by the start time of the driver, so that every run gets its own log
+            std::string file_name = _recorder_file;
+            size_t pos = file_name.find("{stamp}");
+            if (pos != std::string::npos) {
+                char stamp[32];
+                std::time_t now = std::time(nullptr);
+                std::strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", std::localtime(&now));
+                file_name.replace(pos, 7, stamp);
+            }
 
-        // Get the URDF XML from the parameter server
-        urdf::Model urdf_model;
-        std::string urdf_string;
+            _recorder.reset(new SessionRecorder);
+            if (!_recorder->open(file_name, static_cast<size_t>(std::max(_recorder_capacity, 1))))
+                _recorder.reset(); // not fatal: run without the log
+        }
 
-        // search and wait for robot_description on param server
-        while (urdf_string.empty()) {
-            ROS_INFO_ONCE_NAMED("Iiwa", "Iiwa is waiting for model"
-                                        " URDF in parameter [%s] on the ROS param server.",
-                _robot_description.c_str());
+        return true;
+    }
 
-            _nh.getParam(_robot_description, urdf_string);
+    bool Iiwa::_init_arm(FriArm& arm, const urdf::Model* urdf_model_ptr)
+    {
+        int num_joints = arm.joint_names.size();
 
-            usleep(100000);
+        // The joint block has the size of the FRI messages
+        if (num_joints != NUM_JOINTS) {
+            ROS_ERROR_STREAM_NAMED("Iiwa", "The robot" << arm_label(arm) << " has " << static_cast<int>(NUM_JOINTS) << " joints, but " << num_joints << " joint names were given.");
+            return false;
         }
-        ROS_INFO_STREAM_NAMED("Iiwa", "Received urdf from param server, parsing...");
 
-        const urdf::Model* const urdf_model_ptr = urdf_model.initString(urdf_string) ? &urdf_model : nullptr;
-        if (urdf_model_ptr == nullptr)
-            ROS_WARN_STREAM_NAMED("Iiwa", "Could not read URDF from '" << _robot_description << "' parameters. Joint limits will not work.");
+        arm.velocity_estimator = create_velocity_estimator(_estimator_settings);
+        if (!arm.velocity_estimator)
+            return false;
+
+        JointBlock<NUM_JOINTS>& joints = arm.joints;
+        arm.limits.resize(NUM_JOINTS);
+        for (int i = 0; i < NUM_JOINTS; i++) {
+            joints.position[i] = joints.velocity[i] = joints.effort[i] = joints.acceleration[i] = 0.;
+            joints.position_command[i] = joints.velocity_command[i] = joints.effort_command[i] = 0.;
+        }
 
         // Initialize Controller
-        for (int i = 0; i < _num_joints; ++i) {
-            _joint_position[i] = _joint_velocity[i] = _joint_effort[i] = 0.;
+        for (int i = 0; i < num_joints; ++i) {
+            const std::string& joint_name = arm.joint_names[i];
+
             // Create joint state interface
-            hardware_interface::JointStateHandle joint_state_handle(_joint_names[i], &_joint_position[i], &_joint_velocity[i], &_joint_effort[i]);
+            hardware_interface::JointStateHandle joint_state_handle(joint_name, &joints.position[i], &joints.velocity[i], &joints.effort[i]);
             _joint_state_interface.registerHandle(joint_state_handle);
+            _joint_acceleration_interface.registerHandle(iiwa_tools::JointAccelerationHandle(joint_name, &joints.acceleration[i]));
 
             // Get joint limits from URDF
             bool has_soft_limits = false;
@@ -128,9 +265,9 @@ namespace iiwa_ros {
             joint_limits_interface::SoftJointLimits soft_limits;
 
             if (has_limits) {
-                auto urdf_joint = urdf_model_ptr->getJoint(_joint_names[i]);
+                auto urdf_joint = urdf_model_ptr->getJoint(joint_name);
                 if (!urdf_joint) {
-                    ROS_WARN_STREAM_NAMED("Iiwa", "Could not find joint '" << _joint_names[i] << "' in URDF. No limits will be applied for this joint.");
+                    ROS_WARN_STREAM_NAMED("Iiwa", "Could not find joint '" << joint_name << "' in URDF. No limits will be applied for this joint.");
                     continue;
                 }
 
@@ -139,223 +276,830 @@ namespace iiwa_ros {
                     has_soft_limits = true;
             }
 
+            // Limits of the commands, clamped in one pass over the arm every cycle
+            if (limits.has_position_limits)
+                arm.limits.set_position_limits(i, limits.min_position, limits.max_position);
+            if (limits.has_velocity_limits)
+                arm.limits.set_velocity_limit(i, limits.max_velocity);
+            if (limits.has_effort_limits)
+                arm.limits.set_effort_limit(i, limits.max_effort);
+            if (has_soft_limits)
+                arm.limits.set_soft_limits(i, soft_limits.min_position, soft_limits.max_position, soft_limits.k_position, soft_limits.k_velocity);
+
             // Create position joint interface
-            hardware_interface::JointHandle joint_position_handle(joint_state_handle, &_joint_position_command[i]);
+            hardware_interface::JointHandle joint_position_handle(joint_state_handle, &joints.position_command[i]);
+            _position_joint_interface.registerHandle(joint_position_handle);
 
-            if (has_soft_limits) {
-                joint_limits_interface::PositionJointSoftLimitsHandle joint_limits_handle(joint_position_handle, limits, soft_limits);
-                _position_joint_limits_interface.registerHandle(joint_limits_handle);
+            // Create effort joint interface
+            hardware_interface::JointHandle joint_effort_handle(joint_state_handle, &joints.effort_command[i]);
+            _effort_joint_interface.registerHandle(joint_effort_handle);
+
+            // Create velocity joint interface (FRI has no velocity command mode: these commands are never sent)
+            hardware_interface::JointHandle joint_velocity_handle(joint_state_handle, &joints.velocity_command[i]);
+            _velocity_joint_interface.registerHandle(joint_velocity_handle);
+        }
+
+        // Topics of the arm (in its own namespace with several arms)
+        std::string ns = arm.name.empty() ? std::string("") : arm.name + "/";
+        arm.commanding_status_pub = _nh.advertise<std_msgs::Bool>(ns + "commanding_status", 100);
+        arm.additional_pub = _nh.advertise<iiwa_driver::AdditionalOutputs>(ns + "additional_outputs", 20);
+
+        iiwa_driver::AdditionalOutputs& msg = arm.additional_msg;
+        msg.external_torques.layout.dim.resize(1);
+        msg.external_torques.layout.data_offset = 0;
+        msg.external_torques.layout.dim[0].size = num_joints;
+        msg.external_torques.layout.dim[0].stride = 0;
+        msg.external_torques.data.resize(num_joints);
+        msg.commanded_torques.layout.dim.resize(1);
+        msg.commanded_torques.layout.data_offset = 0;
+        msg.commanded_torques.layout.dim[0].size = num_joints;
+        msg.commanded_torques.layout.dim[0].stride = 0;
+        msg.commanded_torques.data.resize(num_joints);
+        msg.commanded_positions.layout.dim.resize(1);
+        msg.commanded_positions.layout.data_offset = 0;
+        msg.commanded_positions.layout.dim[0].size = num_joints;
+        msg.commanded_positions.layout.dim[0].stride = 0;
+        msg.commanded_positions.data.resize(num_joints);
+
+        return true;
+    }
+
+    void Iiwa::_ctrl_loop()
+    {
+        // Real-time setup has to happen in this thread and before the first receive()
+        if (!setup_realtime(_realtime_settings))
+            ROS_WARN_STREAM_NAMED("Iiwa", "Some of the requested real-time settings were refused. Running the control loop without them.");
+
+        ros::Rate rate(_control_freq);
+        for (auto& arm : _arms) {
+            arm->last_fri_stamp = 0;
+            arm->velocity_estimator->reset();
+            arm->last_cycle_time = std::chrono::steady_clock::time_point();
+            arm->last_receive_time = std::chrono::steady_clock::time_point();
+        }
+
+        while (ros::ok()) {
+            // Wait for the messages of this cycle and read the arms that sent one
+            _collect_arms();
+
+            ros::Duration elapsed_time(0.);
+            bool hold = false;
+            for (auto& arm : _arms) {
+                if (arm->in_cycle) {
+                    ros::Duration arm_elapsed_time = _control_period;
+                    _read(*arm, arm_elapsed_time);
+                    if (arm_elapsed_time > elapsed_time)
+                        elapsed_time = arm_elapsed_time;
+                }
+                hold = hold || (arm->fri_message_data->lastState == kuka::fri::IDLE);
+            }
+            if (elapsed_time.isZero())
+                elapsed_time = _control_period;
+            auto read_done = std::chrono::steady_clock::now();
+
+            // control_freq is only an expectation in packet-clocked mode: flag cycles that are way off
+            bool overrun = (elapsed_time > _control_period * 2.);
+
+            // Hold the controllers while any session is lost, restart them from the current state once all are back
+            // (reported by the telemetry thread)
+            if (!hold && _hold_controllers)
+                _reset_controllers = true;
+            _hold_controllers = hold;
+
+            ros::Time now = ros::Time::now();
+            if (!_hold_controllers) {
+                _controller_manager->update(now, elapsed_time, _reset_controllers);
+                _reset_controllers = false;
             }
             else {
-                joint_limits_interface::PositionJointSaturationHandle joint_limits_handle(joint_position_handle, limits);
-                _position_joint_saturation_interface.registerHandle(joint_limits_handle);
+                // The arms whose session is still active must not keep getting the last command of the controllers:
+                // zero torque (on top of the robot's own gravity compensation) or the measured position
+                for (auto& arm : _arms) {
+                    if (!arm->in_cycle)
+                        continue;
+                    std::fill(arm->joints.effort_command, arm->joints.effort_command + NUM_JOINTS, 0.);
+                    std::fill(arm->joints.velocity_command, arm->joints.velocity_command + NUM_JOINTS, 0.);
+                    std::copy(arm->joints.position, arm->joints.position + NUM_JOINTS, arm->joints.position_command);
+                }
             }
+            auto update_done = std::chrono::steady_clock::now();
 
-            _position_joint_interface.registerHandle(joint_position_handle);
+            _enforce_limits(elapsed_time);
+            auto limits_done = std::chrono::steady_clock::now();
 
-            // Create effort joint interface
-            hardware_interface::JointHandle joint_effort_handle(joint_state_handle, &_joint_effort_command[i]);
+            for (auto& arm : _arms) {
+                if (arm->in_cycle)
+                    _write(*arm);
+            }
+            auto write_done = std::chrono::steady_clock::now();
+
+            // Hand the cycle over to the telemetry thread (no allocation, no ROS communication)
+            bool primary = true;
+            for (size_t a = 0; a < _arms.size(); a++) {
+                FriArm& arm = *_arms[a];
+                if (!arm.in_cycle)
+                    continue;
 
-            if (has_soft_limits) {
-                joint_limits_interface::EffortJointSoftLimitsHandle joint_limits_handle(joint_effort_handle, limits, soft_limits);
-                _effort_joint_limits_interface.registerHandle(joint_limits_handle);
+                CycleSnapshot snapshot;
+                snapshot.arm = a;
+                snapshot.primary = primary;
+                primary = false;
+                snapshot.stamp = now.toNSec();
+                snapshot.received = arm.received;
+                snapshot.holding = _hold_controllers;
+                snapshot.connected = arm.connection && arm.connection->is_open();
+                snapshot.stage_latency[STAGE_READ] = arm.received ? to_ns(read_done - arm.receive_time) : 0;
+                snapshot.stage_latency[STAGE_UPDATE] = to_ns(update_done - read_done);
+                snapshot.stage_latency[STAGE_LIMITS] = to_ns(limits_done - update_done);
+                snapshot.stage_latency[STAGE_WRITE] = to_ns(write_done - limits_done);
+                snapshot.receive_jitter = 0;
+                if (arm.received) {
+                    if (arm.last_receive_time != std::chrono::steady_clock::time_point())
+                        snapshot.receive_jitter = std::llabs(to_ns(arm.receive_time - arm.last_receive_time) - static_cast<int64_t>(arm.robot_state.getSampleTime() * 1e9));
+                    arm.last_receive_time = arm.receive_time;
+                }
+                snapshot.errors = arm.errors;
+                _fill_snapshot(snapshot, arm, elapsed_time, overrun);
+                _telemetry->push(snapshot);
             }
-            else if (has_limits) {
-                joint_limits_interface::EffortJointSaturationHandle joint_limits_handle(joint_effort_handle, limits);
-                _effort_joint_saturation_interface.registerHandle(joint_limits_handle);
+
+            _release_arms();
+
+            if (_replay_finished()) {
+                ROS_INFO_STREAM_NAMED("Iiwa", "End of the FRI replay.");
+                break;
             }
 
-            _effort_joint_interface.registerHandle(joint_effort_handle);
+            // In packet-clocked mode, the (blocking) reception of the next monitoring message paces the loop
+            if (!_packet_clocked)
+                rate.sleep();
+        }
+    }
+
+    void Iiwa::_receive_loop(FriArm& arm)
+    {
+        RealtimeSettings settings = _realtime_settings;
+        settings.cpu_set = arm.cpu_set;
+        settings.lock_memory = false; // done for the whole process by the control thread
+        if (!setup_realtime(settings, "receive" + arm_label(arm)))
+            ROS_WARN_STREAM_NAMED("Iiwa", "Some of the requested real-time settings were refused for the receive thread" << arm_label(arm) << ".");
+
+        while (_running && ros::ok()) {
+            // The control thread owns the message buffers until it released the previous message
+            {
+                std::unique_lock<std::mutex> lock(_sync_mutex);
+                _sync_cv.wait(lock, [&] { return !arm.pending || !_running; });
+                if (!_running)
+                    break;
+            }
 
-            // Create velocity joint interface
-            hardware_interface::JointHandle joint_velocity_handle(joint_state_handle, &_joint_velocity_command[i]);
+            bool received = _receive(arm);
 
-            if (has_soft_limits) {
-                joint_limits_interface::VelocityJointSoftLimitsHandle joint_limits_handle(joint_velocity_handle, limits, soft_limits);
-                _velocity_joint_limits_interface.registerHandle(joint_limits_handle);
+            {
+                std::lock_guard<std::mutex> lock(_sync_mutex);
+                arm.received = received;
+                arm.pending = true;
             }
-            else {
-                joint_limits_interface::VelocityJointSaturationHandle joint_limits_handle(joint_velocity_handle, limits);
-                _velocity_joint_saturation_interface.registerHandle(joint_limits_handle);
+            _sync_cv.notify_all();
+        }
+    }
+
+    void Iiwa::_collect_arms()
+    {
+        if (_arms.size() == 1) {
+            FriArm& arm = *_arms[0];
+            arm.received = _receive(arm);
+            arm.in_cycle = true;
+            return;
+        }
+
+        auto any_pending = [this]() {
+            for (auto& arm : _arms) {
+                if (arm->pending)
+                    return true;
             }
+            return false;
+        };
+        auto all_pending = [this]() {
+            for (auto& arm : _arms) {
+                if (!arm->pending)
+                    return false;
+            }
+            return true;
+        };
+
+        std::unique_lock<std::mutex> lock(_sync_mutex);
+        // The first message opens the cycle (timed out receives are reported as well, so this does not block forever)
+        while (!any_pending() && _running && ros::ok())
+            _sync_cv.wait_for(lock, std::chrono::milliseconds(100));
+        // The other arms get a bounded window to catch up; late ones take part in the next cycle
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::nanoseconds(_sync_window.toNSec());
+        _sync_cv.wait_until(lock, deadline, all_pending);
+
+        for (auto& arm : _arms)
+            arm->in_cycle = arm->pending;
+    }
 
-            _velocity_joint_interface.registerHandle(joint_velocity_handle);
+    void Iiwa::_release_arms()
+    {
+        if (_arms.size() == 1) {
+            _arms[0]->in_cycle = false;
+            return;
         }
 
-        registerInterface(&_joint_state_interface);
-        registerInterface(&_position_joint_interface);
-        registerInterface(&_effort_joint_interface);
-        registerInterface(&_velocity_joint_interface);
+        {
+            std::lock_guard<std::mutex> lock(_sync_mutex);
+            for (auto& arm : _arms) {
+                if (arm->in_cycle)
+                    arm->pending = false;
+                arm->in_cycle = false;
+            }
+        }
+        _sync_cv.notify_all();
+    }
 
-        _additional_pub.init(_nh, "additional_outputs", 20);
-        _additional_pub.msg_.external_torques.layout.dim.resize(1);
-        _additional_pub.msg_.external_torques.layout.data_offset = 0;
-        _additional_pub.msg_.external_torques.layout.dim[0].size = _num_joints;
-        _additional_pub.msg_.external_torques.layout.dim[0].stride = 0;
-        _additional_pub.msg_.external_torques.data.resize(_num_joints);
-        _additional_pub.msg_.commanded_torques.layout.dim.resize(1);
-        _additional_pub.msg_.commanded_torques.layout.data_offset = 0;
-        _additional_pub.msg_.commanded_torques.layout.dim[0].size = _num_joints;
-        _additional_pub.msg_.commanded_torques.layout.dim[0].stride = 0;
-        _additional_pub.msg_.commanded_torques.data.resize(_num_joints);
-        _additional_pub.msg_.commanded_positions.layout.dim.resize(1);
-        _additional_pub.msg_.commanded_positions.layout.data_offset = 0;
-        _additional_pub.msg_.commanded_positions.layout.dim[0].size = _num_joints;
-        _additional_pub.msg_.commanded_positions.layout.dim[0].stride = 0;
-        _additional_pub.msg_.commanded_positions.data.resize(_num_joints);
+    void Iiwa::_fill_snapshot(CycleSnapshot& snapshot, const FriArm& arm, ros::Duration elapsed_time, bool overrun)
+    {
+        const kuka::fri::DummyState& state = arm.robot_state;
+        snapshot.fri_stamp = static_cast<int64_t>(state.getTimestampSec()) * 1000000000LL + state.getTimestampNanoSec();
+        snapshot.elapsed = elapsed_time.toNSec();
+        snapshot.session_state = arm.fri_message_data->lastState;
+        snapshot.commanding = arm.commanding;
+        snapshot.overrun = overrun;
+
+        for (int i = 0; i < NUM_JOINTS; i++) {
+            snapshot.measured_position[i] = state.getMeasuredJointPosition()[i];
+            snapshot.commanded_position[i] = state.getCommandedJointPosition()[i];
+            snapshot.measured_torque[i] = state.getMeasuredTorque()[i];
+            snapshot.commanded_torque[i] = state.getCommandedTorque()[i];
+            snapshot.external_torque[i] = state.getExternalTorque()[i];
+        }
     }
 
-    void Iiwa::_ctrl_loop()
+    void Iiwa::_telemetry_loop()
     {
-        static ros::Rate rate(_control_freq);
-        while (ros::ok()) {
-            ros::Time time = ros::Time::now();
-
-            // TO-DO: Get real elapsed time?
-            auto elapsed_time = ros::Duration(1. / _control_freq);
-
-            _read(elapsed_time);
-            _controller_manager->update(ros::Time::now(), elapsed_time);
-            _write(elapsed_time);
-
-            // publish additional outputs
-            if (_additional_pub.trylock()) {
-                _additional_pub.msg_.header.stamp = ros::Time::now();
-                for (unsigned i = 0; i < _num_joints; i++) {
-                    _additional_pub.msg_.external_torques.data[i] = _robot_state.getExternalTorque()[i];
-                    _additional_pub.msg_.commanded_torques.data[i] = _robot_state.getCommandedTorque()[i];
-                    _additional_pub.msg_.commanded_positions.data[i] = _robot_state.getCommandedJointPosition()[i];
-                }
-                _additional_pub.unlockAndPublish();
+        ros::Rate rate(_publish_rate);
+        ros::WallDuration diagnostics_period(1. / _diagnostics_rate);
+        ros::WallTime last_report = ros::WallTime::now();
+
+        CycleSnapshot snapshot;
+        std::vector<CycleSnapshot> latest(_arms.size());
+        std::vector<bool> updated(_arms.size());
+        while (_running && ros::ok()) {
+            // Drain everything the control thread produced (for the statistics),
+            // but publish only the latest snapshot of every arm (decimation)
+            std::fill(updated.begin(), updated.end(), false);
+            while (_telemetry->pop(snapshot)) {
+                _record_statistics(snapshot);
+                if (_recorder)
+                    _recorder->record(snapshot);
+                latest[snapshot.arm] = snapshot;
+                updated[snapshot.arm] = true;
+                _report_events(*_arms[snapshot.arm], snapshot);
+                _arms[snapshot.arm]->published_errors = snapshot.errors;
+            }
+
+            for (size_t a = 0; a < _arms.size(); a++) {
+                if (updated[a])
+                    _publish(*_arms[a], latest[a]);
+            }
+
+            if ((ros::WallTime::now() - last_report) > diagnostics_period) {
+                _publish_diagnostics(_published_errors());
+                last_report = ros::WallTime::now();
             }
 
-            _publish();
             rate.sleep();
         }
+
+        // Account for the last cycles and report the whole run
+        while (_telemetry->pop(snapshot)) {
+            _record_statistics(snapshot);
+            if (_recorder)
+                _recorder->record(snapshot);
+            _report_events(*_arms[snapshot.arm], snapshot);
+            _arms[snapshot.arm]->published_errors = snapshot.errors;
+        }
+        if (_recorder)
+            _recorder->close();
+        _dump_statistics(_published_errors());
     }
 
-    void Iiwa::_publish()
+    void Iiwa::_publish(FriArm& arm, const CycleSnapshot& snapshot)
     {
-        std_msgs::Bool msg;
-        msg.data = _commanding;
-        _commanding_status_pub.publish(msg);
+        arm.additional_msg.header.stamp.fromNSec(snapshot.stamp);
+        for (int i = 0; i < NUM_JOINTS; i++) {
+            arm.additional_msg.external_torques.data[i] = snapshot.external_torque[i];
+            arm.additional_msg.commanded_torques.data[i] = snapshot.commanded_torque[i];
+            arm.additional_msg.commanded_positions.data[i] = snapshot.commanded_position[i];
+        }
+        arm.additional_pub.publish(arm.additional_msg);
+
+        arm.commanding_msg.data = snapshot.commanding;
+        arm.commanding_status_pub.publish(arm.commanding_msg);
     }
 
-    void Iiwa::_load_params()
+    void Iiwa::_record_statistics(const CycleSnapshot& snapshot)
+    {
+        CycleStatistics* stats[2] = {_window_stats.get(), _total_stats.get()};
+        for (CycleStatistics* st : stats) {
+            // Reception is per arm, the rest of the cycle is shared by all arms
+            if (snapshot.received) {
+                st->receive_jitter.record(snapshot.receive_jitter);
+                st->stages[STAGE_READ].record(snapshot.stage_latency[STAGE_READ]);
+            }
+            if (!snapshot.primary)
+                continue;
+            st->dt.record(snapshot.elapsed);
+            for (int i = STAGE_UPDATE; i < NUM_STAGES; i++)
+                st->stages[i].record(snapshot.stage_latency[i]);
+            if (snapshot.overrun)
+                st->overruns++;
+        }
+    }
+
+    void Iiwa::_report_events(FriArm& arm, const CycleSnapshot& snapshot)
+    {
+        // The control and receive threads only leave their traces in the snapshots: the logging happens here
+        if (snapshot.session_state != arm.published_state) {
+            ROS_INFO_STREAM_NAMED("Iiwa", "FRI session state" << arm_label(arm) << ": " << session_state_name((kuka::fri::ESessionState)arm.published_state) << " -> " << session_state_name((kuka::fri::ESessionState)snapshot.session_state));
+            arm.published_state = snapshot.session_state;
+        }
+
+        if (snapshot.errors.reconnect > arm.published_errors.reconnect) {
+            if (snapshot.connected)
+                ROS_WARN_STREAM_NAMED("Iiwa", "No FRI message for " << arm.reconnect_timeout << "s" << arm_label(arm) << ". Reopened the connection on port " << arm.port << ".");
+            else
+                ROS_ERROR_STREAM_NAMED("Iiwa", "Could not reopen the FRI connection on port " << arm.port << arm_label(arm) << ". Retrying in " << arm.reconnect_timeout << "s.");
+        }
+
+        if (snapshot.primary && snapshot.holding != _reported_holding) {
+            if (snapshot.holding)
+                ROS_WARN_STREAM_NAMED("Iiwa", "FRI session lost. Holding the controllers until all sessions are back.");
+            else
+                ROS_INFO_STREAM_NAMED("Iiwa", "FRI session(s) (re)started. Starting the controllers from the current state.");
+            _reported_holding = snapshot.holding;
+        }
+    }
+
+    FriErrorCounters Iiwa::_published_errors() const
+    {
+        FriErrorCounters errors;
+        for (auto& arm : _arms)
+            errors.add(arm->published_errors);
+        return errors;
+    }
+
+    void Iiwa::_publish_diagnostics(const FriErrorCounters& errors)
+    {
+        size_t dropped = _telemetry->dropped();
+        bool new_errors = (errors.receive > _reported_errors.receive) || (errors.decode > _reported_errors.decode) || (errors.encode > _reported_errors.encode) || (errors.send > _reported_errors.send) || (errors.reconnect > _reported_errors.reconnect);
+
+        if (_window_stats->overruns > 0)
+            ROS_WARN_STREAM_NAMED("Iiwa", _window_stats->overruns << " control cycle(s) took more than twice the expected period (" << _control_period.toSec() << "s)!");
+        if (dropped > _reported_dropped)
+            ROS_WARN_STREAM_NAMED("Iiwa", "Telemetry is lagging behind: " << (dropped - _reported_dropped) << " snapshot(s) dropped.");
+
+        _diagnostics_msg.header.stamp = ros::Time::now();
+        _diagnostics_msg.status.resize(1);
+        diagnostic_msgs::DiagnosticStatus& status = _diagnostics_msg.status[0];
+        status.name = "iiwa_driver: control loop";
+        status.hardware_id.clear();
+        for (auto& arm : _arms)
+            status.hardware_id += (status.hardware_id.empty() ? "" : ", ") + arm->remote_host;
+        status.level = (new_errors || _window_stats->overruns > 0 || dropped > _reported_dropped) ? diagnostic_msgs::DiagnosticStatus::WARN : diagnostic_msgs::DiagnosticStatus::OK;
+        status.message = (status.level == diagnostic_msgs::DiagnosticStatus::OK) ? "OK" : "Overruns, FRI errors or dropped telemetry";
+        status.values.clear();
+
+        add_value(status, "cycles", _window_stats->dt.count());
+        add_value(status, "overruns", _window_stats->overruns);
+        add_histogram(status, "dt", _window_stats->dt);
+        add_histogram(status, "receive jitter", _window_stats->receive_jitter);
+        for (int i = 0; i < NUM_STAGES; i++)
+            add_histogram(status, std::string("stage ") + stage_name(i), _window_stats->stages[i]);
+        add_value(status, "receive failures (total)", errors.receive);
+        add_value(status, "decode failures (total)", errors.decode);
+        add_value(status, "encode failures (total)", errors.encode);
+        add_value(status, "send failures (total)", errors.send);
+        add_value(status, "reconnections (total)", errors.reconnect);
+        add_value(status, "dropped snapshots (total)", dropped);
+
+        _diagnostics_pub.publish(_diagnostics_msg);
+
+        _window_stats->reset();
+        _reported_errors = errors;
+        _reported_dropped = dropped;
+    }
+
+    void Iiwa::_dump_statistics(const FriErrorCounters& errors)
+    {
+        auto line = [](const std::string& name, const LatencyHistogram& histogram) {
+            std::ostringstream str;
+            str << std::fixed << std::setprecision(1) << std::setw(16) << std::left << name << std::right
+                << std::setw(10) << histogram.mean() * 1e-3
+                << std::setw(10) << histogram.percentile(0.5) * 1e-3
+                << std::setw(10) << histogram.percentile(0.99) * 1e-3
+                << std::setw(10) << histogram.percentile(0.999) * 1e-3
+                << std::setw(10) << histogram.max() * 1e-3;
+            return str.str();
+        };
+
+        std::ostringstream str;
+        str << "Control loop statistics over " << _total_stats->dt.count() << " cycles (in us):\n";
+        str << std::setw(16) << std::left << "" << std::right << std::setw(10) << "mean" << std::setw(10) << "p50" << std::setw(10) << "p99" << std::setw(10) << "p99.9" << std::setw(10) << "max"
+            << "\n";
+        str << line("dt", _total_stats->dt) << "\n";
+        str << line("receive jitter", _total_stats->receive_jitter) << "\n";
+        for (int i = 0; i < NUM_STAGES; i++)
+            str << line(std::string("stage ") + stage_name(i), _total_stats->stages[i]) << "\n";
+        str << "overruns: " << _total_stats->overruns
+            << ", failures (receive/decode/encode/send): " << errors.receive << "/" << errors.decode << "/" << errors.encode << "/" << errors.send
+            << ", reconnections: " << errors.reconnect
+            << ", dropped snapshots: " << _telemetry->dropped();
+
+        ROS_INFO_STREAM_NAMED("Iiwa", str.str());
+
+        if (!_statistics_file.empty())
+            _write_statistics(errors);
+    }
+
+    void Iiwa::_write_statistics(const FriErrorCounters& errors)
+    {
+        // Write the header only for a new file, so that several runs (e.g. one per controller) end up in one table
+        bool exists = std::ifstream(_statistics_file).good();
+        std::ofstream file(_statistics_file, std::ios::app);
+        if (!file) {
+            ROS_ERROR_STREAM_NAMED("Iiwa", "Could not write the statistics to '" << _statistics_file << "'.");
+            return;
+        }
+
+        std::vector<std::pair<std::string, const LatencyHistogram*>> series = {{"dt", &_total_stats->dt}, {"receive_jitter", &_total_stats->receive_jitter}};
+        for (int i = 0; i < NUM_STAGES; i++)
+            series.push_back({std::string("stage_") + stage_name(i), &_total_stats->stages[i]});
+
+        // all values in microseconds
+        if (!exists) {
+            file << "label,cycles,overruns,receive_failures,decode_failures,encode_failures,send_failures";
+            for (auto& s : series)
+                file << "," << s.first << "_mean," << s.first << "_p50," << s.first << "_p99," << s.first << "_p99.9," << s.first << "_max";
+            file << "\n";
+        }
+
+        file << _statistics_label << "," << _total_stats->dt.count() << "," << _total_stats->overruns << "," << errors.receive << "," << errors.decode << "," << errors.encode << "," << errors.send;
+        file << std::fixed << std::setprecision(2);
+        for (auto& s : series)
+            file << "," << s.second->mean() * 1e-3 << "," << s.second->percentile(0.5) * 1e-3 << "," << s.second->percentile(0.99) * 1e-3 << "," << s.second->percentile(0.999) * 1e-3 << "," << s.second->max() * 1e-3;
+        file << "\n";
+    }
+
+    bool Iiwa::_load_params()
     {
         ros::NodeHandle n_p("~");
 
-        n_p.param("fri/port", _port, 30200); // Default port is 30200
-        n_p.param<std::string>("fri/robot_ip", _remote_host, "192.170.10.2"); // Default robot ip is 192.170.10.2
-        n_p.param<std::string>("fri/robot_description", _robot_description, "/robot_description");
+        if (!_load_arms(n_p))
+            return false;
 
         n_p.param("hardware_interface/control_freq", _control_freq, 200.);
-        n_p.getParam("hardware_interface/joints", _joint_names);
+        _control_period = ros::Duration(1. / _control_freq);
+
+        std::string loop_mode;
+        n_p.param<std::string>("hardware_interface/loop_mode", loop_mode, "packet"); // same default as config/iiwa.yaml
+        _packet_clocked = (loop_mode != "rate");
+        if (_packet_clocked && loop_mode != "packet")
+            ROS_WARN_STREAM_NAMED("Iiwa", "Unknown loop mode '" << loop_mode << "'. Using 'packet' instead.");
+
+        for (auto& arm : _arms) {
+            if (arm->receive_timeout < 0)
+                arm->receive_timeout = 0;
+            if (_arms.size() > 1 && arm->receive_timeout == 0) {
+                // The receive threads have to come back once in a while (e.g. to shut down)
+                ROS_WARN_STREAM_NAMED("Iiwa", "A receive timeout is required with several robots" << arm_label(*arm) << ". Using 100ms.");
+                arm->receive_timeout = 100;
+            }
+        }
+
+        double sync_window;
+        n_p.param("hardware_interface/sync_window", sync_window, 0.5 / _control_freq);
+        _sync_window = ros::Duration(sync_window);
+
+        n_p.param<std::string>("hardware_interface/estimator/type", _estimator_settings.type, "exponential");
+        n_p.param("hardware_interface/estimator/alpha", _estimator_settings.alpha, 0.2);
+        n_p.param("hardware_interface/estimator/window", _estimator_settings.window, 15);
+        n_p.param("hardware_interface/estimator/jerk_noise", _estimator_settings.jerk_noise, 1e2);
+        n_p.param("hardware_interface/estimator/position_noise", _estimator_settings.position_noise, 1e-5);
+
+        n_p.param("hardware_interface/telemetry/publish_rate", _publish_rate, 100.);
+        n_p.param("hardware_interface/telemetry/diagnostics_rate", _diagnostics_rate, 1.);
+        n_p.param<std::string>("hardware_interface/telemetry/statistics_file", _statistics_file, "");
+        n_p.param<std::string>("hardware_interface/telemetry/statistics_label", _statistics_label, "");
+        n_p.param<std::string>("hardware_interface/telemetry/recorder/file", _recorder_file, "");
+        n_p.param("hardware_interface/telemetry/recorder/capacity", _recorder_capacity, 600000);
+
+        int capture_size;
+        n_p.param("hardware_interface/transport/capture_size", capture_size, 64);
+        _capture_size = static_cast<size_t>(std::max(capture_size, 1)) << 20;
+        n_p.param("hardware_interface/transport/replay_realtime", _replay_realtime, false);
+        n_p.param("hardware_interface/transport/replay_loops", _replay_loops, 1);
+        n_p.param("hardware_interface/transport/replay_delay", _replay_delay, 0.);
+
+        n_p.param("hardware_interface/realtime/priority", _realtime_settings.priority, 0);
+        n_p.getParam("hardware_interface/realtime/cpu_set", _realtime_settings.cpu_set);
+        n_p.param("hardware_interface/realtime/lock_memory", _realtime_settings.lock_memory, false);
+        n_p.param("hardware_interface/realtime/prefault_stack", _realtime_settings.prefault_stack, false);
+
+        return true;
     }
 
-    void Iiwa::_read(ros::Duration elapsed_time)
+    bool Iiwa::_load_arms(ros::NodeHandle& n_p)
     {
-        // Read data from robot (via FRI)
-        kuka::fri::ESessionState fri_state;
-        _read_fri(fri_state);
+        XmlRpc::XmlRpcValue fri;
+        n_p.getParam("fri", fri);
+
+        if (fri.getType() != XmlRpc::XmlRpcValue::TypeArray) {
+            // Single robot: 'fri' is a map and the joints are in 'hardware_interface'
+            std::unique_ptr<FriArm> arm(new FriArm);
+            n_p.param("fri/port", arm->port, 30200); // Default port is 30200
+            n_p.param<std::string>("fri/robot_ip", arm->remote_host, "192.170.10.2"); // Default robot ip is 192.170.10.2
+            n_p.param<std::string>("fri/robot_description", _robot_description, "/robot_description");
+            n_p.param<std::string>("fri/capture_file", arm->capture_file, "");
+            n_p.param<std::string>("fri/replay_file", arm->replay_file, "");
+            n_p.param("fri/receive_timeout", arm->receive_timeout, 100);
+            n_p.param("fri/reconnect_timeout", arm->reconnect_timeout, 1.);
+            n_p.getParam("hardware_interface/joints", arm->joint_names);
+            _arms.push_back(std::move(arm));
+            return true;
+        }
+
+        // Several robots: 'fri' is a list with one entry (port, robot_ip, joints, ...) per arm
+        n_p.param<std::string>("robot_description", _robot_description, "/robot_description");
+        try {
+            for (int i = 0; i < fri.size(); i++) {
+                XmlRpc::XmlRpcValue& value = fri[i];
+                if (value.getType() != XmlRpc::XmlRpcValue::TypeStruct || !value.hasMember("joints")) {
+                    ROS_ERROR_STREAM_NAMED("Iiwa", "Entry " << i << " of 'fri' needs at least a list of 'joints'.");
+                    return false;
+                }
+
+                std::unique_ptr<FriArm> arm(new FriArm);
+                arm->name = value.hasMember("name") ? static_cast<std::string>(value["name"]) : "arm_" + std::to_string(i);
+                if (value.hasMember("port"))
+                    arm->port = static_cast<int>(value["port"]);
+                if (value.hasMember("robot_ip"))
+                    arm->remote_host = static_cast<std::string>(value["robot_ip"]);
+                XmlRpc::XmlRpcValue& joints = value["joints"];
+                for (int j = 0; j < joints.size(); j++)
+                    arm->joint_names.push_back(static_cast<std::string>(joints[j]));
+                if (value.hasMember("capture_file"))
+                    arm->capture_file = static_cast<std::string>(value["capture_file"]);
+                if (value.hasMember("replay_file"))
+                    arm->replay_file = static_cast<std::string>(value["replay_file"]);
+                if (value.hasMember("receive_timeout"))
+                    arm->receive_timeout = static_cast<int>(value["receive_timeout"]);
+                if (value.hasMember("reconnect_timeout"))
+                    arm->reconnect_timeout = (value["reconnect_timeout"].getType() == XmlRpc::XmlRpcValue::TypeInt) ? static_cast<int>(value["reconnect_timeout"]) : static_cast<double>(value["reconnect_timeout"]);
+                if (value.hasMember("cpu_set")) {
+                    XmlRpc::XmlRpcValue& cpus = value["cpu_set"];
+                    for (int j = 0; j < cpus.size(); j++)
+                        arm->cpu_set.push_back(static_cast<int>(cpus[j]));
+                }
+                _arms.push_back(std::move(arm));
+            }
+        }
+        catch (const XmlRpc::XmlRpcException& e) {
+            ROS_ERROR_STREAM_NAMED("Iiwa", "Could not parse the list of robots in 'fri': " << e.getMessage());
+            return false;
+        }
+
+        if (_arms.empty()) {
+            ROS_ERROR_STREAM_NAMED("Iiwa", "The list of robots in 'fri' is empty.");
+            return false;
+        }
+
+        return true;
+    }
+
+    void Iiwa::_read(FriArm& arm, ros::Duration& elapsed_time)
+    {
+        // A receive that timed out means that the session is lost, a message that could not be decoded is only skipped
+        kuka::fri::ESessionState fri_state = (kuka::fri::ESessionState)arm.fri_message_data->lastState;
+        if (arm.received)
+            fri_state = (kuka::fri::ESessionState)arm.fri_message_data->monitoringMsg.connectionInfo.sessionState;
+        else if (arm.message_size <= 0)
+            fri_state = kuka::fri::IDLE;
+
+        if (arm.fri_message_data->lastState != fri_state) {
+            _on_fri_state_change(arm, (kuka::fri::ESessionState)arm.fri_message_data->lastState, fri_state);
+            arm.fri_message_data->lastState = fri_state;
+        }
+
+        elapsed_time = _elapsed_time(arm);
+
+        // Without a valid message there is nothing to read or command
+        if (!arm.received)
+            fri_state = kuka::fri::IDLE;
 
         switch (fri_state) {
         case kuka::fri::MONITORING_WAIT:
         case kuka::fri::MONITORING_READY:
         case kuka::fri::COMMANDING_WAIT:
-            _idle = false;
-            _commanding = false;
+            arm.idle = false;
+            arm.commanding = false;
             break;
         case kuka::fri::COMMANDING_ACTIVE:
-            _idle = false;
-            _commanding = true;
+            arm.idle = false;
+            arm.commanding = true;
             break;
         case kuka::fri::IDLE: // if idle, do nothing
         default:
-            _idle = true;
-            _commanding = false;
+            arm.idle = true;
+            arm.commanding = false;
             return;
         }
 
         // Update ROS structures
-        _joint_position_prev = _joint_position;
+        const double* measured_torque = arm.robot_state.getMeasuredTorque();
+        arm.velocity_estimator->update(arm.robot_state.getMeasuredJointPosition(), elapsed_time.toSec(), arm.joints.velocity, arm.joints.acceleration);
 
-        for (int i = 0; i < _num_joints; i++) {
-            _joint_position[i] = _robot_state.getMeasuredJointPosition()[i];
-            _joint_velocity[i] = filters::exponentialSmoothing((_joint_position[i] - _joint_position_prev[i]) / elapsed_time.toSec(), _joint_velocity[i], 0.2);
-            _joint_effort[i] = _robot_state.getMeasuredTorque()[i];
+        for (int i = 0; i < NUM_JOINTS; i++) {
+            arm.joints.position[i] = arm.robot_state.getMeasuredJointPosition()[i];
+            arm.joints.effort[i] = measured_torque[i];
         }
     }
 
-    void Iiwa::_write(ros::Duration elapsed_time)
+    ros::Duration Iiwa::_elapsed_time(FriArm& arm)
     {
-        if (_idle) // if idle, do nothing
-            return;
+        auto now = std::chrono::steady_clock::now();
+        bool first_cycle = (arm.last_cycle_time == std::chrono::steady_clock::time_point());
+        int64_t elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - arm.last_cycle_time).count();
+        arm.last_cycle_time = now;
+
+        if (_packet_clocked) {
+            // Prefer the robot's clock, i.e. the timestamp of the monitoring message,
+            // and fall back to the monotonic clock if the timestamp did not advance
+            int64_t stamp = static_cast<int64_t>(arm.robot_state.getTimestampSec()) * 1000000000LL + arm.robot_state.getTimestampNanoSec();
+            if (arm.last_fri_stamp > 0 && stamp > arm.last_fri_stamp)
+                elapsed_ns = stamp - arm.last_fri_stamp;
+            first_cycle = first_cycle || (arm.last_fri_stamp == 0);
+            arm.last_fri_stamp = stamp;
+        }
+
+        // Nothing to measure against in the first cycle
+        if (first_cycle)
+            return _control_period;
+
+        ros::Duration elapsed;
+        elapsed.fromNSec(elapsed_ns);
+        return elapsed;
+    }
+
+    void Iiwa::_enforce_limits(ros::Duration elapsed_time)
+    {
+        for (auto& arm : _arms) {
+            // The others are still owned by their receive threads (like in _write)
+            if (!arm->in_cycle)
+                continue;
+
+            JointBlock<NUM_JOINTS>& joints = arm->joints;
+            if (arm->idle) { // if idle, do nothing (and limit the first position command around the measured position)
+                arm->limits.reset();
+                continue;
+            }
+
+            // Only the commands that _write sends
+            kuka::fri::EClientCommandMode mode = arm->robot_state.getClientCommandMode();
+            if (mode == kuka::fri::TORQUE)
+                arm->limits.enforce_effort(joints.position, joints.velocity, joints.effort_command);
+            else if (mode == kuka::fri::POSITION)
+                arm->limits.enforce_position(joints.position, joints.position_command, elapsed_time.toSec());
+        }
+    }
 
-        // enforce limits
-        _position_joint_limits_interface.enforceLimits(elapsed_time);
-        _position_joint_saturation_interface.enforceLimits(elapsed_time);
-        _effort_joint_limits_interface.enforceLimits(elapsed_time);
-        _effort_joint_saturation_interface.enforceLimits(elapsed_time);
-        _velocity_joint_limits_interface.enforceLimits(elapsed_time);
-        _velocity_joint_saturation_interface.enforceLimits(elapsed_time);
+    void Iiwa::_write(FriArm& arm)
+    {
+        if (arm.idle) // if idle, do nothing
+            return;
 
         // reset commmand message
-        _fri_message_data->resetCommandMessage();
+        arm.fri_message_data->resetCommandMessage();
 
-        if (_robot_state.getClientCommandMode() == kuka::fri::TORQUE) {
-            _robot_command.setTorque(_joint_effort_command.data());
-            _robot_command.setJointPosition(_joint_position.data());
+        if (arm.robot_state.getClientCommandMode() == kuka::fri::TORQUE) {
+            arm.robot_command.setTorque(arm.joints.effort_command);
+            arm.robot_command.setJointPosition(arm.joints.position);
         }
-        else if (_robot_state.getClientCommandMode() == kuka::fri::POSITION)
-            _robot_command.setJointPosition(_joint_position_command.data());
+        else if (arm.robot_state.getClientCommandMode() == kuka::fri::POSITION)
+            arm.robot_command.setJointPosition(arm.joints.position_command);
         // else ERROR
 
-        _write_fri();
+        _write_fri(arm);
     }
 
-    bool Iiwa::_init_fri()
+    bool Iiwa::_init_fri(FriArm& arm)
     {
-        _idle = true;
-        _commanding = false;
+        arm.idle = true;
+        arm.commanding = false;
 
         // Create message/client data
-        _fri_message_data = new kuka::fri::ClientData(_robot_state.NUMBER_OF_JOINTS);
+        arm.fri_message_data = new kuka::fri::ClientData(arm.robot_state.NUMBER_OF_JOINTS);
 
         // link monitoring and command message to wrappers
-        _robot_state.set_message(&_fri_message_data->monitoringMsg);
-        _robot_command.set_message(&_fri_message_data->commandMsg);
+        arm.robot_state.set_message(&arm.fri_message_data->monitoringMsg);
+        arm.robot_command.set_message(&arm.fri_message_data->commandMsg);
 
         // set specific message IDs
-        _fri_message_data->expectedMonitorMsgID = _robot_state.monitoring_message_id();
-        _fri_message_data->commandMsg.header.messageIdentifier = _robot_command.command_message_id();
+        arm.fri_message_data->expectedMonitorMsgID = arm.robot_state.monitoring_message_id();
+        arm.fri_message_data->commandMsg.header.messageIdentifier = arm.robot_command.command_message_id();
 
-        if (!_connect_fri())
+        arm.last_message_time = std::chrono::steady_clock::now();
+
+        if (!_connect_fri(arm))
             return false;
 
         return true;
     }
 
-    bool Iiwa::_connect_fri()
+    std::unique_ptr<FriTransport> Iiwa::_create_transport(const FriArm& arm)
+    {
+        std::unique_ptr<FriTransport> transport;
+        if (!arm.replay_file.empty())
+            transport.reset(new ReplayTransport(arm.replay_file, _replay_realtime, _replay_loops, _replay_delay, arm.receive_timeout));
+        else
+            transport.reset(new UdpTransport(arm.receive_timeout));
+
+        if (!arm.capture_file.empty()) {
+            ROS_INFO_STREAM_NAMED("Iiwa", "Capturing the FRI messages" << arm_label(arm) << " to '" << arm.capture_file << "' (written on shutdown).");
+            transport.reset(new CaptureTransport(std::move(transport), arm.capture_file, _capture_size));
+        }
+
+        return transport;
+    }
+
+    bool Iiwa::_replay_finished() const
+    {
+        for (auto& arm : _arms) {
+            if (!arm->finished.load(std::memory_order_relaxed))
+                return false;
+        }
+        return true;
+    }
+
+    bool Iiwa::_connect_fri(FriArm& arm)
     {
-        if (_fri_connection.isOpen()) {
+        if (!arm.connection)
+            arm.connection = _create_transport(arm);
+
+        if (arm.connection->is_open()) {
             // TO-DO: Use ROS output
             // printf("Warning: client application already connected!\n");
             return true;
         }
 
-        return _fri_connection.open(_port, _remote_host.c_str());
+        return arm.connection->open(arm.port, arm.remote_host.c_str());
+    }
+
+    void Iiwa::_disconnect_fri(FriArm& arm)
+    {
+        if (arm.connection && arm.connection->is_open())
+            arm.connection->close();
+    }
+
+    bool Iiwa::_reconnect_fri(FriArm& arm)
+    {
+        // Start over with a fresh socket; everything else (URDF, controllers, interfaces, captured messages) is kept
+        _disconnect_fri(arm);
+
+        arm.fri_message_data->lastSendCounter = 0;
+        arm.errors.reconnect++;
+
+        // A failure is reported by the telemetry thread (the connection stays closed in the snapshots)
+        return _connect_fri(arm);
     }
 
-    void Iiwa::_disconnect_fri()
+    bool Iiwa::_receive(FriArm& arm)
     {
-        if (_fri_connection.isOpen())
-            _fri_connection.close();
+        // Do not spin if the connection could not be (re)opened
+        if (!arm.connection || !arm.connection->is_open())
+            std::this_thread::sleep_for(std::chrono::milliseconds(std::max(arm.receive_timeout, 1)));
+
+        bool received = _read_fri(arm);
+        // The transport belongs to the receiving thread, the control thread only looks at this flag
+        arm.finished.store(arm.connection && arm.connection->finished(), std::memory_order_relaxed);
+
+        // Reopen the connection if the robot has been silent for too long
+        if (received)
+            arm.last_message_time = arm.receive_time;
+        else if (arm.reconnect_timeout > 0. && std::chrono::duration<double>(std::chrono::steady_clock::now() - arm.last_message_time).count() > arm.reconnect_timeout) {
+            _reconnect_fri(arm);
+            arm.last_message_time = std::chrono::steady_clock::now();
+        }
+
+        return received;
     }
 
-    bool Iiwa::_read_fri(kuka::fri::ESessionState& current_state)
+    bool Iiwa::_read_fri(FriArm& arm)
     {
-        if (!_fri_connection.isOpen()) {
+        arm.message_size = 0;
+
+        if (!arm.connection || !arm.connection->is_open()) {
             // TO-DO: Use ROS output
             // printf("Error: client application is not connected!\n");
             return false;
@@ -364,59 +1108,71 @@ namespace iiwa_ros {
         // **************************************************************************
         // Receive and decode new monitoring message
         // **************************************************************************
-        _message_size = _fri_connection.receive(_fri_message_data->receiveBuffer, kuka::fri::FRI_MONITOR_MSG_MAX_SIZE);
+        arm.message_size = arm.connection->receive(arm.fri_message_data->receiveBuffer, kuka::fri::FRI_MONITOR_MSG_MAX_SIZE);
 
-        if (_message_size <= 0) { // TODO: size == 0 -> connection closed (maybe go to IDLE instead of stopping?)
-            // TO-DO: Use ROS output
-            // printf("Error: failed while trying to receive monitoring message!\n");
+        if (arm.message_size <= 0) {
+            // Timed out (or the socket failed): the session is lost until the robot talks to us again
+            arm.errors.receive++;
             return false;
         }
+        arm.receive_time = std::chrono::steady_clock::now();
 
-        if (!_fri_message_data->decoder.decode(_fri_message_data->receiveBuffer, _message_size)) {
+        if (!arm.fri_message_data->decoder.decode(arm.fri_message_data->receiveBuffer, arm.message_size)) {
+            arm.errors.decode++;
             return false;
         }
 
         // check message type (so that our wrappers match)
-        if (_fri_message_data->expectedMonitorMsgID != _fri_message_data->monitoringMsg.header.messageIdentifier) {
+        if (arm.fri_message_data->expectedMonitorMsgID != arm.fri_message_data->monitoringMsg.header.messageIdentifier) {
             // TO-DO: Use ROS output
             // printf("Error: incompatible IDs for received message (got: %d expected %d)!\n",
-            //     (int)_fri_message_data->monitoringMsg.header.messageIdentifier,
-            //     (int)_fri_message_data->expectedMonitorMsgID);
+            //     (int)arm.fri_message_data->monitoringMsg.header.messageIdentifier,
+            //     (int)arm.fri_message_data->expectedMonitorMsgID);
+            arm.errors.decode++;
             return false;
         }
 
-        current_state = (kuka::fri::ESessionState)_fri_message_data->monitoringMsg.connectionInfo.sessionState;
+        return true;
+    }
 
-        if (_fri_message_data->lastState != current_state) {
-            _on_fri_state_change(_fri_message_data->lastState, current_state);
-            _fri_message_data->lastState = current_state;
+    void Iiwa::_on_fri_state_change(FriArm& arm, kuka::fri::ESessionState old_state, kuka::fri::ESessionState current_state)
+    {
+        // Logged by the telemetry thread, from the session state of the snapshots
+        if (old_state == kuka::fri::IDLE) {
+            // New session: forget the history of the previous one
+            arm.velocity_estimator->reset();
+            arm.last_fri_stamp = 0;
+            arm.last_cycle_time = std::chrono::steady_clock::time_point();
+            arm.last_receive_time = std::chrono::steady_clock::time_point();
         }
-
-        return true;
     }
 
-    bool Iiwa::_write_fri()
+    bool Iiwa::_write_fri(FriArm& arm)
     {
+        kuka::fri::ClientData* data = arm.fri_message_data;
+
         // **************************************************************************
         // Encode and send command message
         // **************************************************************************
 
-        _fri_message_data->lastSendCounter++;
+        data->lastSendCounter++;
         // check if its time to send an answer
-        if (_fri_message_data->lastSendCounter >= _fri_message_data->monitoringMsg.connectionInfo.receiveMultiplier) {
-            _fri_message_data->lastSendCounter = 0;
+        if (data->lastSendCounter >= data->monitoringMsg.connectionInfo.receiveMultiplier) {
+            data->lastSendCounter = 0;
 
             // set sequence counters
-            _fri_message_data->commandMsg.header.sequenceCounter = _fri_message_data->sequenceCounter++;
-            _fri_message_data->commandMsg.header.reflectedSequenceCounter = _fri_message_data->monitoringMsg.header.sequenceCounter;
+            data->commandMsg.header.sequenceCounter = data->sequenceCounter++;
+            data->commandMsg.header.reflectedSequenceCounter = data->monitoringMsg.header.sequenceCounter;
 
-            if (!_fri_message_data->encoder.encode(_fri_message_data->sendBuffer, _message_size)) {
+            if (!data->encoder.encode(data->sendBuffer, arm.message_size)) {
+                arm.errors.encode++;
                 return false;
             }
 
-            if (!_fri_connection.send(_fri_message_data->sendBuffer, _message_size)) {
+            if (!arm.connection->send(data->sendBuffer, arm.message_size)) {
                 // TO-DO: Use ROS output
                 // printf("Error: failed while trying to send command message!\n");
+                arm.errors.send++;
                 return false;
             }
         }
@@ -0,0 +1,178 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+// Converts the session logs of the driver (hardware_interface/telemetry/recorder) to CSV
+#include <iiwa_driver/session_recorder.h>
+
+// System headers
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// std headers
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+namespace {
+    void usage(const char* name)
+    {
+        std::cout << "Usage: " << name << " [options] <log> [output.csv]\n"
+                  << "  Writes the records of the log in chronological order as CSV (to stdout without output file).\n"
+                  << "  Times are in nanoseconds, positions in rad and torques in Nm.\n"
+                  << "Options:\n"
+                  << "  --arm <n>   only the records of the n-th robot\n"
+                  << "  --info      only print the header of the log" << std::endl;
+    }
+
+    void write_header(std::ostream& out)
+    {
+        out << "stamp,fri_stamp,arm,session_state,commanding,received,overrun,elapsed";
+        for (int i = 0; i < iiwa_ros::NUM_STAGES; i++)
+            out << ",stage_" << iiwa_ros::stage_name(i);
+        out << ",receive_jitter";
+        const char* names[5] = {"q", "q_cmd", "tau", "tau_cmd", "tau_ext"};
+        for (auto name : names) {
+            for (int j = 0; j < iiwa_ros::SESSION_LOG_JOINTS; j++)
+                out << "," << name << "_" << j;
+        }
+        out << "\n";
+    }
+
+    void write_record(std::ostream& out, const iiwa_ros::SessionRecord& r)
+    {
+        out << r.stamp << "," << r.fri_stamp << "," << r.arm << "," << r.session_state << "," << int(r.commanding) << "," << int(r.received) << "," << int(r.overrun) << "," << r.elapsed;
+        for (int i = 0; i < iiwa_ros::NUM_STAGES; i++)
+            out << "," << r.stage_latency[i];
+        out << "," << r.receive_jitter;
+        const double* values[5] = {r.measured_position, r.commanded_position, r.measured_torque, r.commanded_torque, r.external_torque};
+        for (auto v : values) {
+            for (int j = 0; j < iiwa_ros::SESSION_LOG_JOINTS; j++)
+                out << "," << v[j];
+        }
+        out << "\n";
+    }
+} // namespace
+
+int main(int argc, char** argv)
+{
+    std::string input, output;
+    int arm = -1;
+    bool info = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h") {
+            usage(argv[0]);
+            return 0;
+        }
+        else if (arg == "--arm" && i + 1 < argc)
+            arm = std::atoi(argv[++i]);
+        else if (arg == "--info")
+            info = true;
+        else if (arg.compare(0, 2, "--") == 0 || !output.empty()) {
+            usage(argv[0]);
+            return 1;
+        }
+        else if (input.empty())
+            input = arg;
+        else
+            output = arg;
+    }
+
+    if (input.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Map the log read-only: it can be converted while the driver is still writing it
+    int fd = open(input.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        std::cerr << "Could not open '" << input << "': " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+
+    size_t size = st.st_size;
+    if (size < sizeof(iiwa_ros::SessionLogHeader)) {
+        std::cerr << "'" << input << "' is not a session log." << std::endl;
+        return 1;
+    }
+    void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        std::cerr << "Could not map '" << input << "': " << std::strerror(errno) << std::endl;
+        return 1;
+    }
+
+    const iiwa_ros::SessionLogHeader* header = static_cast<const iiwa_ros::SessionLogHeader*>(data);
+    const iiwa_ros::SessionRecord* records = reinterpret_cast<const iiwa_ros::SessionRecord*>(static_cast<const char*>(data) + sizeof(iiwa_ros::SessionLogHeader));
+
+    if (std::memcmp(header->magic, iiwa_ros::SESSION_LOG_MAGIC, sizeof(iiwa_ros::SESSION_LOG_MAGIC)) != 0 || header->record_size != sizeof(iiwa_ros::SessionRecord) || header->num_joints != iiwa_ros::SESSION_LOG_JOINTS) {
+        std::cerr << "'" << input << "' is not a session log of this version of the driver." << std::endl;
+        return 1;
+    }
+    if (sizeof(iiwa_ros::SessionLogHeader) + header->capacity * sizeof(iiwa_ros::SessionRecord) > size) {
+        std::cerr << "'" << input << "' is truncated." << std::endl;
+        return 1;
+    }
+
+    // The latest min(count, capacity) records, oldest first
+    uint64_t count = header->count;
+    uint64_t first = (count > header->capacity) ? count - header->capacity : 0;
+
+    if (info) {
+        std::cout << "capacity: " << header->capacity << " records\n"
+                  << "written: " << count << " records\n"
+                  << "available: " << (count - first) << " records\n"
+                  << "started: " << header->start_stamp << " ns" << std::endl;
+        return 0;
+    }
+
+    std::ofstream file;
+    if (!output.empty()) {
+        file.open(output);
+        if (!file) {
+            std::cerr << "Could not write '" << output << "'." << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = output.empty() ? std::cout : file;
+    out.precision(10);
+
+    write_header(out);
+    for (uint64_t i = first; i < count; i++) {
+        const iiwa_ros::SessionRecord& r = records[i % header->capacity];
+        if (arm < 0 || r.arm == arm)
+            write_record(out, r);
+    }
+
+    munmap(data, size);
+    close(fd);
+
+    return 0;
+}
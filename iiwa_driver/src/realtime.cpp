@@ -0,0 +1,103 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#include <iiwa_driver/realtime.h>
+
+// ROS Headers
+#include <ros/ros.h>
+
+// System headers
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include <cerrno>
+#include <cstring>
+
+namespace iiwa_ros {
+    namespace {
+        // Should be enough for the control loop and everything it calls
+        const size_t PREFAULT_STACK_SIZE = 512 * 1024;
+
+        void prefault_stack()
+        {
+            volatile unsigned char dummy[PREFAULT_STACK_SIZE];
+            for (size_t i = 0; i < PREFAULT_STACK_SIZE; i += 4096)
+                dummy[i] = 0;
+        }
+    } // namespace
+
+    bool setup_realtime(const RealtimeSettings& settings, const std::string& thread_name)
+    {
+        bool ok = true;
+
+        if (settings.lock_memory) {
+            if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+                ROS_ERROR_STREAM_NAMED("Iiwa", "Could not lock memory (mlockall): " << std::strerror(errno) << ". Check 'ulimit -l' (memlock) for this user.");
+                ok = false;
+            }
+            else {
+                // Never give heap memory back to the system and never use mmap for allocations,
+                // so that memory once allocated stays locked and does not fault again
+                mallopt(M_TRIM_THRESHOLD, -1);
+                mallopt(M_MMAP_MAX, 0);
+                ROS_INFO_STREAM_NAMED("Iiwa", "Locked process memory.");
+            }
+        }
+
+        if (settings.prefault_stack)
+            prefault_stack();
+
+        if (!settings.cpu_set.empty()) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            for (int cpu : settings.cpu_set)
+                CPU_SET(cpu, &cpus);
+
+            int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus);
+            if (ret != 0) {
+                ROS_ERROR_STREAM_NAMED("Iiwa", "Could not pin the " << thread_name << " thread to the requested CPUs: " << std::strerror(ret) << ".");
+                ok = false;
+            }
+            else
+                ROS_INFO_STREAM_NAMED("Iiwa", "Pinned the " << thread_name << " thread to " << settings.cpu_set.size() << " CPU(s).");
+        }
+
+        if (settings.priority > 0) {
+            sched_param param;
+            param.sched_priority = settings.priority;
+
+            int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+            if (ret != 0) {
+                ROS_ERROR_STREAM_NAMED("Iiwa", "Could not set SCHED_FIFO priority " << settings.priority << " for the " << thread_name << " thread: " << std::strerror(ret) << ". Check 'ulimit -r' (rtprio) for this user.");
+                ok = false;
+            }
+            else
+                ROS_INFO_STREAM_NAMED("Iiwa", "Running the " << thread_name << " thread with SCHED_FIFO priority " << settings.priority << ".");
+        }
+
+        return ok;
+    }
+} // namespace iiwa_ros
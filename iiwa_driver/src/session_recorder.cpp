@@ -0,0 +1,141 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#include <iiwa_driver/session_recorder.h>
+
+// ROS Headers
+#include <ros/ros.h>
+
+// System headers
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+namespace iiwa_ros {
+    static_assert(sizeof(SessionLogHeader) == 64, "The session log header must keep its on-disk size");
+    static_assert(sizeof(SessionRecord) % 8 == 0, "The session records must keep their on-disk alignment");
+
+    SessionRecorder::SessionRecorder() : _fd(-1), _size(0), _header(nullptr), _records(nullptr) {}
+
+    SessionRecorder::~SessionRecorder()
+    {
+        close();
+    }
+
+    bool SessionRecorder::open(const std::string& file_name, size_t capacity)
+    {
+        close();
+
+        if (capacity == 0) {
+            ROS_ERROR_STREAM_NAMED("Iiwa", "The session log needs room for at least one record.");
+            return false;
+        }
+
+        _fd = ::open(file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (_fd < 0) {
+            ROS_ERROR_STREAM_NAMED("Iiwa", "Could not create the session log '" << file_name << "': " << std::strerror(errno));
+            return false;
+        }
+
+        // Reserve the whole file upfront so that recording never has to grow it
+        _size = sizeof(SessionLogHeader) + capacity * sizeof(SessionRecord);
+        int error = posix_fallocate(_fd, 0, _size);
+        if (error != 0) {
+            ROS_ERROR_STREAM_NAMED("Iiwa", "Could not allocate " << (_size >> 20) << "MB for the session log '" << file_name << "': " << std::strerror(error));
+            close();
+            return false;
+        }
+
+        void* data = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+        if (data == MAP_FAILED) {
+            ROS_ERROR_STREAM_NAMED("Iiwa", "Could not map the session log '" << file_name << "': " << std::strerror(errno));
+            close();
+            return false;
+        }
+
+        _header = static_cast<SessionLogHeader*>(data);
+        _records = reinterpret_cast<SessionRecord*>(static_cast<char*>(data) + sizeof(SessionLogHeader));
+
+        std::memset(_header, 0, sizeof(SessionLogHeader));
+        std::memcpy(_header->magic, SESSION_LOG_MAGIC, sizeof(SESSION_LOG_MAGIC));
+        _header->record_size = sizeof(SessionRecord);
+        _header->num_joints = SESSION_LOG_JOINTS;
+        _header->capacity = capacity;
+        _header->count = 0;
+        _header->start_stamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+        ROS_INFO_STREAM_NAMED("Iiwa", "Recording the FRI sessions to '" << file_name << "' (" << capacity << " records, " << (_size >> 20) << "MB).");
+        return true;
+    }
+
+    void SessionRecorder::close()
+    {
+        if (_header) {
+            msync(_header, _size, MS_SYNC);
+            munmap(_header, _size);
+        }
+        if (_fd >= 0)
+            ::close(_fd);
+
+        _fd = -1;
+        _size = 0;
+        _header = nullptr;
+        _records = nullptr;
+    }
+
+    void SessionRecorder::record(const CycleSnapshot& snapshot)
+    {
+        if (!_header)
+            return;
+
+        SessionRecord& r = _records[_header->count % _header->capacity];
+        r.stamp = snapshot.stamp;
+        r.fri_stamp = snapshot.fri_stamp;
+        r.elapsed = snapshot.elapsed;
+        for (int i = 0; i < NUM_STAGES; i++)
+            r.stage_latency[i] = snapshot.stage_latency[i];
+        r.receive_jitter = snapshot.receive_jitter;
+        r.arm = snapshot.arm;
+        r.session_state = snapshot.session_state;
+        r.commanding = snapshot.commanding;
+        r.received = snapshot.received;
+        r.overrun = snapshot.overrun;
+        std::memset(r.reserved, 0, sizeof(r.reserved));
+
+        std::memcpy(r.measured_position, snapshot.measured_position, sizeof(r.measured_position));
+        std::memcpy(r.commanded_position, snapshot.commanded_position, sizeof(r.commanded_position));
+        std::memcpy(r.measured_torque, snapshot.measured_torque, sizeof(r.measured_torque));
+        std::memcpy(r.commanded_torque, snapshot.commanded_torque, sizeof(r.commanded_torque));
+        std::memcpy(r.external_torque, snapshot.external_torque, sizeof(r.external_torque));
+
+        // A reader of the live file only looks at records below count
+        std::atomic_thread_fence(std::memory_order_release);
+        _header->count++;
+    }
+} // namespace iiwa_ros
@@ -0,0 +1,276 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#include <iiwa_driver/velocity_estimator.h>
+
+// ROS Headers
+#include <control_toolbox/filters.h>
+#include <ros/ros.h>
+
+namespace iiwa_ros {
+    namespace {
+        const int N = VelocityEstimator::NUMBER_OF_JOINTS;
+
+        // Exponential smoothing of the finite differences (what the driver always did)
+        class ExponentialEstimator : public VelocityEstimator {
+        public:
+            ExponentialEstimator(double alpha) : _alpha(alpha) { reset(); }
+
+            void reset() override { _first = true; }
+
+            void update(const double* position, double dt, double* velocity, double* acceleration) override
+            {
+                if (_first) {
+                    for (int i = 0; i < N; i++)
+                        _velocity[i] = _acceleration[i] = 0.;
+                }
+                else if (dt > 0.) {
+                    for (int i = 0; i < N; i++) {
+                        double v = filters::exponentialSmoothing((position[i] - _position[i]) / dt, _velocity[i], _alpha);
+                        _acceleration[i] = filters::exponentialSmoothing((v - _velocity[i]) / dt, _acceleration[i], _alpha);
+                        _velocity[i] = v;
+                    }
+                }
+                _first = false;
+
+                for (int i = 0; i < N; i++) {
+                    _position[i] = position[i];
+                    velocity[i] = _velocity[i];
+                    acceleration[i] = _acceleration[i];
+                }
+            }
+
+        protected:
+            double _alpha;
+            bool _first;
+            double _position[N], _velocity[N], _acceleration[N];
+        };
+
+        // Least-squares quadratic fit over the last samples (Savitzky-Golay), evaluated at the newest
+        // sample. The fit is done on the measured sample times, so it stays valid when packets jitter.
+        class SavitzkyGolayEstimator : public VelocityEstimator {
+        public:
+            static constexpr int MAX_WINDOW = 64;
+
+            SavitzkyGolayEstimator(int window) : _window(window) { reset(); }
+
+            void reset() override
+            {
+                _count = 0;
+                _head = 0;
+                _now = 0.;
+                for (int i = 0; i < N; i++)
+                    _velocity[i] = _acceleration[i] = 0.;
+            }
+
+            void update(const double* position, double dt, double* velocity, double* acceleration) override
+            {
+                // A sample without a new timestamp carries no information about the derivatives
+                if (_count == 0 || dt > 0.) {
+                    if (_count > 0)
+                        _now += dt;
+                    _time[_head] = _now;
+                    for (int i = 0; i < N; i++)
+                        _position[_head][i] = position[i];
+                    _newest = _head;
+                    _head = (_head + 1) % _window;
+                    if (_count < _window)
+                        _count++;
+
+                    _fit();
+                }
+
+                for (int i = 0; i < N; i++) {
+                    velocity[i] = _velocity[i];
+                    acceleration[i] = _acceleration[i];
+                }
+            }
+
+        protected:
+            int _window, _count, _head, _newest;
+            double _now;
+            double _time[MAX_WINDOW];
+            double _position[MAX_WINDOW][N];
+            double _velocity[N], _acceleration[N];
+
+            void _fit()
+            {
+                if (_count < 3) {
+                    // Not enough samples for a quadratic: use the finite difference
+                    if (_count == 2) {
+                        int previous = (_newest + _window - 1) % _window;
+                        double dt = _time[_newest] - _time[previous];
+                        for (int i = 0; i < N; i++)
+                            _velocity[i] = (_position[_newest][i] - _position[previous][i]) / dt;
+                    }
+                    return;
+                }
+
+                // Sample times relative to the newest one and normalized to [-1, 0] for conditioning
+                int oldest = (_newest + _window - _count + 1) % _window;
+                double span = _time[_newest] - _time[oldest];
+                double s[MAX_WINDOW];
+                double S[5] = {0., 0., 0., 0., 0.};
+                for (int k = 0; k < _count; k++) {
+                    int idx = (oldest + k) % _window;
+                    s[k] = (_time[idx] - _time[_newest]) / span;
+                    double p = 1.;
+                    for (int j = 0; j < 5; j++) {
+                        S[j] += p;
+                        p *= s[k];
+                    }
+                }
+
+                // Rows 1 and 2 of the inverse of the (symmetric) normal matrix [S0 S1 S2; S1 S2 S3; S2 S3 S4]
+                double c00 = S[2] * S[4] - S[3] * S[3];
+                double c01 = S[2] * S[3] - S[1] * S[4];
+                double c02 = S[1] * S[3] - S[2] * S[2];
+                double c11 = S[0] * S[4] - S[2] * S[2];
+                double c12 = S[1] * S[2] - S[0] * S[3];
+                double c22 = S[0] * S[2] - S[1] * S[1];
+                double det = S[0] * c00 + S[1] * c01 + S[2] * c02;
+                if (det <= 0.)
+                    return;
+
+                for (int i = 0; i < N; i++)
+                    _velocity[i] = _acceleration[i] = 0.;
+
+                for (int k = 0; k < _count; k++) {
+                    int idx = (oldest + k) % _window;
+                    double w_v = (c01 + c11 * s[k] + c12 * s[k] * s[k]) / (det * span);
+                    double w_a = 2. * (c02 + c12 * s[k] + c22 * s[k] * s[k]) / (det * span * span);
+                    // The weights sum up to zero, so subtracting the newest position only helps precision
+                    for (int i = 0; i < N; i++) {
+                        double dq = _position[idx][i] - _position[_newest][i];
+                        _velocity[i] += w_v * dq;
+                        _acceleration[i] += w_a * dq;
+                    }
+                }
+            }
+        };
+
+        // Per-joint Kalman filter with a constant-acceleration model (white jerk) on the measured dt
+        class KalmanEstimator : public VelocityEstimator {
+        public:
+            KalmanEstimator(double jerk_noise, double position_noise) : _q(jerk_noise), _r(position_noise * position_noise) { reset(); }
+
+            void reset() override { _first = true; }
+
+            void update(const double* position, double dt, double* velocity, double* acceleration) override
+            {
+                if (_first) {
+                    for (int i = 0; i < N; i++) {
+                        _x[i][0] = position[i];
+                        _x[i][1] = _x[i][2] = 0.;
+                        for (int j = 0; j < 3; j++)
+                            for (int l = 0; l < 3; l++)
+                                _P[i][j][l] = 0.;
+                        // Unknown velocity and acceleration at start-up
+                        _P[i][0][0] = _r;
+                        _P[i][1][1] = 1.;
+                        _P[i][2][2] = 100.;
+                    }
+                    _first = false;
+                }
+                else if (dt > 0.) {
+                    double F[3][3] = {{1., dt, 0.5 * dt * dt}, {0., 1., dt}, {0., 0., 1.}};
+                    double dt2 = dt * dt, dt3 = dt2 * dt;
+                    double Q[3][3] = {{_q * dt2 * dt3 / 20., _q * dt2 * dt2 / 8., _q * dt3 / 6.},
+                        {_q * dt2 * dt2 / 8., _q * dt3 / 3., _q * dt2 / 2.},
+                        {_q * dt3 / 6., _q * dt2 / 2., _q * dt}};
+
+                    for (int i = 0; i < N; i++) {
+                        // Predict
+                        double x[3], FP[3][3], P[3][3];
+                        for (int j = 0; j < 3; j++) {
+                            x[j] = 0.;
+                            for (int l = 0; l < 3; l++) {
+                                x[j] += F[j][l] * _x[i][l];
+                                FP[j][l] = 0.;
+                                for (int m = 0; m < 3; m++)
+                                    FP[j][l] += F[j][m] * _P[i][m][l];
+                            }
+                        }
+                        for (int j = 0; j < 3; j++) {
+                            for (int l = 0; l < 3; l++) {
+                                P[j][l] = Q[j][l];
+                                for (int m = 0; m < 3; m++)
+                                    P[j][l] += FP[j][m] * F[l][m];
+                            }
+                        }
+
+                        // Correct with the measured position
+                        double S = P[0][0] + _r;
+                        double y = position[i] - x[0];
+                        for (int j = 0; j < 3; j++) {
+                            double K = P[j][0] / S;
+                            _x[i][j] = x[j] + K * y;
+                            for (int l = 0; l < 3; l++)
+                                _P[i][j][l] = P[j][l] - K * P[0][l];
+                        }
+                    }
+                }
+
+                for (int i = 0; i < N; i++) {
+                    velocity[i] = _x[i][1];
+                    acceleration[i] = _x[i][2];
+                }
+            }
+
+        protected:
+            double _q, _r;
+            bool _first;
+            double _x[N][3]; //!< position, velocity, acceleration
+            double _P[N][3][3];
+        };
+    } // namespace
+
+    std::unique_ptr<VelocityEstimator> create_velocity_estimator(const EstimatorSettings& settings)
+    {
+        if (settings.type == "exponential") {
+            if (settings.alpha <= 0. || settings.alpha > 1.) {
+                ROS_ERROR_STREAM_NAMED("Iiwa", "The smoothing factor of the velocity estimator has to be in (0, 1], got " << settings.alpha << ".");
+                return nullptr;
+            }
+            return std::unique_ptr<VelocityEstimator>(new ExponentialEstimator(settings.alpha));
+        }
+        else if (settings.type == "savitzky_golay") {
+            if (settings.window < 3 || settings.window > SavitzkyGolayEstimator::MAX_WINDOW) {
+                ROS_ERROR_STREAM_NAMED("Iiwa", "The window of the velocity estimator has to be in [3, " << static_cast<int>(SavitzkyGolayEstimator::MAX_WINDOW) << "], got " << settings.window << ".");
+                return nullptr;
+            }
+            return std::unique_ptr<VelocityEstimator>(new SavitzkyGolayEstimator(settings.window));
+        }
+        else if (settings.type == "kalman") {
+            if (settings.jerk_noise <= 0. || settings.position_noise <= 0.) {
+                ROS_ERROR_STREAM_NAMED("Iiwa", "The noise parameters of the velocity estimator have to be positive.");
+                return nullptr;
+            }
+            return std::unique_ptr<VelocityEstimator>(new KalmanEstimator(settings.jerk_noise, settings.position_noise));
+        }
+
+        ROS_ERROR_STREAM_NAMED("Iiwa", "Unknown velocity estimator '" << settings.type << "'. Valid types are: exponential, savitzky_golay, kalman.");
+        return nullptr;
+    }
+} // namespace iiwa_ros
@@ -27,7 +27,13 @@
 // Iiwa service headers
 #include <iiwa_tools/GetGravity.h>
 
+// IIWA Tools
+#include <iiwa_tools/iiwa_tools.h>
+#include <iiwa_tools/joint_limit_table.h>
+
 // std headers
+#include <memory>
+#include <string>
 #include <vector>
 
 namespace iiwa_gazebo {
@@ -44,7 +50,27 @@ namespace iiwa_gazebo {
         virtual void writeSim(ros::Time time, ros::Duration period) override;
 
     protected:
-        // ROS related
+        void _init_effort_limits(const urdf::Model* const urdf_model);
+        bool _init_tools(const Eigen::Vector3d& gravity);
+
+        // Gazebo related
+        bool _ode_physics;
+        std::vector<double> _compensation; // gravity and Coriolis torques of the simulated joints
+        iiwa_tools::JointLimitTable _effort_limits; // effort and soft limits of the simulated joints
+
+        // In-process gravity compensation
+        bool _use_service;
+        iiwa_tools::IiwaTools _tools;
+        std::unique_ptr<iiwa_tools::IiwaTools::Context> _tools_context;
+        std::vector<int> _tools_joint_index; // of each simulated joint in the model of _tools (-1: none)
+        iiwa_tools::RobotState _tools_state;
+        iiwa_tools::ModelState _tools_model;
+        Eigen::Vector3d _tools_gravity;
+
+        // ROS related (gravity compensation service)
+        ros::NodeHandle _nh;
+        std::string _gravity_service_name;
+        bool _persistent_service;
         ros::ServiceClient _iiwa_gravity_client;
         iiwa_tools::GetGravity _gravity_srv;
     };
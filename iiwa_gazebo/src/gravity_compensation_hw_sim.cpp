@@ -23,6 +23,10 @@
 //|    GNU General Public License for more details.
 //|
 #include <iiwa_gazebo/gravity_compensation_hw_sim.h>
+#include <iiwa_tools/model_loader.h>
+
+#include <algorithm>
+#include <limits>
 
 namespace {
     double clamp(const double val, const double min_val, const double max_val)
@@ -43,15 +47,121 @@ namespace iiwa_gazebo {
         if (!DefaultRobotHWSim::initSim(robot_namespace, model_nh, parent_model, urdf_model, transmissions))
             return false;
 
-        _iiwa_gravity_client = model_nh.serviceClient<iiwa_tools::GetGravity>("/iiwa/iiwa_gravity_server");
-
-        // Initialize service message
+        _nh = model_nh;
         auto gravity = parent_model->GetWorld()->Gravity();
-        _gravity_srv.request.joint_angles.resize(n_dof_);
-        _gravity_srv.request.joint_velocities.resize(n_dof_);
-        _gravity_srv.request.joint_torques.resize(n_dof_);
 
-        _gravity_srv.request.gravity = {gravity[0], gravity[1], gravity[2]};
+        // The physics engine does not change during the simulation
+#if GAZEBO_MAJOR_VERSION >= 8
+        gazebo::physics::PhysicsEnginePtr physics = parent_model->GetWorld()->Physics();
+#else
+        gazebo::physics::PhysicsEnginePtr physics = parent_model->GetWorld()->GetPhysicsEngine();
+#endif
+        _ode_physics = (physics->GetType().compare("ode") == 0);
+
+        _compensation.assign(n_dof_, 0.);
+        _init_effort_limits(urdf_model);
+
+        // Gravity compensation in-process by default, with the iiwa_tools service as fallback
+        _nh.param<bool>("gravity_compensation/use_service", _use_service, false);
+        if (!_use_service && !_init_tools(Eigen::Vector3d(gravity[0], gravity[1], gravity[2]))) {
+            ROS_WARN_STREAM_NAMED("GravityCompensationHWSim", "Could not set up the gravity compensation in-process, falling back to the service.");
+            _use_service = true;
+        }
+
+        if (_use_service) {
+            // A persistent client keeps its connection instead of opening one per call (i.e. per control cycle)
+            _nh.param<std::string>("gravity_compensation/service_name", _gravity_service_name, "/iiwa/iiwa_gravity_server");
+            _nh.param<bool>("gravity_compensation/persistent_service", _persistent_service, true);
+            _iiwa_gravity_client = _nh.serviceClient<iiwa_tools::GetGravity>(_gravity_service_name, _persistent_service);
+
+            // Initialize service message
+            _gravity_srv.request.joint_angles.resize(n_dof_);
+            _gravity_srv.request.joint_velocities.resize(n_dof_);
+            _gravity_srv.request.joint_torques.resize(n_dof_);
+
+            _gravity_srv.request.gravity = {gravity[0], gravity[1], gravity[2]};
+        }
+
+        return true;
+    }
+
+    void GravityCompensationHWSim::_init_effort_limits(const urdf::Model* const urdf_model)
+    {
+        // The limits DefaultRobotHWSim registered for the effort-controlled joints, in one table:
+        // the saturation of ej_sat_interface_ for every joint, tightened by the soft limits of
+        // ej_limits_interface_ for the joints with a safety_controller
+        _effort_limits.resize(n_dof_);
+        for (unsigned int j = 0; j < n_dof_; j++) {
+            _effort_limits.set_effort_limit(j, joint_effort_limits_[j]);
+
+            joint_limits_interface::JointLimits limits;
+            joint_limits_interface::SoftJointLimits soft_limits;
+            bool has_limits = false, has_soft_limits = false;
+            urdf::JointConstSharedPtr urdf_joint = urdf_model ? urdf_model->getJoint(joint_names_[j]) : urdf::JointConstSharedPtr();
+            if (urdf_joint) {
+                has_limits = joint_limits_interface::getJointLimits(urdf_joint, limits);
+                has_soft_limits = joint_limits_interface::getSoftJointLimits(urdf_joint, soft_limits);
+            }
+            if (joint_limits_interface::getJointLimits(joint_names_[j], _nh, limits))
+                has_limits = true;
+            // Saturation only
+            if (!has_limits || !has_soft_limits)
+                continue;
+
+            if (limits.has_velocity_limits)
+                _effort_limits.set_velocity_limit(j, limits.max_velocity);
+            const double inf = std::numeric_limits<double>::infinity();
+            if (limits.has_position_limits)
+                _effort_limits.set_soft_limits(j, soft_limits.min_position, soft_limits.max_position, soft_limits.k_position, soft_limits.k_velocity);
+            else
+                _effort_limits.set_soft_limits(j, -inf, inf, soft_limits.k_position, soft_limits.k_velocity);
+        }
+    }
+
+    bool GravityCompensationHWSim::_init_tools(const Eigen::Vector3d& gravity)
+    {
+        // The same robot description that gazebo_ros_control parsed into the urdf::Model of initSim
+        // (its RBDyn model is shared with the controllers loaded in this process)
+        std::string robot_description, end_effector;
+        _nh.param<std::string>("gravity_compensation/robot_description", robot_description, "robot_description");
+        _nh.param<std::string>("gravity_compensation/end_effector", end_effector, "iiwa_link_ee");
+
+        std::string param_name;
+        std::shared_ptr<const mc_rbdyn_urdf::URDFParserResult> rbdyn_urdf;
+        if (_nh.searchParam(robot_description, param_name))
+            rbdyn_urdf = iiwa_tools::ModelLoader::instance().rbdyn_model(_nh, param_name, 0.);
+        if (!rbdyn_urdf) {
+            ROS_ERROR_STREAM_NAMED("GravityCompensationHWSim", "No URDF found in parameter [" << robot_description << "].");
+            return false;
+        }
+
+        _tools.init_rbdyn(*rbdyn_urdf, end_effector);
+        _tools_context = _tools.create_context();
+
+        // Simulated joints of the model, by name (others, e.g. of a gripper, get no compensation)
+        std::vector<std::string> tools_joints = _tools.get_joint_names();
+        _tools_joint_index.assign(n_dof_, -1);
+        size_t found = 0;
+        for (unsigned int j = 0; j < n_dof_; j++) {
+            auto it = std::find(tools_joints.begin(), tools_joints.end(), joint_names_[j]);
+            if (it != tools_joints.end()) {
+                _tools_joint_index[j] = it - tools_joints.begin();
+                found++;
+            }
+        }
+        if (found != tools_joints.size()) {
+            ROS_ERROR_STREAM_NAMED("GravityCompensationHWSim", "Only " << found << " of the " << tools_joints.size() << " joints of the model are simulated.");
+            return false;
+        }
+
+        _tools_state.position = Eigen::VectorXd::Zero(tools_joints.size());
+        _tools_state.velocity = Eigen::VectorXd::Zero(tools_joints.size());
+        _tools_gravity = gravity;
+
+        // Sizes the results so that the updates do not allocate
+        _tools.compute(*_tools_context, _tools_state, iiwa_tools::COMPUTE_GRAVITY, _tools_model, _tools_gravity);
+
+        ROS_INFO_STREAM_NAMED("GravityCompensationHWSim", "Gravity compensation of " << found << " joints computed in-process.");
 
         return true;
     }
@@ -75,28 +185,41 @@ namespace iiwa_gazebo {
             joint_velocity_[j] = sim_joints_[j]->GetVelocity(0);
             joint_effort_[j] = sim_joints_[j]->GetForce((unsigned int)(0));
 
-            // Pass values to gravity compensation service
-            _gravity_srv.request.joint_angles[j] = joint_position_[j];
-            _gravity_srv.request.joint_velocities[j] = joint_velocity_[j];
-            _gravity_srv.request.joint_torques[j] = joint_effort_[j];
+            if (_use_service) {
+                // Pass values to gravity compensation service
+                _gravity_srv.request.joint_angles[j] = joint_position_[j];
+                _gravity_srv.request.joint_velocities[j] = joint_velocity_[j];
+                _gravity_srv.request.joint_torques[j] = joint_effort_[j];
+            }
+            else if (_tools_joint_index[j] >= 0) {
+                _tools_state.position[_tools_joint_index[j]] = joint_position_[j];
+                _tools_state.velocity[_tools_joint_index[j]] = joint_velocity_[j];
+            }
         }
     }
 
     void GravityCompensationHWSim::writeSim(ros::Time time, ros::Duration period)
     {
-#if GAZEBO_MAJOR_VERSION >= 8
-        gazebo::physics::PhysicsEnginePtr physics = gazebo::physics::get_world()->Physics();
-#else
-        gazebo::physics::PhysicsEnginePtr physics = gazebo::physics::get_world()->GetPhysicsEngine();
-#endif
         // Get gravity and Coriolis forces
-        std::vector<double> C(n_dof_, 0.);
+        std::vector<double>& C = _compensation;
+        if (!_use_service) {
+            _tools.compute(*_tools_context, _tools_state, iiwa_tools::COMPUTE_GRAVITY, _tools_model, _tools_gravity);
+            for (size_t i = 0; i < n_dof_; i++) {
+                C[i] = (_tools_joint_index[i] >= 0) ? _tools_model.gravity[_tools_joint_index[i]] : 0.;
+            }
+        }
         // Call iiwa tools service for gravity compensation
-        if (_iiwa_gravity_client.call(_gravity_srv)) {
+        else if (_iiwa_gravity_client.call(_gravity_srv)) {
             for (size_t i = 0; i < n_dof_; i++) {
                 C[i] = _gravity_srv.response.compensation_torques[i];
             }
         }
+        else {
+            std::fill(C.begin(), C.end(), 0.);
+            // The connection of a persistent client is not re-established on its own (e.g. when the service restarts)
+            if (_persistent_service && !_iiwa_gravity_client.isValid())
+                _iiwa_gravity_client = _nh.serviceClient<iiwa_tools::GetGravity>(_gravity_service_name, true);
+        }
 
         // If the E-stop is active, joints controlled by position commands will maintain their positions.
         if (e_stop_active_) {
@@ -110,8 +233,8 @@ namespace iiwa_gazebo {
             last_e_stop_active_ = false;
         }
 
-        ej_sat_interface_.enforceLimits(period);
-        ej_limits_interface_.enforceLimits(period);
+        // Like ej_sat_interface_ and ej_limits_interface_: the limits apply to the commands alone, not to the compensation
+        _effort_limits.enforce_effort(joint_position_.data(), joint_velocity_.data(), joint_effort_command_.data());
         pj_sat_interface_.enforceLimits(period);
         pj_limits_interface_.enforceLimits(period);
         vj_sat_interface_.enforceLimits(period);
@@ -163,7 +286,7 @@ namespace iiwa_gazebo {
 
             case VELOCITY:
 #if GAZEBO_MAJOR_VERSION > 2
-                if (physics->GetType().compare("ode") == 0) {
+                if (_ode_physics) {
                     sim_joints_[j]->SetParam("vel", 0, e_stop_active_ ? 0 : joint_velocity_command_[j]);
                 }
                 else {
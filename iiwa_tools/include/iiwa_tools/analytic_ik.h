@@ -0,0 +1,70 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#ifndef IIWA_TOOLS_ANALYTIC_IK_H
+#define IIWA_TOOLS_ANALYTIC_IK_H
+
+// std headers
+#include <array>
+
+#include <iiwa_tools/serial_chain.h>
+
+namespace iiwa_tools {
+    // Closed-form inverse kinematics of 7-DoF spherical-revolute-spherical arms (like the iiwa):
+    // the axes of joints 1-3 intersect at the shoulder, the ones of joints 5-7 at the wrist.
+    // The redundancy is parametrized by the arm angle, i.e. the rotation of the elbow about the shoulder-wrist line,
+    // measured from the reference plane of the solution with q3 = 0.
+    class AnalyticIk {
+    public:
+        using Vector7d = SerialChain<7>::Vector;
+        static constexpr int MAX_SOLUTIONS = 8; // elbow up/down x 2 shoulder x 2 wrist configurations
+        using Solutions = std::array<Vector7d, MAX_SOLUTIONS>;
+
+        // Checks the geometry of the chain (valid() is false if it is not a spherical-revolute-spherical arm)
+        AnalyticIk(const SerialChain<7>& chain, double tolerance = 1e-6);
+
+        bool valid() const { return _valid; }
+
+        // All the solutions (in [-pi, pi], not checked against any limit) for the pose of the end-effector
+        // in the world frame and the given arm angle; returns their number (0 if the pose is out of reach)
+        int solve(const Eigen::Matrix3d& rotation, const Eigen::Vector3d& position, double arm_angle, Solutions& solutions) const;
+
+        // Arm angle of a configuration
+        double arm_angle(const Vector7d& q) const;
+
+    protected:
+        // Reference shoulder rotation (q3 = 0) that brings the wrist of the elbow configuration q4 to the wrist_target (relative to the shoulder)
+        bool _reference(double q4, const Eigen::Vector3d& wrist_target, Eigen::Matrix3d& reference) const;
+        Eigen::Vector3d _wrist(double q4) const; // relative to the shoulder, with q1 = q2 = q3 = 0
+
+        bool _valid;
+        // Joint axes and the shoulder, elbow and wrist points at the zero configuration (world frame)
+        Eigen::Vector3d _axes[7];
+        Eigen::Vector3d _shoulder, _elbow, _wrist_point;
+        Eigen::Matrix3d _ee_rotation; // of the end-effector at the zero configuration
+        Eigen::Vector3d _ee_position;
+    };
+} // namespace iiwa_tools
+
+#endif
@@ -0,0 +1,150 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#ifndef IIWA_TOOLS_COLLISION_MODEL_H
+#define IIWA_TOOLS_COLLISION_MODEL_H
+
+// std headers
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// ROS headers
+#include <ros/ros.h>
+
+#include <iiwa_tools/param_tree.h>
+
+// RBDyn headers
+#include <RBDyn/MultiBody.h>
+#include <SpaceVecAlg/SpaceVecAlg>
+
+namespace iiwa_tools {
+    // The points within radius of the segment [a, b] (a sphere if a = b)
+    struct Capsule {
+        Eigen::Vector3d a, b;
+        double radius;
+    };
+
+    // Region of the world frame the links must stay out of
+    struct KeepOutZone {
+        enum Type {
+            SPHERE,
+            CAPSULE,
+            PLANE
+        };
+
+        std::string name;
+        Type type;
+        Capsule capsule; // SPHERE (a = b) and CAPSULE
+        Eigen::Vector3d normal; // PLANE: the zone is {x : normal . x < offset}, normal is unit
+        double offset;
+    };
+
+    struct CollisionSettings {
+        CollisionSettings() : mesh_suffix("_s"), padding(0.), self_collision(true) {}
+
+        std::string mesh_suffix; // the simplified mesh <name><suffix>.stl next to each URDF collision mesh is used if it exists
+        double padding; // added to the radius of every link capsule
+        bool self_collision; // check the links against each other (not only against the zones)
+        std::vector<std::pair<std::string, std::string>> allowed_pairs; // links never checked against each other
+        std::vector<KeepOutZone> zones;
+    };
+
+    // Distance of a link capsule to another link capsule or to a zone
+    struct Proximity {
+        int capsule, other; // other: index of a capsule, or -1 - index of a zone
+        double distance; // between the surfaces, negative when they intersect
+        Eigen::Vector3d point, other_point; // closest points on the capsule axis and on the other axis (or the zone)
+        Eigen::Vector3d normal; // unit, from other_point to point: moving the capsule along it increases the distance
+    };
+
+    // Self-collision and keep-out zone distances of a robot, each link approximated by capsules fitted once at init
+    // (to its URDF collision meshes or primitives). At run time, only the capsules are moved to the body poses
+    // of the forward kinematics (rbd::MultiBodyConfig::bodyPosW) and their segment distances computed.
+    class CollisionModel {
+    public:
+        // Results of compute(), one per thread (like IiwaTools::Context)
+        struct Workspace {
+            std::vector<Capsule> capsules; // in the world frame
+            std::vector<Proximity> pairs; // one per checked pair
+            int closest; // index in pairs of the smallest distance (-1: nothing checked)
+        };
+
+        CollisionModel() : _initialized(false) {}
+
+        // joint_indices: the joints of the mb in the order of the joint vectors (IiwaTools::get_indices())
+        bool init(const rbd::MultiBody& mb, const std::vector<size_t>& joint_indices, const std::string& urdf_string, const CollisionSettings& settings);
+        bool initialized() const { return _initialized; }
+
+        std::unique_ptr<Workspace> create_workspace() const;
+
+        size_t num_capsules() const { return _capsules.size(); }
+        size_t num_pairs() const { return _pairs.size(); }
+        const Capsule& capsule(size_t i) const { return _capsules[i].capsule; } // in the body frame
+        std::string name(const Proximity& proximity) const; // "link:link" or "link:zone"
+
+        // Distances of all the checked pairs for the given body poses; returns the smallest one (infinity if none)
+        double compute(const std::vector<sva::PTransformd>& body_poses, Workspace& ws) const;
+
+        // Gradient of the distance of a pair of compute() with respect to the joint positions
+        void gradient(const std::vector<sva::PTransformd>& body_poses, const Proximity& proximity, Eigen::Ref<Eigen::VectorXd> gradient) const;
+
+    protected:
+        struct LinkCapsule {
+            int body;
+            std::string link;
+            Capsule capsule; // in the body frame
+            std::vector<std::pair<int, int>> joints; // (body whose joint moves the capsule, its column in the joint vectors)
+        };
+
+        void _add_capsule(const rbd::MultiBody& mb, const std::vector<size_t>& joint_indices, int body, const Capsule& capsule);
+        void _distance(const Workspace& ws, int capsule, int other, Proximity& proximity) const;
+        void _add_gradient(const std::vector<sva::PTransformd>& body_poses, const LinkCapsule& link, const Eigen::Vector3d& point, double sign, const Eigen::Vector3d& normal, Eigen::Ref<Eigen::VectorXd> gradient) const;
+
+        bool _initialized;
+        CollisionSettings _settings;
+        std::vector<LinkCapsule> _capsules;
+        std::vector<std::pair<int, int>> _pairs; // checked (capsule, other)
+        std::vector<Eigen::Vector3d> _axes; // of the joints (by body), in the body frame
+        std::vector<bool> _prismatic;
+    };
+
+    // Capsule around a point cloud: along its principal axis, with the smallest radius and then the shortest segment
+    Capsule fit_capsule(const std::vector<Eigen::Vector3d>& points);
+
+    // Vertices of the triangles of a binary or ASCII STL file
+    bool load_stl(const std::string& file_name, std::vector<Eigen::Vector3d>& vertices);
+
+    // Closest points of the segments [a0, a1] and [b0, b1], returns their distance
+    double segment_distance(const Eigen::Vector3d& a0, const Eigen::Vector3d& a1, const Eigen::Vector3d& b0, const Eigen::Vector3d& b1, Eigen::Vector3d& pa, Eigen::Vector3d& pb);
+
+    // Settings from parameters under ns: mesh_suffix, padding, self_collision, allowed_pairs ([[link, link], ...])
+    // and zones ([{name, type: sphere|capsule|plane, center|a, b|normal, offset, radius}, ...])
+    bool load_collision_settings(const ros::NodeHandle& nh, const std::string& ns, CollisionSettings& settings);
+    // Same, from parameters already fetched (the collision namespace)
+    bool load_collision_settings(const ParamTree& params, CollisionSettings& settings);
+} // namespace iiwa_tools
+
+#endif
@@ -66,6 +66,46 @@ def function_names():
     return ['ldl_solve', 'ldl_factor', 'check_factorization', 'matrix_multiply', 'check_residual', 'fill_KKT', 'multbymA', 'multbymAT', 'multbymG', 'multbymGT', 'multbyP', 'fillq', 'fillh', 'fillb', 'pre_ops', 'eval_gap', 'set_defaults', 'setup_pointers', 'setup_indexed_params', 'setup_indexing', 'set_start', 'eval_objv', 'fillrhs_aff', 'fillrhs_cc', 'refine', 'calc_ineq_resid_squared', 'calc_eq_resid_squared', 'better_start', 'fillrhs_start', 'solve', 'printmatrix', 'unif', 'ran1', 'randn_internal', 'randn', 'reset_rand']
     # return ['ldl_solve', 'ldl_factor', 'check_factorization', 'matrix_multiply', 'check_residual', 'fill_KKT', 'multbymA', 'multbymAT', 'multbymG', 'multbymGT', 'multbyP', 'fillq', 'fillh', 'fillb', 'pre_ops', 'eval_gap', 'set_defaults', 'setup_pointers', 'setup_indexed_params', 'setup_indexing', 'set_start', 'eval_objv', 'fillrhs_aff', 'fillrhs_cc', 'refine', 'calc_ineq_resid_squared', 'calc_eq_resid_squared', 'better_start', 'fillrhs_start', 'solve', 'tic', 'toc', 'tocq', 'printmatrix', 'unif', 'ran1', 'randn_internal', 'randn', 'reset_rand']
 
+def add_warm_start(structs, functions):
+    # Settings.warm_start: start from the previous solution (x, y) instead of better_start()/set_start()
+    settings = structs[struct_names().index('Settings')]
+    settings.append('  /* Start from the previous solution instead (see warm_start()). */\n')
+    settings.append('  int warm_start;\n')
+
+    warm_start = ['void warm_start(void) {\n',
+        '  /* Keeps x and y of the previous solve (for a similar problem). s is recomputed and, */\n',
+        '  /* like z, kept at least at s_init (z_init) so that the iterations start in the interior. */\n',
+        '  int i;\n',
+        '  multbymG(work.buffer, work.x);\n',
+        '  for (i = 0; i < 14; i++) {\n',
+        '    work.s[i] = work.h[i] + work.buffer[i];\n',
+        '    if (work.s[i] < settings.s_init)\n',
+        '      work.s[i] = settings.s_init;\n',
+        '    if (work.z[i] < settings.z_init)\n',
+        '      work.z[i] = settings.z_init;\n',
+        '  }\n',
+        '}\n']
+
+    result = []
+    for f in functions:
+        name = f[0].strip().split('(')[0].split(' ')[-1]
+        if name == 'set_defaults':
+            f = f[:-1] + ['  settings.warm_start = 0;\n'] + f[-1:]
+        if name == 'fillrhs_start':
+            result.append(warm_start)
+        if name == 'solve':
+            solve = []
+            for l in f:
+                if l.strip() == 'if (settings.better_start)':
+                    solve.append('  if (settings.warm_start)\n')
+                    solve.append('    warm_start();\n')
+                    solve.append('  else if (settings.better_start)\n')
+                else:
+                    solve.append(l)
+            f = solve
+        result.append(f)
+    return result
+
 def get_function(data, fname):
     func_name = fname + "("
     ret_data = []
@@ -134,6 +174,8 @@ if __name__== "__main__":
                 functions.append(d)
                 break
 
+    functions = add_warm_start(structs, functions)
+
     tab = "    "
     out_file = "#include <math.h>\n";
     out_file += "#include <stdio.h>\n";
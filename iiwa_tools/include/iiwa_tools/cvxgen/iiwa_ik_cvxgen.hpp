@@ -108,6 +108,8 @@ namespace iiwa_ik_cvxgen {
         int debug;
         /* For regularization. Minimum value of abs(D_ii) in the kkt D factor. */
         double kkt_reg;
+        /* Start from the previous solution instead (see warm_start()). */
+        int warm_start;
     };
 
     class Solver {
@@ -1382,6 +1384,7 @@ namespace iiwa_ik_cvxgen {
             settings.verbose_refinement = 0;
             settings.better_start = 1;
             settings.kkt_reg = 1e-7;
+            settings.warm_start = 0;
         }
 
         void setup_pointers(void)
@@ -1660,6 +1663,21 @@ namespace iiwa_ik_cvxgen {
             }
         }
 
+        void warm_start(void)
+        {
+            /* Keeps x and y of the previous solve (for a similar problem). s is recomputed and, */
+            /* like z, kept at least at s_init (z_init) so that the iterations start in the interior. */
+            int i;
+            multbymG(work.buffer, work.x);
+            for (i = 0; i < 14; i++) {
+                work.s[i] = work.h[i] + work.buffer[i];
+                if (work.s[i] < settings.s_init)
+                    work.s[i] = settings.s_init;
+                if (work.z[i] < settings.z_init)
+                    work.z[i] = settings.z_init;
+            }
+        }
+
         void fillrhs_start(void)
         {
             /* Fill rhs with (-q, 0, h, b). */
@@ -1696,7 +1714,9 @@ namespace iiwa_ik_cvxgen {
             fillq();
             fillh();
             fillb();
-            if (settings.better_start)
+            if (settings.warm_start)
+                warm_start();
+            else if (settings.better_start)
                 better_start();
             else
                 set_start();
@@ -26,6 +26,7 @@
 #define IIWA_TOOLS_IIWA_SERVICE_H
 
 // std headers
+#include <memory>
 #include <vector>
 
 // ROS headers
@@ -33,21 +34,28 @@
 #include <sensor_msgs/JointState.h>
 
 // IIWA Tools
+#include <iiwa_tools/collision_model.h>
 #include <iiwa_tools/iiwa_tools.h>
+#include <iiwa_tools/ik_cache.h>
+#include <iiwa_tools/thread_pool.h>
 
 // Iiwa IK server headers
+#include <iiwa_tools/GetCollisionsBatch.h>
 #include <iiwa_tools/GetFK.h>
 #include <iiwa_tools/GetGravity.h>
+#include <iiwa_tools/GetGravityBatch.h>
 #include <iiwa_tools/GetIK.h>
 #include <iiwa_tools/GetJacobian.h>
 #include <iiwa_tools/GetJacobians.h>
+#include <iiwa_tools/GetJacobiansBatch.h>
+#include <iiwa_tools/RobotModelState.h>
 
 namespace iiwa_tools {
     class IiwaService {
     public:
         IiwaService(ros::NodeHandle nh);
 
-        void init();
+        bool init();
 
         bool perform_fk(iiwa_tools::GetFK::Request& request,
             iiwa_tools::GetFK::Response& response);
@@ -67,13 +75,29 @@ namespace iiwa_tools {
         bool get_gravity(iiwa_tools::GetGravity::Request& request,
             iiwa_tools::GetGravity::Response& response);
 
+        // N configurations per request, solved in parallel
+        bool get_jacobians_batch(iiwa_tools::GetJacobiansBatch::Request& request,
+            iiwa_tools::GetJacobiansBatch::Response& response);
+
+        bool get_gravity_batch(iiwa_tools::GetGravityBatch::Request& request,
+            iiwa_tools::GetGravityBatch::Response& response);
+
+        // Self-collision and keep-out zone distances (for planners)
+        bool get_collisions_batch(iiwa_tools::GetCollisionsBatch::Request& request,
+            iiwa_tools::GetCollisionsBatch::Response& response);
+
     protected:
         void _load_params();
+        void _joint_state_cb(const sensor_msgs::JointState::ConstPtr& msg);
+        bool _update_joint_map(const sensor_msgs::JointState& msg);
+        int _batch_size(const std_msgs::Float64MultiArray& array, const std::string& name, bool optional);
+        void _report_ik_cache();
+        RobotState& _batch_state(size_t worker, const std_msgs::Float64MultiArray& positions, const std_msgs::Float64MultiArray& velocities, size_t i);
 
         // ROS related
         ros::NodeHandle _nh;
-        std::string _robot_description, _fk_service_name, _ik_service_name, _jacobian_service_name, _jacobian_deriv_service_name, _jacobians_service_name, _gravity_service_name;
-        ros::ServiceServer _fk_server, _ik_server, _jacobian_server, _jacobian_deriv_server, _jacobians_server, _gravity_server;
+        std::string _robot_description, _fk_service_name, _ik_service_name, _jacobian_service_name, _jacobian_deriv_service_name, _jacobians_service_name, _gravity_service_name, _jacobians_batch_service_name, _gravity_batch_service_name, _collisions_batch_service_name;
+        ros::ServiceServer _fk_server, _ik_server, _jacobian_server, _jacobian_deriv_server, _jacobians_server, _gravity_server, _jacobians_batch_server, _gravity_batch_server, _collisions_batch_server;
 
         // Robot
         unsigned int _n_joints;
@@ -81,6 +105,48 @@ namespace iiwa_tools {
 
         // IIWA Tools
         IiwaTools _tools;
+
+        // Parallel requests
+        int _num_threads; // 0: one per core
+        bool _warm_start; // warm-start the IK QPs of a worker from its previous solution
+        bool _analytic_model; // fixed-size kinematics/dynamics for 7-DoF chains instead of RBDyn
+        bool _analytic_ik; // closed-form IK first, the QP only when it finds no solution within the limits
+        std::unique_ptr<ThreadPool> _pool;
+        // One per worker of the pool
+        std::vector<std::unique_ptr<IiwaTools::Context>> _contexts;
+        std::vector<RobotState> _robot_states;
+        std::vector<ModelState> _model_states;
+
+        // Cache of the IK solutions (and index of their poses for the seed of new ones)
+        bool _ik_cache_enabled;
+        IkCacheSettings _ik_cache_settings;
+        double _ik_cache_seed_tolerance; // pose error of a cached solution under which it is refined without the RBDyn pre-solve
+        double _ik_cache_statistics_period; // in seconds between the reports of the hit/miss statistics, 0: none
+        ros::WallTime _ik_cache_report_time;
+        std::unique_ptr<IkCache> _ik_cache;
+
+        // Collision distances (capsules of the links, see CollisionModel)
+        bool _collision;
+        CollisionSettings _collision_settings;
+        double _collision_margin; // distances below are reported as collisions
+        CollisionModel _collision_model;
+        std::vector<std::unique_ptr<CollisionModel::Workspace>> _collision_workspaces; // one per worker
+
+        // Sequential (path) IK requests
+        double _sequential_seed_tolerance, _sequential_continuity; // see IkParams
+
+        // Streaming mode: FK, Jacobian and gravity published for every joint state received
+        bool _stream, _stream_tcp_no_delay;
+        std::string _stream_input_topic, _stream_output_topic;
+        Eigen::Vector3d _stream_gravity;
+        ros::Subscriber _joint_state_sub;
+        ros::Publisher _model_state_pub;
+        std::vector<std::string> _joint_names;
+        std::vector<size_t> _joint_map; // index of each joint in the joint state messages
+        std::unique_ptr<IiwaTools::Context> _stream_context;
+        RobotState _stream_robot_state;
+        ModelState _stream_model_state;
+        iiwa_tools::RobotModelState _model_state_msg;
     }; // class IiwaService
 } // namespace iiwa_tools
 
@@ -26,13 +26,25 @@
 #define IIWA_TOOLS_IIWA_TOOLS_H
 
 // std headers
+#include <limits>
+#include <memory>
+#include <mutex>
 #include <utility>
 #include <vector>
 
 // RBDyn headers
+#include <RBDyn/FD.h>
 #include <RBDyn/IK.h>
+#include <RBDyn/Jacobian.h>
 #include <mc_rbdyn_urdf/urdf.h>
 
+#include <iiwa_tools/analytic_ik.h>
+#include <iiwa_tools/serial_chain.h>
+
+namespace iiwa_ik_cvxgen {
+    class Solver;
+}
+
 namespace iiwa_tools {
     struct RobotState {
         Eigen::VectorXd position,
@@ -45,15 +57,105 @@ namespace iiwa_tools {
         Eigen::Quaterniond orientation;
     };
 
+    // Parameters of the IK solver (non-positive values and vectors of the wrong size fall back to the defaults)
+    struct IkParams {
+        IkParams() : tolerance(1e-5), max_iterations(50), warm_start(true), seed_tolerance(0.), continuity(0.), analytic(false), arm_angle(std::numeric_limits<double>::quiet_NaN()) {}
+
+        double tolerance; // on the norm of the 6D pose error
+        int max_iterations;
+        Eigen::VectorXd slack; // 6, default 1e4
+        Eigen::VectorXd damping; // one per joint, default 1e-3
+        bool warm_start; // start each QP from the previous solution of the context
+        // With a seed only
+        double seed_tolerance; // pose error under which the seed is refined without the RBDyn pre-solve, 0: never
+        double continuity; // weight of the distance to the seed (added to the damping), 0: none
+        // Closed-form solution first (iiwa-like arms only, see AnalyticIk), the QP is the fallback if it violates the limits
+        bool analytic;
+        double arm_angle; // NaN: the one of the seed (or of the zero configuration), then the closest one within the limits
+    };
+
+    struct IkResult {
+        Eigen::VectorXd joints; // best solution found
+        double error; // pose error of the solution
+        int iterations;
+        bool is_valid; // the error is below the tolerance
+    };
+
+    // What IiwaTools::compute evaluates (bitwise or)
+    enum ComputeFlags : unsigned int {
+        COMPUTE_FK = 1 << 0,
+        COMPUTE_JACOBIAN = 1 << 1,
+        COMPUTE_JACOBIAN_DERIV = 1 << 2,
+        COMPUTE_GRAVITY = 1 << 3, // gravity and Coriolis torques
+        COMPUTE_MASS_MATRIX = 1 << 4
+    };
+
+    // Owned by the caller; only the fields that were asked for are written
+    struct ModelState {
+        EefState ee_state;
+        Eigen::MatrixXd jacobian, jacobian_deriv, mass_matrix;
+        Eigen::VectorXd gravity;
+    };
+
     class IiwaTools {
     public:
+        // Mutable workspace of one thread: the robot configuration and the scratch of the solvers.
+        // All contexts share the (immutable) model of the IiwaTools that created them.
+        // A context must not be used by two threads at the same time.
+        struct Context {
+            Context(const rbd::MultiBody& mb, size_t ef_index);
+            ~Context();
+
+            rbd::MultiBodyConfig mbc;
+            rbd::Jacobian jac;
+            rbd::ForwardDynamics fd;
+            rbd::InverseKinematics ik;
+            std::unique_ptr<iiwa_ik_cvxgen::Solver> ik_solver; // set up once, keeps its last solution
+            bool ik_solved; // ik_solver holds a solution to warm-start from
+            std::unique_ptr<SerialChain<7>::Workspace> chain; // with the analytic model only
+
+            // Results (valid until the next call with this context)
+            EefState ee_state;
+            Eigen::VectorXd gravity;
+            Eigen::MatrixXd jacobian, jacobian_deriv; // of the analytic model (RBDyn's are in jac)
+        };
+
         IiwaTools() {}
         ~IiwaTools() {}
 
-        void init_rbdyn(const std::string& urdf_string, const std::string& end_effector);
+        // analytic: use the fixed-size SerialChain instead of RBDyn if the URDF is a chain of 7 revolute joints to the end-effector
+        void init_rbdyn(const std::string& urdf_string, const std::string& end_effector, bool analytic = false);
+        // Same, from an already converted URDF (e.g. the one shared by ModelLoader)
+        void init_rbdyn(const mc_rbdyn_urdf::URDFParserResult& rbdyn_urdf, const std::string& end_effector, bool analytic = false);
+        bool has_analytic_model() const { return _chain != nullptr; }
+        bool has_analytic_ik() const { return _analytic_ik != nullptr; }
 
         std::vector<size_t> get_indices() { return _rbd_indices; }
+        std::vector<std::string> get_joint_names() const; // in the order of the joint vectors
+        const Eigen::VectorXd& get_lower_limits() const { return _q_low; }
+        const Eigen::VectorXd& get_upper_limits() const { return _q_high; }
+        const rbd::MultiBody& get_multibody() const { return _rbdyn_urdf.mb; }
+
+        // Creates a workspace for the calling thread (call after init_rbdyn)
+        std::unique_ptr<Context> create_context() const;
 
+        // Thread-safe as long as every thread uses its own context; no model copy and no allocation per call
+        const EefState& perform_fk(Context& context, const RobotState& robot_state) const;
+        // Poses of all the bodies (rbd::MultiBodyConfig::bodyPosW, always from RBDyn), e.g. for a CollisionModel
+        const std::vector<sva::PTransformd>& body_poses(Context& context, const RobotState& robot_state) const;
+        Eigen::VectorXd perform_ik(Context& context, const EefState& ee_state, const RobotState& seed_state = RobotState()) const;
+        IkResult perform_ik(Context& context, const EefState& ee_state, const RobotState& seed_state, const IkParams& params) const;
+        const Eigen::MatrixXd& jacobian(Context& context, const RobotState& robot_state) const;
+        const Eigen::MatrixXd& jacobian_deriv(Context& context, const RobotState& robot_state) const;
+        std::pair<const Eigen::MatrixXd&, const Eigen::MatrixXd&> jacobians(Context& context, const RobotState& robot_state) const;
+        const Eigen::VectorXd& gravity(Context& context, const std::vector<double>& gravity, const RobotState& robot_state) const;
+
+        // All the requested quantities from a single forward kinematics/velocity pass.
+        // The result matrices are resized on first use only, so a reused result does not allocate.
+        void compute(Context& context, const RobotState& robot_state, unsigned int flags, ModelState& result,
+            const Eigen::Vector3d& gravity = Eigen::Vector3d(0., 0., -9.81)) const;
+
+        // Same as above on an internal context (serialized by a mutex)
         EefState perform_fk(const RobotState& robot_state);
         Eigen::VectorXd perform_ik(const EefState& ee_state, const RobotState& seed_state = RobotState());
         Eigen::MatrixXd jacobian(const RobotState& robot_state);
@@ -63,15 +165,32 @@ namespace iiwa_tools {
 
     protected:
         size_t _rbd_index(const std::string& body_name) const;
-        void _update_urdf_state(mc_rbdyn_urdf::URDFParserResult& rbdyn_urdf, const RobotState& robot_state);
+        void _update_urdf_state(rbd::MultiBodyConfig& mbc, const RobotState& robot_state) const;
+        double _joint_in_limits(size_t i, double q) const; // wrapped in [-pi,pi] and within the joint limits
+        void _reset_config(rbd::MultiBodyConfig& mbc) const;
+        void _get_ee_state(const rbd::MultiBodyConfig& mbc, EefState& ee_state) const;
+        Eigen::Vector6d _pose_error(const rbd::MultiBodyConfig& mbc, const sva::PTransformd& target_tf) const; // (rotation, translation)
+
+        // Analytic model
+        bool _init_analytic();
+        void _update_chain_state(SerialChain<7>::Workspace& ws, const RobotState& robot_state) const;
+        bool _analytic_solution(Context& context, const EefState& ee_state, const RobotState& seed_state, const IkParams& params, IkResult& result) const;
 
-        // RBDyn related
+        // RBDyn related (never modified after init_rbdyn)
         mc_rbdyn_urdf::URDFParserResult _rbdyn_urdf;
-        std::unique_ptr<rbd::InverseKinematics> _ik;
+
+        // Context of the methods without one
+        std::unique_ptr<Context> _context;
+        std::mutex _context_mutex;
 
         // Helper variables
         std::vector<size_t> _rbd_indices;
         size_t _ef_index;
+        Eigen::VectorXd _q_low, _q_high;
+
+        // Fixed-size model of the same robot (when the URDF allows it, never modified after init_rbdyn)
+        std::unique_ptr<SerialChain<7>> _chain;
+        std::unique_ptr<AnalyticIk> _analytic_ik;
 
     }; // class IiwaTools
 } // namespace iiwa_tools
@@ -0,0 +1,142 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#ifndef IIWA_TOOLS_IK_CACHE_H
+#define IIWA_TOOLS_IK_CACHE_H
+
+// std headers
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Eigen headers
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+namespace iiwa_tools {
+    struct IkCacheSettings {
+        IkCacheSettings() : memory_limit(16 << 20), position_resolution(1e-3), orientation_resolution(1e-3), orientation_weight(0.5), max_seed_distance(0.1) {}
+
+        size_t memory_limit; // in bytes, sets the number of entries
+        double position_resolution; // in m, poses closer than that share an entry
+        double orientation_resolution; // on the quaternion components
+        double orientation_weight; // in m per unit of quaternion distance, in the metric of the seed index
+        double max_seed_distance; // of a seed taken from the index (weighted metric), 0: no seed index
+    };
+
+    struct IkCacheStatistics {
+        size_t hits = 0, misses = 0; // of the exact lookups
+        size_t seeds = 0; // misses seeded from the index
+        size_t insertions = 0, evictions = 0;
+        size_t size = 0, capacity = 0;
+    };
+
+    // Bounded LRU cache of IK solutions keyed by the (quantized) pose and the configuration branch of the seed,
+    // plus a k-d tree over position and orientation of the cached solutions to find warm seeds for new poses.
+    // The storage is sized once at construction from the memory limit; the methods are thread-safe.
+    class IkCache {
+    public:
+        static constexpr int NO_SEED = -1; // branch of the requests without seed
+
+        IkCache(size_t num_joints, const IkCacheSettings& settings);
+
+        // Memory of one entry, to size the cache
+        static size_t entry_size(size_t num_joints);
+
+        // Configuration branch: the signs of the joints that flip the shoulder, elbow and wrist (every other joint)
+        static int branch(const Eigen::VectorXd& seed);
+
+        // Copies the solution of the entry into joints and marks the entry as recently used
+        bool find(const Eigen::Vector3d& position, const Eigen::Quaterniond& orientation, int branch, Eigen::VectorXd& joints);
+        // Solution of the cached pose closest to the given one (within max_seed_distance), for any branch
+        bool nearest(const Eigen::Vector3d& position, const Eigen::Quaterniond& orientation, Eigen::VectorXd& joints);
+        // Adds or refreshes an entry, evicts the least recently used one when full
+        void insert(const Eigen::Vector3d& position, const Eigen::Quaterniond& orientation, int branch, const Eigen::VectorXd& joints);
+
+        void clear();
+        IkCacheStatistics statistics() const;
+
+    protected:
+        static constexpr int DIM = 7; // position and weighted quaternion (w >= 0)
+        static constexpr uint32_t NONE = 0xffffffff;
+        using Point = std::array<double, DIM>;
+
+        struct Key {
+            int32_t cell[DIM];
+            int32_t branch;
+            bool operator==(const Key& other) const;
+        };
+
+        struct KeyHash {
+            size_t operator()(const Key& key) const;
+        };
+
+        struct Slot {
+            Key key;
+            uint32_t prev, next; // LRU list (most recent first)
+            uint32_t generation; // incremented on eviction, invalidates the references of the index
+        };
+
+        // Point of the index, with the slot it was taken from (slots are reused after an eviction)
+        struct Item {
+            Point point;
+            uint32_t slot, generation;
+        };
+
+        Key _key(const Eigen::Vector3d& position, const Eigen::Quaterniond& orientation, int branch) const;
+        Point _point(const Eigen::Vector3d& position, const Eigen::Quaterniond& orientation) const; // canonical quaternion
+
+        void _unlink(uint32_t slot);
+        void _push_front(uint32_t slot);
+        uint32_t _evict();
+
+        bool _stale(const Item& item) const { return _slots[item.slot].generation != item.generation; }
+        void _rebuild();
+        void _build(size_t begin, size_t end);
+        void _search(size_t begin, size_t end, const Point& point, uint32_t& best, double& best_distance) const;
+        static double _distance(const Point& a, const Point& b);
+
+        size_t _num_joints, _capacity;
+        IkCacheSettings _settings;
+
+        std::vector<Slot> _slots;
+        std::vector<double> _joints; // _num_joints per slot
+        std::vector<uint32_t> _free;
+        uint32_t _head, _tail;
+        std::unordered_map<Key, uint32_t, KeyHash> _map;
+
+        // Seed index: a k-d tree (implicit, the median of every range is its node) and the items added since its last build
+        std::vector<Item> _tree, _pending;
+        std::vector<int> _split; // axis of every node of _tree
+        size_t _stale_items; // evicted entries still referenced by the tree
+
+        IkCacheStatistics _statistics;
+        mutable std::mutex _mutex;
+    };
+} // namespace iiwa_tools
+
+#endif
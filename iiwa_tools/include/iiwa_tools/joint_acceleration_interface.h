@@ -0,0 +1,65 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#ifndef IIWA_TOOLS_JOINT_ACCELERATION_INTERFACE_H
+#define IIWA_TOOLS_JOINT_ACCELERATION_INTERFACE_H
+
+// ros control
+#include <hardware_interface/hardware_interface.h>
+#include <hardware_interface/internal/hardware_resource_manager.h>
+
+// std headers
+#include <cassert>
+#include <string>
+
+namespace iiwa_tools {
+    // Read-only handle to the estimated acceleration of a joint
+    class JointAccelerationHandle {
+    public:
+        JointAccelerationHandle() : _acceleration(nullptr) {}
+        JointAccelerationHandle(const std::string& name, const double* acceleration) : _name(name), _acceleration(acceleration)
+        {
+            if (!acceleration)
+                throw hardware_interface::HardwareInterfaceException("Cannot create handle '" + name + "'. Acceleration data pointer is null.");
+        }
+
+        std::string getName() const { return _name; }
+        double getAcceleration() const
+        {
+            assert(_acceleration);
+            return *_acceleration;
+        }
+
+    protected:
+        std::string _name;
+        const double* _acceleration;
+    };
+
+    // Exposed by hardware that estimates joint accelerations (e.g., the iiwa driver); the resources are not claimed,
+    // so any controller can read them next to its own command interface.
+    class JointAccelerationInterface : public hardware_interface::HardwareResourceManager<JointAccelerationHandle> {
+    };
+} // namespace iiwa_tools
+
+#endif
@@ -0,0 +1,142 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#ifndef IIWA_TOOLS_JOINT_LIMIT_TABLE_H
+#define IIWA_TOOLS_JOINT_LIMIT_TABLE_H
+
+// Eigen headers
+#include <Eigen/Core>
+
+// std headers
+#include <limits>
+
+namespace iiwa_tools {
+    // Joint limits of a set of joints in contiguous arrays, read once at init (e.g. from the URDF) instead of every cycle.
+    // The clamps are the ones of joint_limits_interface (saturation, or soft limits when given) as single passes
+    // over all the joints; they do not allocate.
+    class JointLimitTable {
+    public:
+        JointLimitTable() : _previous_valid(false) {}
+        explicit JointLimitTable(size_t n) { resize(n); }
+
+        // All the joints unlimited
+        void resize(size_t n)
+        {
+            const double inf = std::numeric_limits<double>::infinity();
+            _min_position = Eigen::ArrayXd::Constant(n, -inf);
+            _max_position = Eigen::ArrayXd::Constant(n, inf);
+            _max_velocity = Eigen::ArrayXd::Constant(n, inf);
+            _max_effort = Eigen::ArrayXd::Constant(n, inf);
+            _has_velocity = Eigen::Array<bool, Eigen::Dynamic, 1>::Constant(n, false);
+            _soft = Eigen::Array<bool, Eigen::Dynamic, 1>::Constant(n, false);
+            _soft_min_position = Eigen::ArrayXd::Constant(n, -inf);
+            _soft_max_position = Eigen::ArrayXd::Constant(n, inf);
+            _k_position = Eigen::ArrayXd::Zero(n);
+            _k_velocity = Eigen::ArrayXd::Zero(n);
+            _previous = Eigen::ArrayXd::Zero(n);
+            _low = Eigen::ArrayXd::Zero(n);
+            _high = Eigen::ArrayXd::Zero(n);
+            _previous_valid = false;
+        }
+
+        size_t size() const { return _min_position.size(); }
+
+        // The limits that are not given stay infinite
+        void set_position_limits(size_t i, double min_position, double max_position)
+        {
+            _min_position(i) = min_position;
+            _max_position(i) = max_position;
+        }
+
+        void set_velocity_limit(size_t i, double max_velocity)
+        {
+            _max_velocity(i) = max_velocity;
+            _has_velocity(i) = true;
+        }
+
+        void set_effort_limit(size_t i, double max_effort) { _max_effort(i) = max_effort; }
+
+        void set_soft_limits(size_t i, double min_position, double max_position, double k_position, double k_velocity)
+        {
+            _soft(i) = true;
+            _soft_min_position(i) = min_position;
+            _soft_max_position(i) = max_position;
+            _k_position(i) = k_position;
+            _k_velocity(i) = k_velocity;
+        }
+
+        double max_effort(size_t i) const { return _max_effort(i); }
+
+        // The next position command is limited around the current position rather than the previous command
+        void reset() { _previous_valid = false; }
+
+        // Bounds of the effort commands: the effort limits, tightened by the soft limits from the joint state
+        void effort_bounds(const double* position, const double* velocity, double* low, double* high) const
+        {
+            Eigen::Map<const Eigen::ArrayXd> pos(position, size()), vel(velocity, size());
+            // Velocity bounds pushing away from the soft position limits, then effort bounds reaching them
+            auto min_vel = (-_k_position * (pos - _soft_min_position)).max(-_max_velocity).min(_max_velocity);
+            auto max_vel = (-_k_position * (pos - _soft_max_position)).max(-_max_velocity).min(_max_velocity);
+            Eigen::Map<Eigen::ArrayXd>(low, size()) = _soft.select((-_k_velocity * (vel - min_vel)).max(-_max_effort).min(_max_effort), -_max_effort);
+            Eigen::Map<Eigen::ArrayXd>(high, size()) = _soft.select((-_k_velocity * (vel - max_vel)).max(-_max_effort).min(_max_effort), _max_effort);
+        }
+
+        void enforce_effort(const double* position, const double* velocity, double* command)
+        {
+            effort_bounds(position, velocity, _low.data(), _high.data());
+            Eigen::Map<Eigen::ArrayXd> cmd(command, size());
+            cmd = cmd.max(_low).min(_high);
+        }
+
+        // Position commands: within the position limits and reachable from the previous command at the velocity limits
+        // (slowed down near the soft limits); dt is the time since the previous command
+        void enforce_position(const double* position, double* command, double dt)
+        {
+            Eigen::Map<Eigen::ArrayXd> cmd(command, size());
+            if (!_previous_valid)
+                _previous = Eigen::Map<const Eigen::ArrayXd>(position, size());
+
+            auto min_vel = _soft.select((-_k_position * (_previous - _soft_min_position)).max(-_max_velocity).min(_max_velocity), -_max_velocity);
+            auto max_vel = _soft.select((-_k_position * (_previous - _soft_max_position)).max(-_max_velocity).min(_max_velocity), _max_velocity);
+            // Without velocity limit, only the (soft) position limits apply
+            _low = _has_velocity.select(_previous + min_vel * dt, _soft_min_position).max(_min_position);
+            _high = _has_velocity.select(_previous + max_vel * dt, _soft_max_position).min(_max_position);
+
+            cmd = cmd.max(_low).min(_high);
+            _previous = cmd;
+            _previous_valid = true;
+        }
+
+    protected:
+        Eigen::ArrayXd _min_position, _max_position, _max_velocity, _max_effort;
+        Eigen::Array<bool, Eigen::Dynamic, 1> _has_velocity, _soft;
+        Eigen::ArrayXd _soft_min_position, _soft_max_position, _k_position, _k_velocity;
+
+        // Workspace of the clamps
+        Eigen::ArrayXd _previous, _low, _high;
+        bool _previous_valid; // _previous holds the last position command
+    };
+} // namespace iiwa_tools
+
+#endif
@@ -0,0 +1,81 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#ifndef IIWA_TOOLS_MODEL_LOADER_H
+#define IIWA_TOOLS_MODEL_LOADER_H
+
+// std headers
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// ROS headers
+#include <ros/ros.h>
+#include <urdf/model.h>
+
+// RBDyn headers
+#include <mc_rbdyn_urdf/urdf.h>
+
+namespace iiwa_tools {
+    // Process-wide cache of the robot descriptions, so that the components of one process (the hardware interface,
+    // its controllers, the services) wait for the URDF parameter once and share its parsed models.
+    // The parameter is read through the parameter cache (ros::NodeHandle::getParamCached): the master pushes its
+    // updates, so waiting for it does not poll the master. Each model is parsed on first use, once per XML.
+    class ModelLoader {
+    public:
+        static ModelLoader& instance();
+
+        // The URDF XML of the parameter (resolved by nh), waiting for it at most timeout seconds (negative: forever).
+        // Empty if it did not arrive (or ROS shut down).
+        std::string urdf_string(const ros::NodeHandle& nh, const std::string& param, double timeout = -1.);
+
+        // Null if the XML did not arrive or could not be parsed
+        std::shared_ptr<const urdf::Model> urdf_model(const ros::NodeHandle& nh, const std::string& param, double timeout = -1.);
+        std::shared_ptr<const mc_rbdyn_urdf::URDFParserResult> rbdyn_model(const ros::NodeHandle& nh, const std::string& param, double timeout = -1.);
+
+        // Parses both models in the background (e.g. while the hardware starts, for the controllers loaded later)
+        void prefetch(const ros::NodeHandle& nh, const std::string& param, double timeout = -1.);
+
+    protected:
+        struct Entry {
+            std::shared_ptr<const std::string> xml; // shared with the background parses
+            std::shared_future<std::shared_ptr<const urdf::Model>> urdf;
+            std::shared_future<std::shared_ptr<const mc_rbdyn_urdf::URDFParserResult>> rbdyn;
+        };
+
+        ModelLoader() {}
+        ModelLoader(const ModelLoader&) = delete;
+        ModelLoader& operator=(const ModelLoader&) = delete;
+
+        // The entry of the current XML of the parameter, with the requested parses started (null if no XML)
+        std::shared_ptr<Entry> _entry(const ros::NodeHandle& nh, const std::string& param, double timeout, bool urdf, bool rbdyn);
+
+        std::mutex _mutex;
+        std::map<std::string, std::shared_ptr<Entry>> _entries; // by resolved parameter name
+    };
+} // namespace iiwa_tools
+
+#endif
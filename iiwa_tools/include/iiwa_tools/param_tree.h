@@ -0,0 +1,87 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#ifndef IIWA_TOOLS_PARAM_TREE_H
+#define IIWA_TOOLS_PARAM_TREE_H
+
+// std headers
+#include <string>
+#include <vector>
+
+// ROS headers
+#include <ros/ros.h>
+
+namespace iiwa_tools {
+    // A whole parameter namespace, fetched from the parameter server with a single getParam. Values are looked up by
+    // "a/b/c" paths relative to it, with the conversions of ros::NodeHandle::param (integers are accepted as doubles).
+    class ParamTree {
+    public:
+        ParamTree() {}
+        explicit ParamTree(const XmlRpc::XmlRpcValue& value) : _root(value) {}
+
+        // ns is relative to the node handle (empty: its own namespace); false if there is no such namespace
+        bool load(const ros::NodeHandle& nh, const std::string& ns = "");
+
+        bool has(const std::string& path) const { return _find(path) != nullptr; }
+
+        // False (and value unchanged) if the parameter does not exist or has another type
+        template <typename T>
+        bool get(const std::string& path, T& value) const
+        {
+            XmlRpc::XmlRpcValue* node = _find(path);
+            return node && _convert(*node, value);
+        }
+
+        template <typename T>
+        void param(const std::string& path, T& value, const T& default_value) const
+        {
+            if (!get(path, value))
+                value = default_value;
+        }
+
+        // The members of a struct parameter (empty if it is not one), e.g. to iterate over the controllers
+        std::vector<std::string> members(const std::string& path) const;
+
+        // Parameters under path; an empty tree if there is none
+        ParamTree subtree(const std::string& path) const;
+
+        // The raw value (nullptr if the parameter does not exist), for the layouts the conversions do not cover
+        XmlRpc::XmlRpcValue* value(const std::string& path) const { return _find(path); }
+
+    protected:
+        XmlRpc::XmlRpcValue* _find(const std::string& path) const;
+
+        static bool _convert(XmlRpc::XmlRpcValue& node, bool& value);
+        static bool _convert(XmlRpc::XmlRpcValue& node, int& value);
+        static bool _convert(XmlRpc::XmlRpcValue& node, double& value);
+        static bool _convert(XmlRpc::XmlRpcValue& node, std::string& value);
+        static bool _convert(XmlRpc::XmlRpcValue& node, std::vector<double>& value);
+        static bool _convert(XmlRpc::XmlRpcValue& node, std::vector<std::string>& value);
+
+        // XmlRpcValue has no const lookup of struct members
+        mutable XmlRpc::XmlRpcValue _root;
+    };
+} // namespace iiwa_tools
+
+#endif
@@ -0,0 +1,191 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#ifndef IIWA_TOOLS_SERIAL_CHAIN_H
+#define IIWA_TOOLS_SERIAL_CHAIN_H
+
+// Eigen headers
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+namespace iiwa_tools {
+    // Fixed-size model of a serial chain of N revolute joints (e.g. the 7 joints of the iiwa).
+    // Same quantities and conventions as the RBDyn path of IiwaTools, but with compile-time sizes
+    // and without walking a generic MultiBody: everything is expressed in the world frame.
+    template <int N>
+    class SerialChain {
+    public:
+        using Vector = Eigen::Matrix<double, N, 1>;
+        using Jacobian = Eigen::Matrix<double, 6, N>;
+
+        struct Link {
+            Link() : rotation(Eigen::Matrix3d::Identity()), translation(Eigen::Vector3d::Zero()), axis(Eigen::Vector3d::UnitZ()), mass(0.), com(Eigen::Vector3d::Zero()), inertia(Eigen::Matrix3d::Zero()) {}
+
+            // Frame of the joint in the frame of the previous link (of the world for the first joint)
+            Eigen::Matrix3d rotation;
+            Eigen::Vector3d translation;
+            Eigen::Vector3d axis; // unit, in the frame of the joint
+            // Inertial parameters of the link (and everything rigidly attached to it), in the frame of the link
+            double mass;
+            Eigen::Vector3d com;
+            Eigen::Matrix3d inertia; // about the center of mass
+        };
+
+        // Per-thread scratch and results (world frame)
+        struct Workspace {
+            EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+            Eigen::Matrix3d rotation[N]; // of the links
+            Eigen::Vector3d origin[N];
+            Eigen::Vector3d axis[N];
+            Eigen::Matrix3d ee_rotation;
+            Eigen::Vector3d ee_position;
+
+            // Velocity and acceleration propagation (joint origins and links)
+            Eigen::Vector3d omega[N], omega_dot[N], velocity[N], acceleration[N];
+            Eigen::Vector3d force[N], moment[N];
+
+            Vector q, dq, tau;
+            Jacobian jacobian, jacobian_deriv;
+        };
+
+        SerialChain() : _ee_rotation(Eigen::Matrix3d::Identity()), _ee_translation(Eigen::Vector3d::Zero()) {}
+
+        Link& link(int i) { return _links[i]; }
+        const Link& link(int i) const { return _links[i]; }
+
+        // End-effector frame in the frame of the last link
+        void set_end_effector(const Eigen::Matrix3d& rotation, const Eigen::Vector3d& translation)
+        {
+            _ee_rotation = rotation;
+            _ee_translation = translation;
+        }
+
+        // Poses of the links and of the end-effector at ws.q
+        void forward_kinematics(Workspace& ws) const
+        {
+            Eigen::Matrix3d rotation = Eigen::Matrix3d::Identity();
+            Eigen::Vector3d position = Eigen::Vector3d::Zero();
+            for (int i = 0; i < N; i++) {
+                const Link& link = _links[i];
+                ws.origin[i] = position + rotation * link.translation;
+                rotation = rotation * link.rotation;
+                ws.axis[i] = rotation * link.axis;
+                rotation = rotation * Eigen::AngleAxisd(ws.q[i], link.axis).toRotationMatrix();
+                ws.rotation[i] = rotation;
+                position = ws.origin[i];
+            }
+            ws.ee_position = position + rotation * _ee_translation;
+            ws.ee_rotation = rotation * _ee_rotation;
+        }
+
+        // Jacobian of the end-effector in the world frame at the end-effector (angular rows first), after forward_kinematics
+        void jacobian(Workspace& ws) const
+        {
+            for (int i = 0; i < N; i++) {
+                ws.jacobian.col(i).template head<3>() = ws.axis[i];
+                ws.jacobian.col(i).template tail<3>() = ws.axis[i].cross(ws.ee_position - ws.origin[i]);
+            }
+        }
+
+        // Time derivative of the above at the velocities ws.dq, after forward_kinematics
+        void jacobian_deriv(Workspace& ws) const
+        {
+            _velocities(ws);
+
+            Eigen::Vector3d ee_velocity = ws.velocity[N - 1] + ws.omega[N - 1].cross(ws.ee_position - ws.origin[N - 1]);
+            Eigen::Vector3d parent_omega = Eigen::Vector3d::Zero();
+            for (int i = 0; i < N; i++) {
+                Eigen::Vector3d axis_dot = parent_omega.cross(ws.axis[i]);
+                ws.jacobian_deriv.col(i).template head<3>() = axis_dot;
+                ws.jacobian_deriv.col(i).template tail<3>() = axis_dot.cross(ws.ee_position - ws.origin[i]) + ws.axis[i].cross(ee_velocity - ws.velocity[i]);
+                parent_omega = ws.omega[i];
+            }
+        }
+
+        // Recursive Newton-Euler with zero joint accelerations: the torques of the velocities ws.dq and of
+        // a base accelerating with base_acceleration (RBDyn's convention for the gravity), after forward_kinematics
+        void inverse_dynamics(const Eigen::Vector3d& base_acceleration, Workspace& ws) const
+        {
+            // Forward: velocities and accelerations of the joint origins and links
+            Eigen::Vector3d omega = Eigen::Vector3d::Zero(), omega_dot = Eigen::Vector3d::Zero();
+            Eigen::Vector3d acceleration = base_acceleration, origin = Eigen::Vector3d::Zero();
+            for (int i = 0; i < N; i++) {
+                Eigen::Vector3d d = ws.origin[i] - origin;
+                acceleration += omega_dot.cross(d) + omega.cross(omega.cross(d));
+                Eigen::Vector3d joint_omega = ws.axis[i] * ws.dq[i];
+                omega_dot += omega.cross(joint_omega);
+                omega += joint_omega;
+
+                ws.omega[i] = omega;
+                ws.omega_dot[i] = omega_dot;
+                ws.acceleration[i] = acceleration;
+                origin = ws.origin[i];
+            }
+
+            // Backward: forces and moments (about the joint origins) transmitted by the joints
+            Eigen::Vector3d force = Eigen::Vector3d::Zero(), moment = Eigen::Vector3d::Zero();
+            for (int i = N - 1; i >= 0; i--) {
+                const Link& link = _links[i];
+                const Eigen::Matrix3d& rotation = ws.rotation[i];
+                Eigen::Vector3d c = rotation * link.com;
+                Eigen::Matrix3d inertia = rotation * link.inertia * rotation.transpose();
+
+                Eigen::Vector3d com_acceleration = ws.acceleration[i] + ws.omega_dot[i].cross(c) + ws.omega[i].cross(ws.omega[i].cross(c));
+                Eigen::Vector3d link_force = link.mass * com_acceleration;
+                Eigen::Vector3d link_moment = inertia * ws.omega_dot[i] + ws.omega[i].cross(inertia * ws.omega[i]);
+
+                // the force and moment of the child are applied at its joint origin
+                if (i < N - 1)
+                    moment += (ws.origin[i + 1] - ws.origin[i]).cross(force);
+                moment += link_moment + c.cross(link_force);
+                force += link_force;
+
+                ws.force[i] = force;
+                ws.moment[i] = moment;
+                ws.tau[i] = ws.axis[i].dot(moment);
+            }
+        }
+
+    protected:
+        // Angular velocities of the links and linear velocities of the joint origins
+        void _velocities(Workspace& ws) const
+        {
+            Eigen::Vector3d omega = Eigen::Vector3d::Zero(), velocity = Eigen::Vector3d::Zero(), origin = ws.origin[0];
+            for (int i = 0; i < N; i++) {
+                velocity += omega.cross(ws.origin[i] - origin);
+                omega += ws.axis[i] * ws.dq[i];
+                ws.omega[i] = omega;
+                ws.velocity[i] = velocity;
+                origin = ws.origin[i];
+            }
+        }
+
+        Link _links[N];
+        Eigen::Matrix3d _ee_rotation;
+        Eigen::Vector3d _ee_translation;
+    };
+} // namespace iiwa_tools
+
+#endif
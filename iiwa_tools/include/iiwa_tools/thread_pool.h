@@ -0,0 +1,132 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#ifndef IIWA_TOOLS_THREAD_POOL_H
+#define IIWA_TOOLS_THREAD_POOL_H
+
+// std headers
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace iiwa_tools {
+    // Fixed set of worker threads for data-parallel loops (parallel_for calls are serialized)
+    class ThreadPool {
+    public:
+        // With less than 2 threads, the loops run on the calling thread
+        explicit ThreadPool(size_t num_threads) : _job(nullptr), _n(0), _next(0), _active(0), _generation(0), _stop(false)
+        {
+            if (num_threads < 2)
+                return;
+            for (size_t i = 0; i < num_threads; i++)
+                _threads.emplace_back(&ThreadPool::_worker, this, i);
+        }
+
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _stop = true;
+            }
+            _start_cv.notify_all();
+            for (auto& thread : _threads)
+                thread.join();
+        }
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        // Number of workers, i.e. of the distinct worker indices passed to the jobs
+        size_t size() const { return _threads.empty() ? 1 : _threads.size(); }
+
+        // Calls job(i, worker) for every i in [0, n) and returns when all are done
+        void parallel_for(size_t n, const std::function<void(size_t, size_t)>& job)
+        {
+            std::lock_guard<std::mutex> run_lock(_run_mutex);
+            if (n == 0)
+                return;
+
+            if (_threads.empty()) {
+                for (size_t i = 0; i < n; i++)
+                    job(i, 0);
+                return;
+            }
+
+            std::unique_lock<std::mutex> lock(_mutex);
+            _job = &job;
+            _n = n;
+            _next = 0;
+            _active = _threads.size();
+            _generation++;
+            lock.unlock();
+            _start_cv.notify_all();
+
+            lock.lock();
+            _done_cv.wait(lock, [this] { return _active == 0; });
+            _job = nullptr;
+        }
+
+    protected:
+        void _worker(size_t id)
+        {
+            uint64_t generation = 0;
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (true) {
+                _start_cv.wait(lock, [&] { return _stop || _generation != generation; });
+                if (_stop)
+                    return;
+                generation = _generation;
+                const std::function<void(size_t, size_t)>& job = *_job;
+                size_t n = _n;
+                lock.unlock();
+
+                for (size_t i = _next++; i < n; i = _next++)
+                    job(i, id);
+
+                lock.lock();
+                if (--_active == 0)
+                    _done_cv.notify_all();
+            }
+        }
+
+        std::vector<std::thread> _threads;
+        std::mutex _run_mutex; // one loop at a time
+        std::mutex _mutex;
+        std::condition_variable _start_cv, _done_cv;
+
+        // Current loop (guarded by _mutex, except the index counter)
+        const std::function<void(size_t, size_t)>* _job;
+        size_t _n;
+        std::atomic<size_t> _next;
+        size_t _active;
+        uint64_t _generation;
+        bool _stop;
+    };
+} // namespace iiwa_tools
+
+#endif
@@ -0,0 +1,220 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#include <iiwa_tools/analytic_ik.h>
+
+// std headers
+#include <cmath>
+#include <memory>
+
+namespace iiwa_tools {
+    namespace {
+        Eigen::Matrix3d rotation(const Eigen::Vector3d& axis, double angle)
+        {
+            return Eigen::AngleAxisd(angle, axis).toRotationMatrix();
+        }
+
+        double wrap(double angle)
+        {
+            return std::atan2(std::sin(angle), std::cos(angle));
+        }
+
+        // Closest point of the line (o1, a1) to the line (o2, a2) and the distance between the lines
+        Eigen::Vector3d closest_point(const Eigen::Vector3d& o1, const Eigen::Vector3d& a1, const Eigen::Vector3d& o2, const Eigen::Vector3d& a2, double& distance)
+        {
+            Eigen::Vector3d w = o1 - o2;
+            double b = a1.dot(a2), d = a1.dot(w), e = a2.dot(w);
+            double denominator = 1. - b * b;
+            double t = (denominator > 1e-12) ? (b * e - d) / denominator : 0.;
+            double s = (denominator > 1e-12) ? (e - b * d) / denominator : e;
+            Eigen::Vector3d p1 = o1 + t * a1;
+            distance = (p1 - (o2 + s * a2)).norm();
+            return p1;
+        }
+
+        double line_distance(const Eigen::Vector3d& p, const Eigen::Vector3d& o, const Eigen::Vector3d& a)
+        {
+            Eigen::Vector3d d = p - o;
+            return (d - a * a.dot(d)).norm();
+        }
+
+        // Paden-Kahan subproblems on vectors relative to a point of the (unit) axes
+        // 1: the angle that rotates u to v about axis
+        double rotation_angle(const Eigen::Vector3d& axis, const Eigen::Vector3d& u, const Eigen::Vector3d& v)
+        {
+            Eigen::Vector3d up = u - axis * axis.dot(u);
+            Eigen::Vector3d vp = v - axis * axis.dot(v);
+            return std::atan2(axis.dot(up.cross(vp)), up.dot(vp));
+        }
+
+        // 2: rotation(a1, t1[k]) * rotation(a2, t2[k]) * u = v, for intersecting and non-parallel axes
+        int two_rotations(const Eigen::Vector3d& a1, const Eigen::Vector3d& a2, const Eigen::Vector3d& u, const Eigen::Vector3d& v, double t1[2], double t2[2], double tolerance)
+        {
+            double c = a1.dot(a2);
+            Eigen::Vector3d n = a1.cross(a2);
+            double alpha = (c * a2.dot(u) - a1.dot(v)) / (c * c - 1.);
+            double beta = (c * a1.dot(v) - a2.dot(u)) / (c * c - 1.);
+            double gamma2 = (u.squaredNorm() - alpha * alpha - beta * beta - 2. * alpha * beta * c) / n.squaredNorm();
+            if (gamma2 < -tolerance)
+                return 0;
+            double gamma = std::sqrt(std::max(gamma2, 0.));
+
+            int count = (gamma > 0.) ? 2 : 1;
+            for (int k = 0; k < count; k++) {
+                Eigen::Vector3d z = alpha * a1 + beta * a2 + ((k == 0) ? gamma : -gamma) * n;
+                t2[k] = rotation_angle(a2, u, z);
+                t1[k] = rotation_angle(a1, z, v);
+            }
+            return count;
+        }
+
+        // 3: |rotation(axis, t[k]) * u - v| = delta
+        int rotation_at_distance(const Eigen::Vector3d& axis, const Eigen::Vector3d& u, const Eigen::Vector3d& v, double delta, double t[2], double tolerance)
+        {
+            Eigen::Vector3d up = u - axis * axis.dot(u);
+            Eigen::Vector3d vp = v - axis * axis.dot(v);
+            double along = axis.dot(u - v);
+            double delta_p2 = delta * delta - along * along;
+            double norms = 2. * up.norm() * vp.norm();
+            if (norms < 1e-12)
+                return 0;
+
+            double cos_angle = (up.squaredNorm() + vp.squaredNorm() - delta_p2) / norms;
+            if (std::abs(cos_angle) > 1. + tolerance)
+                return 0;
+            cos_angle = std::max(-1., std::min(1., cos_angle));
+
+            double t0 = rotation_angle(axis, u, v);
+            double angle = std::acos(cos_angle);
+            t[0] = t0 + angle;
+            t[1] = t0 - angle;
+            return (angle > 0.) ? 2 : 1;
+        }
+    } // namespace
+
+    AnalyticIk::AnalyticIk(const SerialChain<7>& chain, double tolerance) : _valid(false)
+    {
+        std::unique_ptr<SerialChain<7>::Workspace> ws(new SerialChain<7>::Workspace);
+        ws->q.setZero();
+        chain.forward_kinematics(*ws);
+
+        for (int i = 0; i < 7; i++)
+            _axes[i] = ws->axis[i];
+        _ee_rotation = ws->ee_rotation;
+        _ee_position = ws->ee_position;
+
+        // Shoulder and wrist: intersections of the (pairwise orthogonal) axes 1-3 and 5-7
+        double d12, d67;
+        _shoulder = closest_point(ws->origin[0], _axes[0], ws->origin[1], _axes[1], d12);
+        _wrist_point = closest_point(ws->origin[6], _axes[6], ws->origin[5], _axes[5], d67);
+        double d3 = line_distance(_shoulder, ws->origin[2], _axes[2]);
+        double d5 = line_distance(_wrist_point, ws->origin[4], _axes[4]);
+        bool orthogonal = std::abs(_axes[0].dot(_axes[1])) < tolerance && std::abs(_axes[1].dot(_axes[2])) < tolerance
+            && std::abs(_axes[4].dot(_axes[5])) < tolerance && std::abs(_axes[5].dot(_axes[6])) < tolerance;
+        if (d12 > tolerance || d67 > tolerance || d3 > tolerance || d5 > tolerance || !orthogonal)
+            return;
+
+        // Elbow: the point of the axis of joint 4 closest to the shoulder
+        Eigen::Vector3d d = _shoulder - ws->origin[3];
+        _elbow = ws->origin[3] + _axes[3] * _axes[3].dot(d);
+
+        // The elbow has to bend the arm
+        _valid = (line_distance(_shoulder, _elbow, _axes[3]) > tolerance) && (line_distance(_wrist_point, _elbow, _axes[3]) > tolerance);
+    }
+
+    Eigen::Vector3d AnalyticIk::_wrist(double q4) const
+    {
+        return rotation(_axes[3], q4) * (_wrist_point - _elbow) + _elbow - _shoulder;
+    }
+
+    bool AnalyticIk::_reference(double q4, const Eigen::Vector3d& wrist_target, Eigen::Matrix3d& reference) const
+    {
+        double t1[2], t2[2];
+        if (two_rotations(_axes[0], _axes[1], _wrist(q4), wrist_target, t1, t2, 1e-9) == 0)
+            return false;
+        reference = rotation(_axes[0], t1[0]) * rotation(_axes[1], t2[0]);
+        return true;
+    }
+
+    int AnalyticIk::solve(const Eigen::Matrix3d& target_rotation, const Eigen::Vector3d& target_position, double arm_angle, Solutions& solutions) const
+    {
+        if (!_valid)
+            return 0;
+
+        // Every joint after the wrist keeps the wrist point, which constrains the elbow
+        Eigen::Matrix3d motion = target_rotation * _ee_rotation.transpose(); // rotation of the whole chain from the zero configuration
+        Eigen::Vector3d wrist_target = motion * (_wrist_point - _ee_position) + target_position - _shoulder;
+
+        double q4[2];
+        int n4 = rotation_at_distance(_axes[3], _wrist_point - _elbow, _shoulder - _elbow, wrist_target.norm(), q4, 1e-9);
+
+        Eigen::Vector3d sw_axis = wrist_target.normalized();
+        Eigen::Vector3d x3 = _axes[2].unitOrthogonal(), x7 = _axes[6].unitOrthogonal();
+        int count = 0;
+        for (int i4 = 0; i4 < n4; i4++) {
+            Eigen::Matrix3d reference;
+            if (!_reference(q4[i4], wrist_target, reference))
+                continue;
+
+            // Shoulder: the rotation of the reference plane by the arm angle about the shoulder-wrist line
+            Eigen::Matrix3d shoulder = rotation(sw_axis, arm_angle) * reference;
+            double t1[2], t2[2];
+            int ns = two_rotations(_axes[0], _axes[1], _axes[2], shoulder * _axes[2], t1, t2, 1e-9);
+            for (int is = 0; is < ns; is++) {
+                Eigen::Matrix3d r12 = rotation(_axes[0], t1[is]) * rotation(_axes[1], t2[is]);
+                double t3 = rotation_angle(_axes[2], x3, r12.transpose() * shoulder * x3);
+
+                // Wrist: what is left of the orientation
+                Eigen::Matrix3d wrist = (r12 * rotation(_axes[2], t3) * rotation(_axes[3], q4[i4])).transpose() * motion;
+                double t5[2], t6[2];
+                int nw = two_rotations(_axes[4], _axes[5], _axes[6], wrist * _axes[6], t5, t6, 1e-9);
+                for (int iw = 0; iw < nw; iw++) {
+                    Eigen::Matrix3d r56 = rotation(_axes[4], t5[iw]) * rotation(_axes[5], t6[iw]);
+                    double t7 = rotation_angle(_axes[6], x7, r56.transpose() * wrist * x7);
+
+                    Vector7d& q = solutions[count++];
+                    q << wrap(t1[is]), wrap(t2[is]), wrap(t3), wrap(q4[i4]), wrap(t5[iw]), wrap(t6[iw]), wrap(t7);
+                }
+            }
+        }
+
+        return count;
+    }
+
+    double AnalyticIk::arm_angle(const Vector7d& q) const
+    {
+        if (!_valid)
+            return 0.;
+
+        Eigen::Matrix3d shoulder = rotation(_axes[0], q[0]) * rotation(_axes[1], q[1]) * rotation(_axes[2], q[2]);
+        Eigen::Vector3d wrist = shoulder * _wrist(q[3]);
+        Eigen::Matrix3d reference;
+        if (!_reference(q[3], wrist, reference))
+            return 0.;
+
+        // Angle from the reference elbow to the actual one about the shoulder-wrist line
+        Eigen::Vector3d sw_axis = wrist.normalized();
+        return rotation_angle(sw_axis, reference * (_elbow - _shoulder), shoulder * (_elbow - _shoulder));
+    }
+} // namespace iiwa_tools
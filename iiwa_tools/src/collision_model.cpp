@@ -0,0 +1,556 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#include <iiwa_tools/collision_model.h>
+
+#include <ros/package.h>
+
+#include <RBDyn/FK.h>
+
+#include <tinyxml2.h>
+
+#include <Eigen/Eigenvalues>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+namespace iiwa_tools {
+    namespace {
+        // Group of bodies rigidly attached to each other (through fixed joints): the body of its moving joint (or the root)
+        int rigid_group(const rbd::MultiBody& mb, int body)
+        {
+            while (mb.joint(body).dof() == 0 && mb.parent(body) >= 0)
+                body = mb.parent(body);
+            return body;
+        }
+
+        Eigen::Vector3d parse_vector(const char* text, const Eigen::Vector3d& default_value)
+        {
+            if (!text)
+                return default_value;
+            Eigen::Vector3d v;
+            std::istringstream stream(text);
+            if (!(stream >> v(0) >> v(1) >> v(2)))
+                return default_value;
+            return v;
+        }
+
+        // Resolves package:// and file:// URLs
+        std::string resolve_file(const std::string& url)
+        {
+            const std::string package = "package://", file = "file://";
+            if (url.compare(0, package.size(), package) == 0) {
+                std::string path = url.substr(package.size());
+                size_t slash = path.find('/');
+                if (slash == std::string::npos)
+                    return "";
+                std::string package_path = ros::package::getPath(path.substr(0, slash));
+                return package_path.empty() ? "" : package_path + path.substr(slash);
+            }
+            if (url.compare(0, file.size(), file) == 0)
+                return url.substr(file.size());
+            return url;
+        }
+
+        // Capsule of one <collision> element, in the link frame
+        bool collision_capsule(const tinyxml2::XMLElement* collision, const std::string& mesh_suffix, Capsule& capsule)
+        {
+            const tinyxml2::XMLElement* geometry = collision->FirstChildElement("geometry");
+            if (!geometry)
+                return false;
+
+            Eigen::Vector3d xyz = Eigen::Vector3d::Zero(), rpy = Eigen::Vector3d::Zero();
+            if (const tinyxml2::XMLElement* origin = collision->FirstChildElement("origin")) {
+                xyz = parse_vector(origin->Attribute("xyz"), xyz);
+                rpy = parse_vector(origin->Attribute("rpy"), rpy);
+            }
+            Eigen::Matrix3d rotation = (Eigen::AngleAxisd(rpy(2), Eigen::Vector3d::UnitZ()) * Eigen::AngleAxisd(rpy(1), Eigen::Vector3d::UnitY()) * Eigen::AngleAxisd(rpy(0), Eigen::Vector3d::UnitX())).toRotationMatrix();
+
+            // Primitives, along the z axis of their frame
+            Eigen::Vector3d a = Eigen::Vector3d::Zero(), b = Eigen::Vector3d::Zero();
+            if (const tinyxml2::XMLElement* cylinder = geometry->FirstChildElement("cylinder")) {
+                double length = cylinder->DoubleAttribute("length");
+                capsule.radius = cylinder->DoubleAttribute("radius");
+                a(2) = -0.5 * length;
+                b(2) = 0.5 * length;
+            }
+            else if (const tinyxml2::XMLElement* sphere = geometry->FirstChildElement("sphere")) {
+                capsule.radius = sphere->DoubleAttribute("radius");
+            }
+            else if (const tinyxml2::XMLElement* box = geometry->FirstChildElement("box")) {
+                // Along the longest side, through the corners
+                Eigen::Vector3d half = 0.5 * parse_vector(box->Attribute("size"), Eigen::Vector3d::Zero());
+                int axis;
+                half.maxCoeff(&axis);
+                a(axis) = -half(axis);
+                b(axis) = half(axis);
+                half(axis) = 0.;
+                capsule.radius = half.norm();
+            }
+            else if (const tinyxml2::XMLElement* mesh = geometry->FirstChildElement("mesh")) {
+                const char* url = mesh->Attribute("filename");
+                std::string file = url ? resolve_file(url) : "";
+                if (file.empty())
+                    return false;
+
+                // The simplified mesh if there is one
+                std::vector<Eigen::Vector3d> vertices;
+                size_t dot = file.rfind('.');
+                bool loaded = false;
+                if (!mesh_suffix.empty() && dot != std::string::npos && file.compare(dot - std::min(dot, mesh_suffix.size()), mesh_suffix.size(), mesh_suffix) != 0)
+                    loaded = load_stl(file.substr(0, dot) + mesh_suffix + file.substr(dot), vertices);
+                if (!loaded && !load_stl(file, vertices)) {
+                    ROS_ERROR_STREAM("Could not read the collision mesh '" << file << "' (only STL files are supported).");
+                    return false;
+                }
+
+                Eigen::Vector3d scale = parse_vector(mesh->Attribute("scale"), Eigen::Vector3d::Ones());
+                for (auto& v : vertices)
+                    v = rotation * scale.cwiseProduct(v) + xyz;
+                capsule = fit_capsule(vertices);
+                return true;
+            }
+            else
+                return false;
+
+            capsule.a = rotation * a + xyz;
+            capsule.b = rotation * b + xyz;
+            return true;
+        }
+
+        double to_double(XmlRpc::XmlRpcValue& value)
+        {
+            if (value.getType() == XmlRpc::XmlRpcValue::TypeInt)
+                return static_cast<int>(value);
+            return static_cast<double>(value);
+        }
+
+        Eigen::Vector3d to_vector(XmlRpc::XmlRpcValue& value)
+        {
+            if (value.getType() != XmlRpc::XmlRpcValue::TypeArray || value.size() != 3)
+                throw XmlRpc::XmlRpcException("expected a 3D vector");
+            return Eigen::Vector3d(to_double(value[0]), to_double(value[1]), to_double(value[2]));
+        }
+    } // namespace
+
+    bool CollisionModel::init(const rbd::MultiBody& mb, const std::vector<size_t>& joint_indices, const std::string& urdf_string, const CollisionSettings& settings)
+    {
+        _initialized = false;
+        _settings = settings;
+        _capsules.clear();
+        _pairs.clear();
+
+        // Joint axes (the joint of body i rotates/translates it about/along the axis through its origin)
+        _axes.assign(mb.nrBodies(), Eigen::Vector3d::Zero());
+        _prismatic.assign(mb.nrBodies(), false);
+        for (size_t i = 0; i < mb.nrBodies(); i++) {
+            const rbd::Joint& joint = mb.joint(i);
+            if (joint.dof() != 1)
+                continue;
+            if (joint.type() == rbd::Joint::Prism) {
+                _axes[i] = joint.motionSubspace().col(0).tail<3>();
+                _prismatic[i] = true;
+            }
+            else
+                _axes[i] = joint.motionSubspace().col(0).head<3>();
+        }
+
+        // Capsules of the collision geometries of the links
+        tinyxml2::XMLDocument doc;
+        if (doc.Parse(urdf_string.c_str()) != tinyxml2::XML_SUCCESS || !doc.FirstChildElement("robot")) {
+            ROS_ERROR_STREAM("CollisionModel: could not parse the URDF.");
+            return false;
+        }
+        for (const tinyxml2::XMLElement* link = doc.FirstChildElement("robot")->FirstChildElement("link"); link; link = link->NextSiblingElement("link")) {
+            const char* name = link->Attribute("name");
+            int body = name ? mb.bodyIndexByName(name) : -1;
+            if (body < 0)
+                continue;
+            for (const tinyxml2::XMLElement* collision = link->FirstChildElement("collision"); collision; collision = collision->NextSiblingElement("collision")) {
+                Capsule capsule;
+                if (collision_capsule(collision, _settings.mesh_suffix, capsule)) {
+                    capsule.radius += _settings.padding;
+                    _add_capsule(mb, joint_indices, body, capsule);
+                }
+                else
+                    ROS_WARN_STREAM("CollisionModel: unsupported collision geometry of " << name << ", ignored.");
+            }
+        }
+
+        if (_capsules.empty()) {
+            ROS_ERROR_STREAM("CollisionModel: no collision geometry in the URDF.");
+            return false;
+        }
+
+        // Self-collision pairs: not rigidly attached or adjacent, not allowed, and apart at the zero configuration
+        // (links that intersect there, e.g. through their joint, would always be reported)
+        std::vector<std::pair<int, int>> candidates;
+        if (_settings.self_collision) {
+            for (size_t i = 0; i < _capsules.size(); i++) {
+                for (size_t j = i + 1; j < _capsules.size(); j++) {
+                    int gi = rigid_group(mb, _capsules[i].body), gj = rigid_group(mb, _capsules[j].body);
+                    int pi = (mb.parent(gi) >= 0) ? rigid_group(mb, mb.parent(gi)) : -1;
+                    int pj = (mb.parent(gj) >= 0) ? rigid_group(mb, mb.parent(gj)) : -1;
+                    if (gi == gj || pi == gj || pj == gi)
+                        continue;
+                    if (_capsules[i].joints.empty() && _capsules[j].joints.empty())
+                        continue;
+
+                    const std::string &li = _capsules[i].link, &lj = _capsules[j].link;
+                    bool allowed = std::any_of(_settings.allowed_pairs.begin(), _settings.allowed_pairs.end(), [&](const std::pair<std::string, std::string>& p) {
+                        return (p.first == li && p.second == lj) || (p.first == lj && p.second == li);
+                    });
+                    if (!allowed)
+                        candidates.push_back({static_cast<int>(i), static_cast<int>(j)});
+                }
+            }
+        }
+
+        rbd::MultiBodyConfig mbc(mb);
+        mbc.zero(mb);
+        rbd::forwardKinematics(mb, mbc);
+        _pairs = candidates;
+        std::unique_ptr<Workspace> ws = create_workspace();
+        compute(mbc.bodyPosW, *ws);
+        _pairs.clear();
+        for (size_t i = 0; i < candidates.size(); i++) {
+            if (ws->pairs[i].distance > 0.)
+                _pairs.push_back(candidates[i]);
+            else
+                ROS_INFO_STREAM("CollisionModel: " << name(ws->pairs[i]) << " intersect at the zero configuration, not checked.");
+        }
+
+        // Zones: all the capsules that move
+        for (size_t z = 0; z < _settings.zones.size(); z++)
+            for (size_t i = 0; i < _capsules.size(); i++)
+                if (!_capsules[i].joints.empty())
+                    _pairs.push_back({static_cast<int>(i), -1 - static_cast<int>(z)});
+
+        ROS_INFO_STREAM("CollisionModel: " << _capsules.size() << " capsules, " << _pairs.size() << " pairs (" << _settings.zones.size() << " keep-out zones).");
+        _initialized = true;
+        return true;
+    }
+
+    std::unique_ptr<CollisionModel::Workspace> CollisionModel::create_workspace() const
+    {
+        std::unique_ptr<Workspace> ws(new Workspace);
+        ws->capsules.resize(_capsules.size());
+        ws->pairs.resize(_pairs.size());
+        ws->closest = -1;
+        return ws;
+    }
+
+    std::string CollisionModel::name(const Proximity& proximity) const
+    {
+        const std::string& link = _capsules[proximity.capsule].link;
+        if (proximity.other >= 0)
+            return link + ":" + _capsules[proximity.other].link;
+        return link + ":" + _settings.zones[-1 - proximity.other].name;
+    }
+
+    double CollisionModel::compute(const std::vector<sva::PTransformd>& body_poses, Workspace& ws) const
+    {
+        for (size_t i = 0; i < _capsules.size(); i++) {
+            const sva::PTransformd& pose = body_poses[_capsules[i].body];
+            // E maps the world frame to the body frame
+            ws.capsules[i].a = pose.rotation().transpose() * _capsules[i].capsule.a + pose.translation();
+            ws.capsules[i].b = pose.rotation().transpose() * _capsules[i].capsule.b + pose.translation();
+            ws.capsules[i].radius = _capsules[i].capsule.radius;
+        }
+
+        double min_distance = std::numeric_limits<double>::infinity();
+        ws.closest = -1;
+        for (size_t p = 0; p < _pairs.size(); p++) {
+            _distance(ws, _pairs[p].first, _pairs[p].second, ws.pairs[p]);
+            if (ws.pairs[p].distance < min_distance) {
+                min_distance = ws.pairs[p].distance;
+                ws.closest = p;
+            }
+        }
+
+        return min_distance;
+    }
+
+    void CollisionModel::gradient(const std::vector<sva::PTransformd>& body_poses, const Proximity& proximity, Eigen::Ref<Eigen::VectorXd> gradient) const
+    {
+        gradient.setZero();
+        _add_gradient(body_poses, _capsules[proximity.capsule], proximity.point, 1., proximity.normal, gradient);
+        if (proximity.other >= 0)
+            _add_gradient(body_poses, _capsules[proximity.other], proximity.other_point, -1., proximity.normal, gradient);
+    }
+
+    void CollisionModel::_add_capsule(const rbd::MultiBody& mb, const std::vector<size_t>& joint_indices, int body, const Capsule& capsule)
+    {
+        LinkCapsule link;
+        link.body = body;
+        link.link = mb.body(body).name();
+        link.capsule = capsule;
+        for (int b = body; b >= 0; b = mb.parent(b)) {
+            if (mb.joint(b).dof() != 1)
+                continue;
+            auto it = std::find(joint_indices.begin(), joint_indices.end(), static_cast<size_t>(b));
+            if (it != joint_indices.end())
+                link.joints.push_back({b, static_cast<int>(it - joint_indices.begin())});
+        }
+        _capsules.push_back(link);
+    }
+
+    void CollisionModel::_distance(const Workspace& ws, int capsule, int other, Proximity& proximity) const
+    {
+        const Capsule& c = ws.capsules[capsule];
+        proximity.capsule = capsule;
+        proximity.other = other;
+
+        if (other < 0 && _settings.zones[-1 - other].type == KeepOutZone::PLANE) {
+            const KeepOutZone& zone = _settings.zones[-1 - other];
+            double da = zone.normal.dot(c.a) - zone.offset, db = zone.normal.dot(c.b) - zone.offset;
+            proximity.point = (da < db) ? c.a : c.b;
+            double d = std::min(da, db);
+            proximity.other_point = proximity.point - d * zone.normal;
+            proximity.normal = zone.normal;
+            proximity.distance = d - c.radius;
+            return;
+        }
+
+        const Capsule& o = (other >= 0) ? ws.capsules[other] : _settings.zones[-1 - other].capsule;
+        double d = segment_distance(c.a, c.b, o.a, o.b, proximity.point, proximity.other_point);
+        if (d > 1e-12)
+            proximity.normal = (proximity.point - proximity.other_point) / d;
+        else {
+            // The axes intersect: any direction normal to both
+            Eigen::Vector3d n = (c.b - c.a).cross(o.b - o.a);
+            if (n.norm() < 1e-12)
+                n = (c.b - c.a).unitOrthogonal();
+            proximity.normal = n.normalized();
+        }
+        proximity.distance = d - c.radius - o.radius;
+    }
+
+    void CollisionModel::_add_gradient(const std::vector<sva::PTransformd>& body_poses, const LinkCapsule& link, const Eigen::Vector3d& point, double sign, const Eigen::Vector3d& normal, Eigen::Ref<Eigen::VectorXd> gradient) const
+    {
+        for (auto& joint : link.joints) {
+            const sva::PTransformd& pose = body_poses[joint.first];
+            Eigen::Vector3d axis = pose.rotation().transpose() * _axes[joint.first];
+            if (_prismatic[joint.first])
+                gradient(joint.second) += sign * normal.dot(axis);
+            else
+                gradient(joint.second) += sign * normal.dot(axis.cross(point - pose.translation()));
+        }
+    }
+
+    Capsule fit_capsule(const std::vector<Eigen::Vector3d>& points)
+    {
+        Capsule capsule;
+        capsule.a = capsule.b = Eigen::Vector3d::Zero();
+        capsule.radius = 0.;
+        if (points.empty())
+            return capsule;
+
+        // Principal axis
+        Eigen::Vector3d center = Eigen::Vector3d::Zero();
+        for (auto& p : points)
+            center += p;
+        center /= points.size();
+        Eigen::Matrix3d covariance = Eigen::Matrix3d::Zero();
+        for (auto& p : points)
+            covariance += (p - center) * (p - center).transpose();
+        Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(covariance);
+        Eigen::Vector3d axis = solver.eigenvectors().col(2);
+
+        // Smallest radius around the axis, then the shortest segment whose caps still contain all the points
+        for (auto& p : points) {
+            Eigen::Vector3d v = p - center;
+            capsule.radius = std::max(capsule.radius, (v - v.dot(axis) * axis).norm());
+        }
+        double low = std::numeric_limits<double>::max(), high = std::numeric_limits<double>::lowest();
+        for (auto& p : points) {
+            Eigen::Vector3d v = p - center;
+            double t = v.dot(axis);
+            double cap = std::sqrt(std::max(0., capsule.radius * capsule.radius - (v - t * axis).squaredNorm()));
+            low = std::min(low, t + cap);
+            high = std::max(high, t - cap);
+        }
+        if (low > high)
+            low = high = 0.5 * (low + high);
+
+        capsule.a = center + low * axis;
+        capsule.b = center + high * axis;
+        return capsule;
+    }
+
+    bool load_stl(const std::string& file_name, std::vector<Eigen::Vector3d>& vertices)
+    {
+        std::ifstream file(file_name, std::ios::binary);
+        if (!file)
+            return false;
+        std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+        vertices.clear();
+        // Binary: 80 bytes of header, the number of triangles, then 50 bytes per triangle (normal, 3 vertices, attribute)
+        if (content.size() >= 84) {
+            uint32_t triangles;
+            std::memcpy(&triangles, content.data() + 80, sizeof(triangles));
+            if (content.size() == 84 + 50 * static_cast<size_t>(triangles)) {
+                vertices.reserve(3 * triangles);
+                for (size_t t = 0; t < triangles; t++) {
+                    for (int v = 0; v < 3; v++) {
+                        float xyz[3];
+                        std::memcpy(xyz, content.data() + 84 + 50 * t + 12 * (v + 1), sizeof(xyz));
+                        vertices.emplace_back(xyz[0], xyz[1], xyz[2]);
+                    }
+                }
+                return true;
+            }
+        }
+
+        // ASCII: "vertex x y z" lines
+        std::istringstream stream(content);
+        std::string word;
+        while (stream >> word) {
+            if (word != "vertex")
+                continue;
+            Eigen::Vector3d v;
+            if (!(stream >> v(0) >> v(1) >> v(2)))
+                return false;
+            vertices.push_back(v);
+        }
+        return !vertices.empty();
+    }
+
+    double segment_distance(const Eigen::Vector3d& a0, const Eigen::Vector3d& a1, const Eigen::Vector3d& b0, const Eigen::Vector3d& b1, Eigen::Vector3d& pa, Eigen::Vector3d& pb)
+    {
+        // Closest points of two segments (Ericson, Real-Time Collision Detection, 5.1.9)
+        const double eps = 1e-12;
+        Eigen::Vector3d d1 = a1 - a0, d2 = b1 - b0, r = a0 - b0;
+        double a = d1.squaredNorm(), e = d2.squaredNorm(), f = d2.dot(r);
+        double s, t;
+
+        if (a <= eps && e <= eps) {
+            s = t = 0.;
+        }
+        else if (a <= eps) {
+            s = 0.;
+            t = std::min(std::max(f / e, 0.), 1.);
+        }
+        else {
+            double c = d1.dot(r);
+            if (e <= eps) {
+                t = 0.;
+                s = std::min(std::max(-c / a, 0.), 1.);
+            }
+            else {
+                double b = d1.dot(d2), denom = a * e - b * b;
+                s = (denom > eps) ? std::min(std::max((b * f - c * e) / denom, 0.), 1.) : 0.;
+                t = (b * s + f) / e;
+                if (t < 0.) {
+                    t = 0.;
+                    s = std::min(std::max(-c / a, 0.), 1.);
+                }
+                else if (t > 1.) {
+                    t = 1.;
+                    s = std::min(std::max((b - c) / a, 0.), 1.);
+                }
+            }
+        }
+
+        pa = a0 + s * d1;
+        pb = b0 + t * d2;
+        return (pa - pb).norm();
+    }
+
+    bool load_collision_settings(const ros::NodeHandle& nh, const std::string& ns, CollisionSettings& settings)
+    {
+        ParamTree params;
+        params.load(nh, ns);
+        return load_collision_settings(params, settings);
+    }
+
+    bool load_collision_settings(const ParamTree& params, CollisionSettings& settings)
+    {
+        params.param<std::string>("mesh_suffix", settings.mesh_suffix, "_s");
+        params.param<double>("padding", settings.padding, 0.);
+        params.param<bool>("self_collision", settings.self_collision, true);
+
+        try {
+            settings.allowed_pairs.clear();
+            if (params.has("allowed_pairs")) {
+                XmlRpc::XmlRpcValue& pairs = *params.value("allowed_pairs");
+                if (pairs.getType() != XmlRpc::XmlRpcValue::TypeArray)
+                    throw XmlRpc::XmlRpcException("allowed_pairs is not a list");
+                for (int i = 0; i < pairs.size(); i++) {
+                    if (pairs[i].getType() != XmlRpc::XmlRpcValue::TypeArray || pairs[i].size() != 2)
+                        throw XmlRpc::XmlRpcException("an allowed pair is not a list of two links");
+                    settings.allowed_pairs.push_back({static_cast<std::string>(pairs[i][0]), static_cast<std::string>(pairs[i][1])});
+                }
+            }
+
+            settings.zones.clear();
+            if (params.has("zones")) {
+                XmlRpc::XmlRpcValue& zones = *params.value("zones");
+                if (zones.getType() != XmlRpc::XmlRpcValue::TypeArray)
+                    throw XmlRpc::XmlRpcException("zones is not a list");
+                for (int i = 0; i < zones.size(); i++) {
+                    XmlRpc::XmlRpcValue& value = zones[i];
+                    if (value.getType() != XmlRpc::XmlRpcValue::TypeStruct || !value.hasMember("type"))
+                        throw XmlRpc::XmlRpcException("a zone has no type");
+
+                    KeepOutZone zone;
+                    zone.name = value.hasMember("name") ? static_cast<std::string>(value["name"]) : "zone_" + std::to_string(i);
+                    std::string type = value["type"];
+                    zone.capsule.radius = value.hasMember("radius") ? to_double(value["radius"]) : 0.;
+                    zone.normal = Eigen::Vector3d::UnitZ();
+                    zone.offset = 0.;
+                    if (type == "sphere") {
+                        zone.type = KeepOutZone::SPHERE;
+                        zone.capsule.a = zone.capsule.b = to_vector(value["center"]);
+                    }
+                    else if (type == "capsule") {
+                        zone.type = KeepOutZone::CAPSULE;
+                        zone.capsule.a = to_vector(value["a"]);
+                        zone.capsule.b = to_vector(value["b"]);
+                    }
+                    else if (type == "plane") {
+                        zone.type = KeepOutZone::PLANE;
+                        zone.normal = to_vector(value["normal"]).normalized();
+                        zone.offset = value.hasMember("offset") ? to_double(value["offset"]) : 0.;
+                    }
+                    else
+                        throw XmlRpc::XmlRpcException("unknown zone type '" + type + "'");
+                    settings.zones.push_back(zone);
+                }
+            }
+        }
+        catch (const XmlRpc::XmlRpcException& e) {
+            ROS_ERROR_STREAM("Invalid collision parameters: " << e.getMessage());
+            return false;
+        }
+
+        return true;
+    }
+} // namespace iiwa_tools
@@ -23,6 +23,9 @@
 //|    GNU General Public License for more details.
 //|
 #include <iiwa_tools/iiwa_service.h>
+#include <iiwa_tools/model_loader.h>
+
+#include <algorithm>
 
 namespace iiwa_tools {
     double get_multi_array(const std_msgs::Float64MultiArray& array, size_t i, size_t j)
@@ -41,11 +44,27 @@ namespace iiwa_tools {
         array.data[offset + i * array.layout.dim[0].stride + j] = val;
     }
 
+    // Row-major layout with the given sizes (the stride of the last dimension is 0, as above)
+    void init_multi_array(std_msgs::Float64MultiArray& array, const std::vector<size_t>& sizes)
+    {
+        array.layout.dim.resize(sizes.size());
+        array.layout.data_offset = 0;
+        size_t stride = 0;
+        for (size_t k = sizes.size(); k-- > 0;) {
+            array.layout.dim[k].size = sizes[k];
+            array.layout.dim[k].stride = stride;
+            stride = (stride > 0) ? stride * sizes[k] : sizes[k];
+        }
+        array.data.resize((sizes.size() > 0) ? array.layout.dim[0].size * std::max(array.layout.dim[0].stride, 1u) : 0);
+    }
+
     IiwaService::IiwaService(ros::NodeHandle nh) : _nh(nh)
     {
         ROS_INFO_STREAM("Starting Iiwa IK server..");
         _load_params();
-        init();
+        // Without a model there is nothing to serve (the node is shutting down)
+        if (!init())
+            return;
 
         _fk_server = _nh.advertiseService(_fk_service_name, &IiwaService::perform_fk, this);
         ROS_INFO_STREAM("Started Iiwa FK server..");
@@ -64,6 +83,26 @@ namespace iiwa_tools {
 
         _gravity_server = _nh.advertiseService(_gravity_service_name, &IiwaService::get_gravity, this);
         ROS_INFO_STREAM("Started Iiwa Gravity Compensation server..");
+
+        _jacobians_batch_server = _nh.advertiseService(_jacobians_batch_service_name, &IiwaService::get_jacobians_batch, this);
+        ROS_INFO_STREAM("Started Iiwa Batched Jacobians server..");
+
+        _gravity_batch_server = _nh.advertiseService(_gravity_batch_service_name, &IiwaService::get_gravity_batch, this);
+        ROS_INFO_STREAM("Started Iiwa Batched Gravity Compensation server..");
+
+        if (_collision_model.initialized()) {
+            _collisions_batch_server = _nh.advertiseService(_collisions_batch_service_name, &IiwaService::get_collisions_batch, this);
+            ROS_INFO_STREAM("Started Iiwa Batched Collisions server..");
+        }
+
+        if (_stream) {
+            _model_state_pub = _nh.advertise<iiwa_tools::RobotModelState>(_stream_output_topic, 1);
+            ros::TransportHints hints;
+            if (_stream_tcp_no_delay)
+                hints = hints.tcpNoDelay();
+            _joint_state_sub = _nh.subscribe(_stream_input_topic, 1, &IiwaService::_joint_state_cb, this, hints);
+            ROS_INFO_STREAM("Streaming the model state of " << _stream_input_topic << " to " << _stream_output_topic << "..");
+        }
     }
 
     bool IiwaService::perform_fk(iiwa_tools::GetFK::Request& request,
@@ -76,13 +115,13 @@ namespace iiwa_tools {
 
         response.poses.resize(request.joints.layout.dim[0].size);
 
-        for (size_t point = 0; point < request.joints.layout.dim[0].size; ++point) {
-            iiwa_tools::RobotState robot_state;
+        _pool->parallel_for(request.joints.layout.dim[0].size, [&](size_t point, size_t worker) {
+            iiwa_tools::RobotState& robot_state = _robot_states[worker];
             robot_state.position.resize(_n_joints);
             for (size_t i = 0; i < _n_joints; i++)
                 robot_state.position[i] = get_multi_array(request.joints, point, i);
 
-            iiwa_tools::EefState ee_state = _tools.perform_fk(robot_state);
+            const iiwa_tools::EefState& ee_state = _tools.perform_fk(*_contexts[worker], robot_state);
 
             response.poses[point].position.x = ee_state.translation(0);
             response.poses[point].position.y = ee_state.translation(1);
@@ -92,7 +131,7 @@ namespace iiwa_tools {
             response.poses[point].orientation.x = ee_state.orientation.x();
             response.poses[point].orientation.y = ee_state.orientation.y();
             response.poses[point].orientation.z = ee_state.orientation.z();
-        }
+        });
 
         return true;
     }
@@ -101,42 +140,38 @@ namespace iiwa_tools {
         iiwa_tools::GetIK::Response& response)
     {
         bool seeds_provided = request.seed_angles.layout.dim.size() == 2 && (request.seed_angles.layout.dim[0].size == request.poses.size());
-        // // copy RBDyn for thread-safety
-        // // TO-DO: Check if it takes time
-        // mc_rbdyn_urdf::URDFParserResult rbdyn_urdf = _rbdyn_urdf;
-
-        // double damp = 1e-3;
-        // Eigen::VectorXd damping = Eigen::VectorXd::Ones(_n_joints).array() * damp;
-        // if (request.damping.size() != _n_joints) {
-        //     ROS_WARN_STREAM("No damping parameters given. Using " << damping.transpose() << ".");
-        // }
-        // else {
-        //     for (size_t i = 0; i < _n_joints; i++) {
-        //         damping(i) = request.damping[i];
-        //     }
-        // }
-
-        // double slack = 10000.;
-        // Eigen::VectorXd slack_vec = Eigen::VectorXd::Ones(6).array() * slack;
-        // if (request.slack.size() != 6) {
-        //     ROS_WARN_STREAM("No slack parameters given. Using " << slack_vec.transpose() << ".");
-        // }
-        // else {
-        //     for (size_t i = 0; i < 6; i++) {
-        //         slack_vec(i) = request.slack[i];
-        //     }
-        // }
-
-        // int max_iterations = request.max_iterations;
-        // if (max_iterations <= 0) {
-        //     max_iterations = 50;
-        //     ROS_WARN_STREAM("No max iterations given. Using " << max_iterations << " iterations.");
-        // }
-        // double tolerance = request.tolerance;
-        // if (tolerance <= 0.) {
-        //     tolerance = 1e-5;
-        //     ROS_WARN_STREAM("No tolerance given. Using " << tolerance << ".");
-        // }
+
+        IkParams params;
+        if (request.damping.size() != _n_joints) {
+            ROS_WARN_STREAM_ONCE("No damping parameters given. Using the default ones.");
+        }
+        else {
+            params.damping = Eigen::VectorXd::Map(request.damping.data(), request.damping.size());
+        }
+
+        if (request.slack.size() != 6) {
+            ROS_WARN_STREAM_ONCE("No slack parameters given. Using the default ones.");
+        }
+        else {
+            params.slack = Eigen::VectorXd::Map(request.slack.data(), request.slack.size());
+        }
+
+        if (request.max_iterations <= 0) {
+            ROS_WARN_STREAM_ONCE("No max iterations given. Using " << params.max_iterations << " iterations.");
+        }
+        else {
+            params.max_iterations = request.max_iterations;
+        }
+
+        if (request.tolerance <= 0.) {
+            ROS_WARN_STREAM_ONCE("No tolerance given. Using " << params.tolerance << ".");
+        }
+        else {
+            params.tolerance = request.tolerance;
+        }
+
+        params.warm_start = _warm_start;
+        params.analytic = _analytic_ik;
 
         response.joints.layout.dim.resize(2);
         response.joints.layout.data_offset = 0;
@@ -145,36 +180,93 @@ namespace iiwa_tools {
         response.joints.layout.dim[1].size = _n_joints;
         response.joints.layout.dim[1].stride = 0;
         response.joints.data.resize(request.poses.size() * _n_joints);
+        response.is_valid.resize(request.poses.size());
+        response.accepted_tolerance.resize(request.poses.size());
 
-        for (size_t point = 0; point < request.poses.size(); ++point) {
-            iiwa_tools::RobotState seed_state;
-            if (seeds_provided) {
-                seed_state.position.resize(_n_joints);
-                for (size_t i = 0; i < _n_joints; i++) {
-                    seed_state.position(i) = get_multi_array(request.seed_angles, point, i);
-                }
-            }
-
+        auto get_pose = [&](size_t point) {
             iiwa_tools::EefState ee_state;
             ee_state.translation = {request.poses[point].position.x, request.poses[point].position.y, request.poses[point].position.z};
             ee_state.orientation = Eigen::Quaterniond(request.poses[point].orientation.w,
                 request.poses[point].orientation.x,
                 request.poses[point].orientation.y,
                 request.poses[point].orientation.z);
+            return ee_state;
+        };
 
-            Eigen::VectorXd q_best = _tools.perform_ik(ee_state, seed_state);
+        auto solve_pose = [&](size_t point, IiwaTools::Context& context, const iiwa_tools::EefState& ee_state, const iiwa_tools::RobotState& seed_state, const IkParams& pose_params) {
+            IkResult result = _tools.perform_ik(context, ee_state, seed_state, pose_params);
 
             for (size_t joint = 0; joint < _n_joints; ++joint) {
-                set_multi_array(response.joints, point, joint, q_best[joint]);
+                set_multi_array(response.joints, point, joint, result.joints[joint]);
+            }
+
+            response.is_valid[point] = result.is_valid;
+            response.accepted_tolerance[point] = result.error;
+
+            return result;
+        };
+
+        auto get_seed = [&](size_t point, iiwa_tools::RobotState& seed_state) {
+            seed_state.position.resize(_n_joints);
+            for (size_t i = 0; i < _n_joints; i++) {
+                seed_state.position(i) = get_multi_array(request.seed_angles, point, i);
             }
+        };
 
-            // TO-DO: Fix those
-            response.is_valid.push_back(true);
-            response.accepted_tolerance.push_back(1e-5);
-            // response.is_valid.push_back(iter < max_iterations);
-            // response.accepted_tolerance.push_back(best);
+        if (request.sequential) {
+            // A path: solve the poses in order, each one seeded by (and kept close to) the previous solution
+            params.seed_tolerance = _sequential_seed_tolerance;
+            params.continuity = _sequential_continuity;
+
+            iiwa_tools::RobotState seed_state;
+            if (seeds_provided)
+                get_seed(0, seed_state);
+
+            for (size_t point = 0; point < request.poses.size(); point++) {
+                iiwa_tools::EefState ee_state = get_pose(point);
+                IkResult result = solve_pose(point, *_contexts[0], ee_state, seed_state, params);
+                if (_ik_cache && result.is_valid)
+                    _ik_cache->insert(ee_state.translation, ee_state.orientation, IkCache::branch(seed_state.position), result.joints);
+                seed_state.position = result.joints;
+            }
+
+            _report_ik_cache();
+            return true;
         }
 
+        // The poses are independent: solve them in parallel, each worker with its own context
+        _pool->parallel_for(request.poses.size(), [&](size_t point, size_t worker) {
+            iiwa_tools::RobotState seed_state;
+            if (seeds_provided)
+                get_seed(point, seed_state);
+
+            iiwa_tools::EefState ee_state = get_pose(point);
+            if (!_ik_cache) {
+                solve_pose(point, *_contexts[worker], ee_state, seed_state, params);
+                return;
+            }
+
+            // The solution cached for this pose and branch is refined like a close seed (usually without any QP iteration).
+            // Without a seed, the closest cached pose gives one.
+            int branch = IkCache::branch(seed_state.position);
+            iiwa_tools::RobotState cached_state;
+            IkResult result;
+            result.is_valid = false;
+            bool cached = _ik_cache->find(ee_state.translation, ee_state.orientation, branch, cached_state.position);
+            if (cached || (!seeds_provided && _ik_cache->nearest(ee_state.translation, ee_state.orientation, cached_state.position))) {
+                IkParams cached_params = params;
+                cached_params.seed_tolerance = _ik_cache_seed_tolerance;
+                cached_params.analytic = params.analytic && !cached;
+                result = solve_pose(point, *_contexts[worker], ee_state, cached_state, cached_params);
+            }
+            if (!result.is_valid)
+                result = solve_pose(point, *_contexts[worker], ee_state, seed_state, params);
+
+            if (result.is_valid)
+                _ik_cache->insert(ee_state.translation, ee_state.orientation, branch, result.joints);
+        });
+
+        _report_ik_cache();
         return true;
     }
 
@@ -337,43 +429,308 @@ namespace iiwa_tools {
         return true;
     }
 
-    void IiwaService::_load_params()
+    bool IiwaService::get_jacobians_batch(iiwa_tools::GetJacobiansBatch::Request& request,
+        iiwa_tools::GetJacobiansBatch::Response& response)
     {
-        ros::NodeHandle n_p("~");
+        int n_configs = _batch_size(request.joint_angles, "joint_angles", false);
+        int n_velocities = _batch_size(request.joint_velocities, "joint_velocities", true);
+        if (n_configs < 0 || n_velocities < 0 || (n_velocities > 0 && n_velocities != n_configs))
+            return false;
 
-        n_p.param<std::string>("service/robot_description", _robot_description, "/robot_description");
-        n_p.param<std::string>("service/end_effector", _end_effector, "iiwa_link_ee");
-        n_p.param<std::string>("service/fk_service_name", _fk_service_name, "iiwa_fk_server");
-        n_p.param<std::string>("service/ik_service_name", _ik_service_name, "iiwa_ik_server");
-        n_p.param<std::string>("service/jacobian_service_name", _jacobian_service_name, "iiwa_jacobian_server");
-        n_p.param<std::string>("service/jacobian_deriv_service_name", _jacobian_deriv_service_name, "iiwa_jacobian_deriv_server");
-        n_p.param<std::string>("service/jacobians_service_name", _jacobians_service_name, "iiwa_jacobians_server");
-        n_p.param<std::string>("service/gravity_service_name", _gravity_service_name, "iiwa_gravity_server");
+        init_multi_array(response.jacobians, {static_cast<size_t>(n_configs), 6, _n_joints});
+        init_multi_array(response.jacobian_derivs, {static_cast<size_t>(n_configs), 6, _n_joints});
+
+        // Each result is written with one (row-major) copy into its slot of the response
+        typedef Eigen::Matrix<double, 6, Eigen::Dynamic, Eigen::RowMajor> RowMajorJacobian;
+        size_t jac_size = 6 * _n_joints;
+        _pool->parallel_for(n_configs, [&](size_t point, size_t worker) {
+            ModelState& model = _model_states[worker];
+            _tools.compute(*_contexts[worker], _batch_state(worker, request.joint_angles, request.joint_velocities, point), COMPUTE_JACOBIAN | COMPUTE_JACOBIAN_DERIV, model);
+
+            Eigen::Map<RowMajorJacobian>(response.jacobians.data.data() + point * jac_size, 6, _n_joints) = model.jacobian;
+            Eigen::Map<RowMajorJacobian>(response.jacobian_derivs.data.data() + point * jac_size, 6, _n_joints) = model.jacobian_deriv;
+        });
+
+        return true;
     }
 
-    void IiwaService::init()
+    bool IiwaService::get_gravity_batch(iiwa_tools::GetGravityBatch::Request& request,
+        iiwa_tools::GetGravityBatch::Response& response)
     {
-        // Get the URDF XML from the parameter server
-        std::string urdf_string;
+        int n_configs = _batch_size(request.joint_angles, "joint_angles", false);
+        int n_velocities = _batch_size(request.joint_velocities, "joint_velocities", true);
+        if (n_configs < 0 || n_velocities < 0 || (n_velocities > 0 && n_velocities != n_configs))
+            return false;
+
+        Eigen::Vector3d gravity(0., 0., -9.8);
+        if (request.gravity.size() != 3) {
+            ROS_WARN_STREAM_ONCE("Gravity not given. Assuming default [0, 0, -9.8]!");
+        }
+        else {
+            gravity = Eigen::Vector3d::Map(request.gravity.data());
+        }
+
+        init_multi_array(response.compensation_torques, {static_cast<size_t>(n_configs), _n_joints});
+
+        _pool->parallel_for(n_configs, [&](size_t point, size_t worker) {
+            ModelState& model = _model_states[worker];
+            _tools.compute(*_contexts[worker], _batch_state(worker, request.joint_angles, request.joint_velocities, point), COMPUTE_GRAVITY, model, gravity);
 
-        // search and wait for robot_description on param server
-        while (urdf_string.empty()) {
-            ROS_INFO_ONCE_NAMED("IiwaService", "IiwaService is waiting for model"
-                                               " URDF in parameter [%s] on the ROS param server.",
-                _robot_description.c_str());
+            Eigen::VectorXd::Map(response.compensation_torques.data.data() + point * _n_joints, _n_joints) = model.gravity;
+        });
 
-            _nh.getParam(_robot_description, urdf_string);
+        return true;
+    }
 
-            usleep(100000);
+    bool IiwaService::get_collisions_batch(iiwa_tools::GetCollisionsBatch::Request& request,
+        iiwa_tools::GetCollisionsBatch::Response& response)
+    {
+        int n_configs = _batch_size(request.joint_angles, "joint_angles", false);
+        if (n_configs < 0)
+            return false;
+
+        response.min_distances.resize(n_configs);
+        response.in_collision.resize(n_configs);
+        response.closest_pairs.resize(n_configs);
+
+        std_msgs::Float64MultiArray no_velocities;
+        _pool->parallel_for(n_configs, [&](size_t point, size_t worker) {
+            CollisionModel::Workspace& ws = *_collision_workspaces[worker];
+            double distance = _collision_model.compute(_tools.body_poses(*_contexts[worker], _batch_state(worker, request.joint_angles, no_velocities, point)), ws);
+
+            response.min_distances[point] = distance;
+            response.in_collision[point] = (distance < _collision_margin);
+            response.closest_pairs[point] = (ws.closest >= 0) ? _collision_model.name(ws.pairs[ws.closest]) : "";
+        });
+
+        return true;
+    }
+
+    int IiwaService::_batch_size(const std_msgs::Float64MultiArray& array, const std::string& name, bool optional)
+    {
+        if (optional && array.layout.dim.empty() && array.data.empty())
+            return 0;
+
+        if (array.layout.dim.size() != 2 || array.layout.dim[1].size != _n_joints || array.layout.dim[0].stride < _n_joints) {
+            ROS_ERROR_STREAM("Request " << name << " not properly defined (expected N x " << _n_joints << ").");
+            return -1;
+        }
+
+        size_t rows = array.layout.dim[0].size;
+        if (rows > 0 && array.data.size() < array.layout.data_offset + (rows - 1) * array.layout.dim[0].stride + _n_joints) {
+            ROS_ERROR_STREAM("Request " << name << " has less data than its layout.");
+            return -1;
+        }
+
+        return rows;
+    }
+
+    RobotState& IiwaService::_batch_state(size_t worker, const std_msgs::Float64MultiArray& positions, const std_msgs::Float64MultiArray& velocities, size_t i)
+    {
+        RobotState& robot_state = _robot_states[worker];
+
+        robot_state.position = Eigen::VectorXd::Map(positions.data.data() + positions.layout.data_offset + i * positions.layout.dim[0].stride, _n_joints);
+        if (velocities.data.empty())
+            robot_state.velocity.resize(0);
+        else
+            robot_state.velocity = Eigen::VectorXd::Map(velocities.data.data() + velocities.layout.data_offset + i * velocities.layout.dim[0].stride, _n_joints);
+
+        return robot_state;
+    }
+
+    void IiwaService::_joint_state_cb(const sensor_msgs::JointState::ConstPtr& msg)
+    {
+        if (!_update_joint_map(*msg)) {
+            ROS_WARN_STREAM_THROTTLE(1., "The joint states on " << _stream_input_topic << " do not contain all the joints of the robot!");
+            return;
+        }
+
+        bool velocities = (msg->velocity.size() == msg->position.size());
+        _stream_robot_state.position.resize(_n_joints);
+        _stream_robot_state.velocity.setZero(_n_joints);
+        for (size_t i = 0; i < _n_joints; i++) {
+            _stream_robot_state.position[i] = msg->position[_joint_map[i]];
+            if (velocities)
+                _stream_robot_state.velocity[i] = msg->velocity[_joint_map[i]];
+        }
+
+        // One pass for all the published quantities
+        _tools.compute(*_stream_context, _stream_robot_state, COMPUTE_FK | COMPUTE_JACOBIAN | COMPUTE_GRAVITY, _stream_model_state, _stream_gravity);
+
+        _model_state_msg.header = msg->header;
+        Eigen::VectorXd::Map(_model_state_msg.joint_angles.data(), _n_joints) = _stream_robot_state.position;
+        Eigen::VectorXd::Map(_model_state_msg.joint_velocities.data(), _n_joints) = _stream_robot_state.velocity;
+
+        const EefState& ee_state = _stream_model_state.ee_state;
+        _model_state_msg.pose.position.x = ee_state.translation(0);
+        _model_state_msg.pose.position.y = ee_state.translation(1);
+        _model_state_msg.pose.position.z = ee_state.translation(2);
+        _model_state_msg.pose.orientation.w = ee_state.orientation.w();
+        _model_state_msg.pose.orientation.x = ee_state.orientation.x();
+        _model_state_msg.pose.orientation.y = ee_state.orientation.y();
+        _model_state_msg.pose.orientation.z = ee_state.orientation.z();
+
+        Eigen::Map<Eigen::Matrix<double, 6, Eigen::Dynamic, Eigen::RowMajor>>(_model_state_msg.jacobian.data.data(), 6, _n_joints) = _stream_model_state.jacobian;
+        Eigen::VectorXd::Map(_model_state_msg.compensation_torques.data(), _n_joints) = _stream_model_state.gravity;
+
+        _model_state_pub.publish(_model_state_msg);
+    }
+
+    bool IiwaService::_update_joint_map(const sensor_msgs::JointState& msg)
+    {
+        // Without names, the joint states are in the order of the robot
+        if (msg.name.empty()) {
+            for (size_t i = 0; i < _n_joints; i++)
+                _joint_map[i] = i;
+            return msg.position.size() >= _n_joints;
+        }
+
+        // The map is only searched again when the message layout changes
+        bool valid = true;
+        for (size_t i = 0; i < _n_joints && valid; i++)
+            valid = (_joint_map[i] < msg.name.size() && _joint_map[i] < msg.position.size() && msg.name[_joint_map[i]] == _joint_names[i]);
+        if (valid)
+            return true;
+
+        for (size_t i = 0; i < _n_joints; i++) {
+            auto it = std::find(msg.name.begin(), msg.name.end(), _joint_names[i]);
+            if (it == msg.name.end() || static_cast<size_t>(it - msg.name.begin()) >= msg.position.size())
+                return false;
+            _joint_map[i] = it - msg.name.begin();
+        }
+
+        return true;
+    }
+
+    void IiwaService::_load_params()
+    {
+        ros::NodeHandle n_p("~");
+
+        // All the settings in one round trip to the parameter server
+        ParamTree params;
+        params.load(n_p, "service");
+
+        params.param<std::string>("robot_description", _robot_description, "/robot_description");
+        params.param<std::string>("end_effector", _end_effector, "iiwa_link_ee");
+        params.param<std::string>("fk_service_name", _fk_service_name, "iiwa_fk_server");
+        params.param<std::string>("ik_service_name", _ik_service_name, "iiwa_ik_server");
+        params.param<std::string>("jacobian_service_name", _jacobian_service_name, "iiwa_jacobian_server");
+        params.param<std::string>("jacobian_deriv_service_name", _jacobian_deriv_service_name, "iiwa_jacobian_deriv_server");
+        params.param<std::string>("jacobians_service_name", _jacobians_service_name, "iiwa_jacobians_server");
+        params.param<std::string>("gravity_service_name", _gravity_service_name, "iiwa_gravity_server");
+        params.param<std::string>("jacobians_batch_service_name", _jacobians_batch_service_name, "iiwa_jacobians_batch_server");
+        params.param<std::string>("gravity_batch_service_name", _gravity_batch_service_name, "iiwa_gravity_batch_server");
+        params.param<std::string>("collisions_batch_service_name", _collisions_batch_service_name, "iiwa_collisions_batch_server");
+        params.param<int>("num_threads", _num_threads, 0);
+        params.param<bool>("warm_start", _warm_start, true);
+        params.param<bool>("analytic_model", _analytic_model, false);
+        params.param<bool>("analytic_ik", _analytic_ik, false);
+        params.param<bool>("collision/enabled", _collision, true);
+        params.param<double>("collision/margin", _collision_margin, 0.);
+        if (_collision && !load_collision_settings(params.subtree("collision"), _collision_settings))
+            _collision = false;
+        params.param<bool>("ik_cache/enabled", _ik_cache_enabled, false);
+        double memory_limit;
+        params.param<double>("ik_cache/memory_limit", memory_limit, 16.);
+        _ik_cache_settings.memory_limit = static_cast<size_t>(std::max(0., memory_limit) * (1 << 20));
+        params.param<double>("ik_cache/position_resolution", _ik_cache_settings.position_resolution, 1e-3);
+        params.param<double>("ik_cache/orientation_resolution", _ik_cache_settings.orientation_resolution, 1e-3);
+        params.param<double>("ik_cache/orientation_weight", _ik_cache_settings.orientation_weight, 0.5);
+        params.param<double>("ik_cache/max_seed_distance", _ik_cache_settings.max_seed_distance, 0.1);
+        params.param<double>("ik_cache/seed_tolerance", _ik_cache_seed_tolerance, 1e-2);
+        params.param<double>("ik_cache/statistics_period", _ik_cache_statistics_period, 60.);
+        params.param<double>("sequential/seed_tolerance", _sequential_seed_tolerance, 1e-2);
+        params.param<double>("sequential/continuity", _sequential_continuity, 1e-2);
+        params.param<bool>("stream/enabled", _stream, false);
+        params.param<std::string>("stream/input_topic", _stream_input_topic, "joint_states");
+        params.param<std::string>("stream/output_topic", _stream_output_topic, "model_state");
+        params.param<bool>("stream/tcp_no_delay", _stream_tcp_no_delay, true);
+        std::vector<double> gravity;
+        params.param<std::vector<double>>("stream/gravity", gravity, std::vector<double>{0., 0., -9.8});
+        if (gravity.size() == 3) {
+            _stream_gravity = Eigen::Vector3d::Map(gravity.data());
+        }
+        else {
+            ROS_WARN_STREAM("service/stream/gravity should have 3 elements. Assuming default [0, 0, -9.8]!");
+            _stream_gravity = Eigen::Vector3d(0., 0., -9.8);
+        }
+    }
+
+    void IiwaService::_report_ik_cache()
+    {
+        if (!_ik_cache || _ik_cache_statistics_period <= 0.)
+            return;
+
+        ros::WallTime now = ros::WallTime::now();
+        if ((now - _ik_cache_report_time).toSec() < _ik_cache_statistics_period)
+            return;
+        _ik_cache_report_time = now;
+
+        IkCacheStatistics statistics = _ik_cache->statistics();
+        size_t lookups = statistics.hits + statistics.misses;
+        ROS_INFO_STREAM_NAMED("IiwaService", "IK cache: " << statistics.hits << " hits, " << statistics.misses << " misses ("
+                                                          << (lookups ? 100. * statistics.hits / lookups : 0.) << "% hit rate), "
+                                                          << statistics.seeds << " seeded from the index, "
+                                                          << statistics.size << "/" << statistics.capacity << " entries, "
+                                                          << statistics.evictions << " evictions");
+    }
+
+    bool IiwaService::init()
+    {
+        // Get the URDF from the parameter server (waits for it, parsed once per process)
+        std::shared_ptr<const mc_rbdyn_urdf::URDFParserResult> rbdyn_urdf = ModelLoader::instance().rbdyn_model(_nh, _robot_description);
+        if (!rbdyn_urdf) {
+            ROS_FATAL_STREAM_NAMED("IiwaService", "Could not load the URDF from [" << _robot_description << "]");
+            ros::shutdown();
+            return false;
         }
-        ROS_INFO_STREAM_NAMED("IiwaService", "Received urdf from param server, parsing...");
 
         // Initialize iiwa tools
-        _tools.init_rbdyn(urdf_string, _end_effector);
+        _tools.init_rbdyn(*rbdyn_urdf, _end_effector, _analytic_model);
 
         // Number of joints
         _n_joints = _tools.get_indices().size();
 
         ROS_INFO_STREAM_NAMED("IiwaService", "Number of joints found: " << _n_joints);
+
+        // Workers of the batched requests, with one context each
+        size_t num_threads = (_num_threads > 0) ? _num_threads : std::max(1u, std::thread::hardware_concurrency());
+        _pool.reset(new ThreadPool(num_threads));
+        _contexts.clear();
+        for (size_t i = 0; i < _pool->size(); i++)
+            _contexts.push_back(_tools.create_context());
+        _robot_states.resize(_pool->size());
+        _model_states.resize(_pool->size());
+
+        ROS_INFO_STREAM_NAMED("IiwaService", "Using " << _pool->size() << " thread(s) for the batched requests");
+
+        // Collision model, from the capsules of the collision meshes
+        if (_collision) {
+            if (_collision_model.init(_tools.get_multibody(), _tools.get_indices(), ModelLoader::instance().urdf_string(_nh, _robot_description), _collision_settings)) {
+                _collision_workspaces.clear();
+                for (size_t i = 0; i < _pool->size(); i++)
+                    _collision_workspaces.push_back(_collision_model.create_workspace());
+            }
+            else
+                ROS_WARN_STREAM_NAMED("IiwaService", "No collision model, the collisions service is not available.");
+        }
+
+        // Cache of the IK solutions
+        if (_ik_cache_enabled) {
+            _ik_cache.reset(new IkCache(_n_joints, _ik_cache_settings));
+            _ik_cache_report_time = ros::WallTime::now();
+            ROS_INFO_STREAM_NAMED("IiwaService", "IK cache of " << _ik_cache->statistics().capacity << " solutions");
+        }
+
+        // Streaming mode
+        _joint_names = _tools.get_joint_names();
+        _joint_map.assign(_n_joints, _n_joints);
+        _stream_context = _tools.create_context();
+        _model_state_msg.joint_angles.resize(_n_joints);
+        _model_state_msg.joint_velocities.resize(_n_joints);
+        init_multi_array(_model_state_msg.jacobian, {6, _n_joints});
+        _model_state_msg.compensation_torques.resize(_n_joints);
+
+        return true;
     }
 } // namespace iiwa_tools
\ No newline at end of file
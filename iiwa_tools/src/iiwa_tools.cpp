@@ -24,6 +24,10 @@
 //|
 #include <iiwa_tools/iiwa_tools.h>
 
+// std headers
+#include <algorithm>
+#include <cmath>
+
 // RBDyn headers
 #include <RBDyn/FD.h>
 #include <RBDyn/FK.h>
@@ -52,75 +56,107 @@ namespace iiwa_tools {
         return wrapped;
     }
 
-    iiwa_tools::EefState IiwaTools::perform_fk(const RobotState& robot_state)
+    IiwaTools::Context::Context(const rbd::MultiBody& mb, size_t ef_index)
+        : mbc(mb), jac(mb, mb.body(ef_index).name()), fd(mb), ik(mb, ef_index), ik_solver(new iiwa_ik_cvxgen::Solver), ik_solved(false), gravity(Eigen::VectorXd::Zero(mb.nrDof()))
     {
-        // copy RBDyn for thread-safety
-        // TO-DO: Check if it takes time
-        mc_rbdyn_urdf::URDFParserResult rbdyn_urdf = _rbdyn_urdf;
+        ik_solver->set_defaults();
+        ik_solver->setup_indexing();
+        ik_solver->settings.verbose = 0;
+        ik_solver->settings.resid_tol = 1e-10;
+        ik_solver->settings.eps = 1e-10;
+        ik_solver->settings.max_iters = 100;
+        // floor of the slacks and multipliers of a warm start (better_start does not use them)
+        ik_solver->settings.s_init = 1e-2;
+        ik_solver->settings.z_init = 1e-2;
+    }
 
-        Eigen::VectorXd q_low = Eigen::VectorXd::Ones(_rbd_indices.size());
-        Eigen::VectorXd q_high = q_low;
+    IiwaTools::Context::~Context() {}
 
-        for (size_t i = 0; i < _rbd_indices.size(); i++) {
-            size_t index = _rbd_indices[i];
-            q_low(i) = rbdyn_urdf.limits.lower[rbdyn_urdf.mb.joint(index).name()][0];
-            q_high(i) = rbdyn_urdf.limits.upper[rbdyn_urdf.mb.joint(index).name()][0];
+    std::unique_ptr<IiwaTools::Context> IiwaTools::create_context() const
+    {
+        std::unique_ptr<Context> context(new Context(_rbdyn_urdf.mb, _ef_index));
+        if (_chain) {
+            context->chain.reset(new SerialChain<7>::Workspace);
+            context->jacobian.setZero(6, 7);
+            context->jacobian_deriv.setZero(6, 7);
         }
+        return context;
+    }
 
-        rbdyn_urdf.mbc.zero(rbdyn_urdf.mb);
-
-        for (size_t i = 0; i < _rbd_indices.size(); i++) {
-            size_t rbd_index = _rbd_indices[i];
-            double jt = robot_state.position[i];
-            // wrap in [-pi,pi]
-            jt = wrap_angle(jt);
-            // enforce limits
-            if (jt < q_low(i))
-                jt = q_low(i);
-            if (jt > q_high(i))
-                jt = q_high(i);
-
-            rbdyn_urdf.mbc.q[rbd_index][0] = jt;
+    const iiwa_tools::EefState& IiwaTools::perform_fk(Context& context, const RobotState& robot_state) const
+    {
+        if (_chain) {
+            SerialChain<7>::Workspace& ws = *context.chain;
+            for (size_t i = 0; i < 7; i++)
+                ws.q[i] = _joint_in_limits(i, robot_state.position[i]);
+            _chain->forward_kinematics(ws);
+
+            context.ee_state.translation = ws.ee_position;
+            context.ee_state.orientation = Eigen::Quaterniond(ws.ee_rotation).normalized();
+            return context.ee_state;
         }
 
-        rbd::forwardKinematics(rbdyn_urdf.mb, rbdyn_urdf.mbc);
+        const rbd::MultiBody& mb = _rbdyn_urdf.mb;
+        rbd::MultiBodyConfig& mbc = context.mbc;
+
+        _reset_config(mbc);
+
+        for (size_t i = 0; i < _rbd_indices.size(); i++)
+            mbc.q[_rbd_indices[i]][0] = _joint_in_limits(i, robot_state.position[i]);
 
-        sva::PTransformd tf = rbdyn_urdf.mbc.bodyPosW[_ef_index];
+        rbd::forwardKinematics(mb, mbc);
 
-        Eigen::Matrix4d eig_tf = sva::conversions::toHomogeneous(tf);
-        Eigen::Vector3d trans = eig_tf.col(3).head(3);
-        Eigen::Matrix3d rot_mat = eig_tf.block(0, 0, 3, 3);
-        Eigen::Quaterniond quat = Eigen::Quaterniond(rot_mat).normalized();
+        _get_ee_state(mbc, context.ee_state);
 
-        return {trans, quat};
+        return context.ee_state;
     }
 
-    Eigen::VectorXd IiwaTools::perform_ik(const EefState& ee_state, const RobotState& seed_state)
+    const std::vector<sva::PTransformd>& IiwaTools::body_poses(Context& context, const RobotState& robot_state) const
     {
-        // copy RBDyn for thread-safety
-        // TO-DO: Check if it takes time
-        mc_rbdyn_urdf::URDFParserResult rbdyn_urdf = _rbdyn_urdf;
+        const rbd::MultiBody& mb = _rbdyn_urdf.mb;
+        rbd::MultiBodyConfig& mbc = context.mbc;
 
-        // TO-DO: Get this from parameters?
-        double damp = 1e-3;
-        Eigen::VectorXd damping = Eigen::VectorXd::Ones(_rbd_indices.size()).array() * damp;
+        _reset_config(mbc);
 
-        double slack = 10000.;
-        Eigen::VectorXd slack_vec = Eigen::VectorXd::Ones(6).array() * slack;
+        for (size_t i = 0; i < _rbd_indices.size(); i++)
+            mbc.q[_rbd_indices[i]][0] = _joint_in_limits(i, robot_state.position[i]);
 
-        int max_iterations = 50;
-        double tolerance = 1e-5;
-        // End TO-DO
+        rbd::forwardKinematics(mb, mbc);
 
-        Eigen::VectorXd zero = Eigen::VectorXd::Zero(_rbd_indices.size());
-        Eigen::VectorXd q_low = Eigen::VectorXd::Ones(_rbd_indices.size());
-        Eigen::VectorXd q_high = q_low;
+        return mbc.bodyPosW;
+    }
 
-        for (size_t i = 0; i < _rbd_indices.size(); i++) {
-            size_t index = _rbd_indices[i];
-            q_low(i) = rbdyn_urdf.limits.lower[rbdyn_urdf.mb.joint(index).name()][0];
-            q_high(i) = rbdyn_urdf.limits.upper[rbdyn_urdf.mb.joint(index).name()][0];
-        }
+    Eigen::VectorXd IiwaTools::perform_ik(Context& context, const EefState& ee_state, const RobotState& seed_state) const
+    {
+        return perform_ik(context, ee_state, seed_state, IkParams()).joints;
+    }
+
+    IkResult IiwaTools::perform_ik(Context& context, const EefState& ee_state, const RobotState& seed_state, const IkParams& params) const
+    {
+        IkResult analytic_result;
+        if (params.analytic && _analytic_ik && _analytic_solution(context, ee_state, seed_state, params, analytic_result))
+            return analytic_result;
+
+        const rbd::MultiBody& mb = _rbdyn_urdf.mb;
+        rbd::MultiBodyConfig& mbc = context.mbc;
+        iiwa_ik_cvxgen::Solver& ik_solver = *context.ik_solver;
+        size_t n = _rbd_indices.size();
+
+        // QP parameters that are the same for all the iterations
+        Eigen::Map<Eigen::VectorXd> damping(ik_solver.params.damping, n);
+        if (static_cast<size_t>(params.damping.size()) == n)
+            damping = params.damping;
+        else
+            damping.setConstant(1e-3);
+
+        Eigen::Map<Eigen::VectorXd> slack_vec(ik_solver.params.slack, 6);
+        if (params.slack.size() == 6)
+            slack_vec = params.slack;
+        else
+            slack_vec.setConstant(10000.);
+
+        int max_iterations = (params.max_iterations > 0) ? params.max_iterations : 50;
+        double tolerance = (params.tolerance > 0.) ? params.tolerance : 1e-5;
 
         Eigen::Matrix4d tf = Eigen::Matrix4d::Identity();
         tf.col(3).head(3) << ee_state.translation;
@@ -132,62 +168,58 @@ namespace iiwa_tools {
 
         Eigen::VectorXd qref = Eigen::VectorXd::Zero(_rbd_indices.size());
 
-        rbdyn_urdf.mbc.zero(rbdyn_urdf.mb);
+        _reset_config(mbc);
         bool seeds_provided = (seed_state.position.size() == _rbd_indices.size());
         if (seeds_provided) {
             for (size_t i = 0; i < _rbd_indices.size(); i++) {
-                size_t rbd_index = _rbd_indices[i];
-                // wrap in [-pi,pi]
-                double seed = wrap_angle(seed_state.position[i]);
-                // enforce limits
-                if (seed < q_low(i))
-                    seed = q_low(i);
-                if (seed > q_high(i))
-                    seed = q_high(i);
-
-                rbdyn_urdf.mbc.q[rbd_index][0] = seed;
+                double seed = _joint_in_limits(i, seed_state.position[i]);
+                mbc.q[_rbd_indices[i]][0] = seed;
                 qref(i) = seed;
             }
         }
 
+        // A seed that already is close to the target (e.g. the previous pose of a path) is refined directly
+        bool seed_close = false;
+        if (seeds_provided && params.seed_tolerance > 0.) {
+            rbd::forwardKinematics(mb, mbc);
+            seed_close = (_pose_error(mbc, target_tf).norm() < params.seed_tolerance);
+        }
+
         // Solve IK with traditional approach and pass it as a seed if successful
-        bool valid = _ik->inverseKinematics(rbdyn_urdf.mb, rbdyn_urdf.mbc, target_tf);
+        bool valid = false;
+        if (seed_close)
+            ROS_DEBUG_STREAM("Seed close to the target, skipping RBDyn: " << qref.transpose());
+        else
+            valid = context.ik.inverseKinematics(mb, mbc, target_tf);
         if (valid) {
-            for (size_t i = 0; i < _rbd_indices.size(); i++) {
-                size_t rbd_index = _rbd_indices[i];
-
-                // wrap in [-pi,pi]
-                qref(i) = wrap_angle(rbdyn_urdf.mbc.q[rbd_index][0]);
-
-                // enforce limits
-                if (qref(i) < q_low(i))
-                    qref(i) = q_low(i);
-                if (qref(i) > q_high(i))
-                    qref(i) = q_high(i);
-            }
+            for (size_t i = 0; i < _rbd_indices.size(); i++)
+                qref(i) = _joint_in_limits(i, mbc.q[_rbd_indices[i]][0]);
             ROS_DEBUG_STREAM("Using seed from RBDyn: " << qref.transpose());
         }
         else {
             if (seeds_provided) {
                 for (size_t i = 0; i < _rbd_indices.size(); i++) {
-                    size_t rbd_index = _rbd_indices[i];
-                    // wrap in [-pi,pi]
-                    double seed = wrap_angle(seed_state.position[i]);
-                    // enforce limits
-                    if (seed < q_low(i))
-                        seed = q_low(i);
-                    if (seed > q_high(i))
-                        seed = q_high(i);
-
-                    rbdyn_urdf.mbc.q[rbd_index][0] = seed;
+                    double seed = _joint_in_limits(i, seed_state.position[i]);
+                    mbc.q[_rbd_indices[i]][0] = seed;
                     qref(i) = seed;
                 }
             }
             else
-                rbdyn_urdf.mbc.zero(rbdyn_urdf.mb);
+                _reset_config(mbc);
         }
 
-        rbd::Jacobian jac(rbdyn_urdf.mb, rbdyn_urdf.mb.body(_ef_index).name());
+        // Joint continuity: damping * dq^2 + continuity * (q + dq - q_seed)^2 is, up to a constant,
+        // w * (qref + dq)^2 with w = damping + continuity and qref = continuity / w * (q - q_seed)
+        bool continuity = (seeds_provided && params.continuity > 0.);
+        Eigen::VectorXd q_seed, continuity_ratio;
+        if (continuity) {
+            q_seed.resize(n);
+            for (size_t i = 0; i < n; i++)
+                q_seed(i) = _joint_in_limits(i, seed_state.position[i]);
+            continuity_ratio = params.continuity * (damping.array() + params.continuity).inverse();
+            damping.array() += params.continuity;
+        }
+        Eigen::Map<Eigen::VectorXd> qref_param(ik_solver.params.qref, n);
 
         double best = std::numeric_limits<double>::max();
         Eigen::VectorXd q_best = qref;
@@ -195,12 +227,10 @@ namespace iiwa_tools {
         int iter = 0;
         double error = 0.;
         for (iter = 0; iter < max_iterations; iter++) {
-            rbd::forwardKinematics(rbdyn_urdf.mb, rbdyn_urdf.mbc);
-            rbd::forwardVelocity(rbdyn_urdf.mb, rbdyn_urdf.mbc);
+            rbd::forwardKinematics(mb, mbc);
+            rbd::forwardVelocity(mb, mbc);
 
-            Eigen::Vector3d rotErr = sva::rotationError(rbdyn_urdf.mbc.bodyPosW[_ef_index].rotation(), target_tf.rotation());
-            Eigen::Vector6d v;
-            v << rotErr, target_tf.translation() - rbdyn_urdf.mbc.bodyPosW[_ef_index].translation();
+            Eigen::Vector6d v = _pose_error(mbc, target_tf);
 
             error = v.norm();
 
@@ -212,36 +242,26 @@ namespace iiwa_tools {
             if (error < tolerance)
                 break;
 
-            Eigen::MatrixXd jac_mat = jac.jacobian(rbdyn_urdf.mb, rbdyn_urdf.mbc);
-
-            iiwa_ik_cvxgen::Solver ik_solver;
-
-            ik_solver.set_defaults();
-            ik_solver.setup_indexing();
-            ik_solver.settings.verbose = 0;
-            ik_solver.settings.resid_tol = 1e-10;
-            ik_solver.settings.eps = 1e-10;
-            ik_solver.settings.max_iters = 100;
+            const Eigen::MatrixXd& jac_mat = context.jac.jacobian(mb, mbc);
 
             // set params
-            for (int r = 0; r < 6; r++) {
-                for (int c = 0; c < _rbd_indices.size(); c++) {
-                    ik_solver.params.J[r + 1][c] = jac_mat(r, c);
-                }
-            }
+            for (int r = 0; r < 6; r++)
+                Eigen::Map<Eigen::RowVectorXd>(ik_solver.params.J[r + 1], n) = jac_mat.row(r);
+
+            if (continuity)
+                qref_param = continuity_ratio.cwiseProduct(qref - q_seed);
+            else
+                qref_param.setZero(); // we set qref to zero so that we minimize the dq
 
             // adapt the limits
-            Eigen::VectorXd qlow = q_low - qref;
-            Eigen::VectorXd qhigh = q_high - qref;
-
-            memcpy(ik_solver.params.damping, damping.data(), _rbd_indices.size() * sizeof(double));
-            memcpy(ik_solver.params.slack, slack_vec.data(), 6 * sizeof(double));
-            memcpy(ik_solver.params.qref, zero.data(), _rbd_indices.size() * sizeof(double)); // we set qref to zero so that we minimize the dq
-            memcpy(ik_solver.params.qlow, qlow.data(), _rbd_indices.size() * sizeof(double));
-            memcpy(ik_solver.params.qup, qhigh.data(), _rbd_indices.size() * sizeof(double));
+            Eigen::Map<Eigen::VectorXd>(ik_solver.params.qlow, n) = _q_low - qref + qref_param;
+            Eigen::Map<Eigen::VectorXd>(ik_solver.params.qup, n) = _q_high - qref + qref_param;
             memcpy(ik_solver.params.dx, v.data(), 6 * sizeof(double));
 
+            // the previous QP (last iteration or last pose) is close to this one
+            ik_solver.settings.warm_start = (params.warm_start && context.ik_solved) ? 1 : 0;
             ik_solver.solve();
+            context.ik_solved = true;
 
             Eigen::VectorXd q_prev = qref;
 
@@ -251,103 +271,242 @@ namespace iiwa_tools {
 
             for (size_t j = 0; j < _rbd_indices.size(); j++) {
                 size_t rbd_index = _rbd_indices[j];
-                rbdyn_urdf.mbc.q[rbd_index][0] = qref(j);
+                mbc.q[rbd_index][0] = qref(j);
             }
 
             if ((q_prev - qref).norm() < 1e-8)
                 break;
         }
 
-        return q_best;
+        IkResult result;
+        result.joints = q_best;
+        result.error = best;
+        result.iterations = iter;
+        result.is_valid = (best < tolerance);
+
+        return result;
     }
 
-    Eigen::VectorXd IiwaTools::gravity(const std::vector<double>& gravity, const RobotState& robot_state)
+    const Eigen::VectorXd& IiwaTools::gravity(Context& context, const std::vector<double>& gravity, const RobotState& robot_state) const
     {
-        // copy RBDyn for thread-safety
-        // TO-DO: Check if it takes time
-        mc_rbdyn_urdf::URDFParserResult rbdyn_urdf = _rbdyn_urdf;
+        if (_chain) {
+            SerialChain<7>::Workspace& ws = *context.chain;
+            _update_chain_state(ws, robot_state);
+            _chain->forward_kinematics(ws);
+            _chain->inverse_dynamics(Eigen::Vector3d(gravity[0], gravity[1], gravity[2]), ws);
+            context.gravity = -ws.tau;
+            return context.gravity;
+        }
 
-        rbdyn_urdf.mbc.zero(rbdyn_urdf.mb);
-        rbdyn_urdf.mbc.gravity = {gravity[0], gravity[1], gravity[2]};
+        const rbd::MultiBody& mb = _rbdyn_urdf.mb;
+        rbd::MultiBodyConfig& mbc = context.mbc;
 
-        _update_urdf_state(rbdyn_urdf, robot_state);
+        _reset_config(mbc);
+        mbc.gravity = {gravity[0], gravity[1], gravity[2]};
 
-        // Forward Dynamics
-        rbd::ForwardDynamics fd(rbdyn_urdf.mb);
+        _update_urdf_state(mbc, robot_state);
 
         // Compute gravity compensation
-        rbd::forwardKinematics(rbdyn_urdf.mb, rbdyn_urdf.mbc);
-        rbd::forwardVelocity(rbdyn_urdf.mb, rbdyn_urdf.mbc);
-        fd.computeC(rbdyn_urdf.mb, rbdyn_urdf.mbc);
+        rbd::forwardKinematics(mb, mbc);
+        rbd::forwardVelocity(mb, mbc);
+        context.fd.computeC(mb, mbc);
 
         // Get gravity and Coriolis forces
-        return -fd.C();
+        context.gravity = -context.fd.C();
+        return context.gravity;
     }
 
-    Eigen::MatrixXd IiwaTools::jacobian(const RobotState& robot_state)
+    const Eigen::MatrixXd& IiwaTools::jacobian(Context& context, const RobotState& robot_state) const
     {
-        // copy RBDyn for thread-safety
-        // TO-DO: Check if it takes time
-        mc_rbdyn_urdf::URDFParserResult rbdyn_urdf = _rbdyn_urdf;
+        if (_chain) {
+            SerialChain<7>::Workspace& ws = *context.chain;
+            _update_chain_state(ws, robot_state);
+            _chain->forward_kinematics(ws);
+            _chain->jacobian(ws);
+            context.jacobian = ws.jacobian;
+            return context.jacobian;
+        }
 
-        rbdyn_urdf.mbc.zero(rbdyn_urdf.mb);
+        const rbd::MultiBody& mb = _rbdyn_urdf.mb;
+        rbd::MultiBodyConfig& mbc = context.mbc;
 
-        _update_urdf_state(rbdyn_urdf, robot_state);
+        _reset_config(mbc);
 
-        // Compute jacobian
-        rbd::Jacobian jac(rbdyn_urdf.mb, rbdyn_urdf.mb.body(_ef_index).name());
+        _update_urdf_state(mbc, robot_state);
 
         // TO-DO: Check if we need this
-        rbd::forwardKinematics(rbdyn_urdf.mb, rbdyn_urdf.mbc);
-        rbd::forwardVelocity(rbdyn_urdf.mb, rbdyn_urdf.mbc);
+        rbd::forwardKinematics(mb, mbc);
+        rbd::forwardVelocity(mb, mbc);
 
-        return jac.jacobian(rbdyn_urdf.mb, rbdyn_urdf.mbc);
+        // Compute jacobian
+        return context.jac.jacobian(mb, mbc);
     }
 
-    Eigen::MatrixXd IiwaTools::jacobian_deriv(const RobotState& robot_state)
+    const Eigen::MatrixXd& IiwaTools::jacobian_deriv(Context& context, const RobotState& robot_state) const
     {
-        // copy RBDyn for thread-safety
-        // TO-DO: Check if it takes time
-        mc_rbdyn_urdf::URDFParserResult rbdyn_urdf = _rbdyn_urdf;
+        if (_chain) {
+            SerialChain<7>::Workspace& ws = *context.chain;
+            _update_chain_state(ws, robot_state);
+            _chain->forward_kinematics(ws);
+            _chain->jacobian_deriv(ws);
+            context.jacobian_deriv = ws.jacobian_deriv;
+            return context.jacobian_deriv;
+        }
 
-        rbdyn_urdf.mbc.zero(rbdyn_urdf.mb);
+        const rbd::MultiBody& mb = _rbdyn_urdf.mb;
+        rbd::MultiBodyConfig& mbc = context.mbc;
 
-        _update_urdf_state(rbdyn_urdf, robot_state);
+        _reset_config(mbc);
 
-        // Compute jacobian
-        rbd::Jacobian jac(rbdyn_urdf.mb, rbdyn_urdf.mb.body(_ef_index).name());
+        _update_urdf_state(mbc, robot_state);
 
         // TO-DO: Check if we need this
-        rbd::forwardKinematics(rbdyn_urdf.mb, rbdyn_urdf.mbc);
-        rbd::forwardVelocity(rbdyn_urdf.mb, rbdyn_urdf.mbc);
+        rbd::forwardKinematics(mb, mbc);
+        rbd::forwardVelocity(mb, mbc);
 
-        return jac.jacobianDot(rbdyn_urdf.mb, rbdyn_urdf.mbc);
+        // Compute jacobian derivative
+        return context.jac.jacobianDot(mb, mbc);
     }
 
-    std::pair<Eigen::MatrixXd, Eigen::MatrixXd> IiwaTools::jacobians(const RobotState& robot_state)
+    std::pair<const Eigen::MatrixXd&, const Eigen::MatrixXd&> IiwaTools::jacobians(Context& context, const RobotState& robot_state) const
     {
-        // copy RBDyn for thread-safety
-        // TO-DO: Check if it takes time
-        mc_rbdyn_urdf::URDFParserResult rbdyn_urdf = _rbdyn_urdf;
+        if (_chain) {
+            SerialChain<7>::Workspace& ws = *context.chain;
+            _update_chain_state(ws, robot_state);
+            _chain->forward_kinematics(ws);
+            _chain->jacobian(ws);
+            _chain->jacobian_deriv(ws);
+            context.jacobian = ws.jacobian;
+            context.jacobian_deriv = ws.jacobian_deriv;
+            return std::pair<const Eigen::MatrixXd&, const Eigen::MatrixXd&>(context.jacobian, context.jacobian_deriv);
+        }
 
-        rbdyn_urdf.mbc.zero(rbdyn_urdf.mb);
+        const rbd::MultiBody& mb = _rbdyn_urdf.mb;
+        rbd::MultiBodyConfig& mbc = context.mbc;
 
-        _update_urdf_state(rbdyn_urdf, robot_state);
+        _reset_config(mbc);
 
-        // Compute jacobian
-        rbd::Jacobian jac(rbdyn_urdf.mb, rbdyn_urdf.mb.body(_ef_index).name());
+        _update_urdf_state(mbc, robot_state);
 
         // TO-DO: Check if we need this
-        rbd::forwardKinematics(rbdyn_urdf.mb, rbdyn_urdf.mbc);
-        rbd::forwardVelocity(rbdyn_urdf.mb, rbdyn_urdf.mbc);
+        rbd::forwardKinematics(mb, mbc);
+        rbd::forwardVelocity(mb, mbc);
+
+        // Both refer to the storage of the context's jacobian
+        const Eigen::MatrixXd& jac = context.jac.jacobian(mb, mbc);
+        const Eigen::MatrixXd& jac_deriv = context.jac.jacobianDot(mb, mbc);
+        return std::pair<const Eigen::MatrixXd&, const Eigen::MatrixXd&>(jac, jac_deriv);
+    }
+
+    void IiwaTools::compute(Context& context, const RobotState& robot_state, unsigned int flags, ModelState& result, const Eigen::Vector3d& gravity) const
+    {
+        // The analytic model has no mass matrix
+        if (_chain && !(flags & COMPUTE_MASS_MATRIX)) {
+            SerialChain<7>::Workspace& ws = *context.chain;
+            _update_chain_state(ws, robot_state);
+            _chain->forward_kinematics(ws);
+
+            if (flags & COMPUTE_FK) {
+                result.ee_state.translation = ws.ee_position;
+                result.ee_state.orientation = Eigen::Quaterniond(ws.ee_rotation).normalized();
+            }
+
+            if (flags & COMPUTE_JACOBIAN) {
+                _chain->jacobian(ws);
+                result.jacobian = ws.jacobian;
+            }
+
+            if (flags & COMPUTE_JACOBIAN_DERIV) {
+                _chain->jacobian_deriv(ws);
+                result.jacobian_deriv = ws.jacobian_deriv;
+            }
+
+            if (flags & COMPUTE_GRAVITY) {
+                _chain->inverse_dynamics(gravity, ws);
+                result.gravity = -ws.tau;
+            }
+            return;
+        }
+
+        const rbd::MultiBody& mb = _rbdyn_urdf.mb;
+        rbd::MultiBodyConfig& mbc = context.mbc;
+
+        _reset_config(mbc);
+        mbc.gravity = gravity;
+
+        _update_urdf_state(mbc, robot_state);
+
+        rbd::forwardKinematics(mb, mbc);
+        // Only the Jacobian derivative and the Coriolis terms depend on the body velocities
+        if (flags & (COMPUTE_JACOBIAN_DERIV | COMPUTE_GRAVITY))
+            rbd::forwardVelocity(mb, mbc);
+
+        if (flags & COMPUTE_FK)
+            _get_ee_state(mbc, result.ee_state);
+
+        if (flags & COMPUTE_JACOBIAN)
+            result.jacobian = context.jac.jacobian(mb, mbc);
+
+        if (flags & COMPUTE_JACOBIAN_DERIV)
+            result.jacobian_deriv = context.jac.jacobianDot(mb, mbc);
+
+        if (flags & COMPUTE_GRAVITY) {
+            context.fd.computeC(mb, mbc);
+            result.gravity = -context.fd.C();
+        }
+
+        if (flags & COMPUTE_MASS_MATRIX) {
+            context.fd.computeH(mb, mbc);
+            result.mass_matrix = context.fd.H();
+        }
+    }
+
+    iiwa_tools::EefState IiwaTools::perform_fk(const RobotState& robot_state)
+    {
+        std::lock_guard<std::mutex> lock(_context_mutex);
+        return perform_fk(*_context, robot_state);
+    }
+
+    Eigen::VectorXd IiwaTools::perform_ik(const EefState& ee_state, const RobotState& seed_state)
+    {
+        std::lock_guard<std::mutex> lock(_context_mutex);
+        return perform_ik(*_context, ee_state, seed_state);
+    }
+
+    Eigen::VectorXd IiwaTools::gravity(const std::vector<double>& gravity, const RobotState& robot_state)
+    {
+        std::lock_guard<std::mutex> lock(_context_mutex);
+        return this->gravity(*_context, gravity, robot_state);
+    }
+
+    Eigen::MatrixXd IiwaTools::jacobian(const RobotState& robot_state)
+    {
+        std::lock_guard<std::mutex> lock(_context_mutex);
+        return jacobian(*_context, robot_state);
+    }
+
+    Eigen::MatrixXd IiwaTools::jacobian_deriv(const RobotState& robot_state)
+    {
+        std::lock_guard<std::mutex> lock(_context_mutex);
+        return jacobian_deriv(*_context, robot_state);
+    }
 
-        return std::make_pair(jac.jacobian(rbdyn_urdf.mb, rbdyn_urdf.mbc), jac.jacobianDot(rbdyn_urdf.mb, rbdyn_urdf.mbc));
+    std::pair<Eigen::MatrixXd, Eigen::MatrixXd> IiwaTools::jacobians(const RobotState& robot_state)
+    {
+        std::lock_guard<std::mutex> lock(_context_mutex);
+        auto jacs = jacobians(*_context, robot_state);
+        return std::make_pair(Eigen::MatrixXd(jacs.first), Eigen::MatrixXd(jacs.second));
     }
 
-    void IiwaTools::init_rbdyn(const std::string& urdf_string, const std::string& end_effector)
+    void IiwaTools::init_rbdyn(const std::string& urdf_string, const std::string& end_effector, bool analytic)
     {
         // Convert URDF to RBDyn
-        _rbdyn_urdf = mc_rbdyn_urdf::rbdyn_from_urdf(urdf_string);
+        init_rbdyn(mc_rbdyn_urdf::rbdyn_from_urdf(urdf_string), end_effector, analytic);
+    }
+
+    void IiwaTools::init_rbdyn(const mc_rbdyn_urdf::URDFParserResult& rbdyn_urdf, const std::string& end_effector, bool analytic)
+    {
+        _rbdyn_urdf = rbdyn_urdf;
 
         _rbd_indices.clear();
 
@@ -358,7 +517,30 @@ namespace iiwa_tools {
 
         _ef_index = _rbd_index(end_effector);
 
-        _ik.reset(new rbd::InverseKinematics(_rbdyn_urdf.mb, _ef_index));
+        // The limits are looked up once (by joint name)
+        _q_low = Eigen::VectorXd::Zero(_rbd_indices.size());
+        _q_high = _q_low;
+        for (size_t i = 0; i < _rbd_indices.size(); i++) {
+            const std::string& name = _rbdyn_urdf.mb.joint(_rbd_indices[i]).name();
+            _q_low(i) = _rbdyn_urdf.limits.lower[name][0];
+            _q_high(i) = _rbdyn_urdf.limits.upper[name][0];
+        }
+
+        _chain.reset();
+        _analytic_ik.reset();
+        if (analytic && _init_analytic())
+            ROS_INFO_STREAM("Using the analytic model of the 7-DoF chain" << (_analytic_ik ? " (with the closed-form IK)" : "") << ".");
+
+        std::lock_guard<std::mutex> lock(_context_mutex);
+        _context = create_context();
+    }
+
+    std::vector<std::string> IiwaTools::get_joint_names() const
+    {
+        std::vector<std::string> names;
+        for (size_t i = 0; i < _rbd_indices.size(); i++)
+            names.push_back(_rbdyn_urdf.mb.joint(_rbd_indices[i]).name());
+        return names;
     }
 
     size_t IiwaTools::_rbd_index(const std::string& body_name) const
@@ -373,18 +555,209 @@ namespace iiwa_tools {
         return 0;
     }
 
-    void IiwaTools::_update_urdf_state(mc_rbdyn_urdf::URDFParserResult& rbdyn_urdf, const RobotState& robot_state)
+    void IiwaTools::_update_urdf_state(rbd::MultiBodyConfig& mbc, const RobotState& robot_state) const
     {
         for (size_t i = 0; i < _rbd_indices.size(); i++) {
             size_t rbd_index = _rbd_indices[i];
 
             if (robot_state.position.size() > i)
-                rbdyn_urdf.mbc.q[rbd_index][0] = robot_state.position[i];
+                mbc.q[rbd_index][0] = robot_state.position[i];
             if (robot_state.velocity.size() > i)
-                rbdyn_urdf.mbc.alpha[rbd_index][0] = robot_state.velocity[i];
+                mbc.alpha[rbd_index][0] = robot_state.velocity[i];
             if (robot_state.torque.size() > i)
-                rbdyn_urdf.mbc.jointTorque[rbd_index][0] = robot_state.torque[i];
+                mbc.jointTorque[rbd_index][0] = robot_state.torque[i];
         }
     }
 
+    void IiwaTools::_reset_config(rbd::MultiBodyConfig& mbc) const
+    {
+        // Same as mbc.zero(mb) for the (1-dof) joints of the arm, without temporary vectors
+        for (size_t i = 0; i < mbc.q.size(); i++) {
+            std::fill(mbc.q[i].begin(), mbc.q[i].end(), 0.);
+            std::fill(mbc.alpha[i].begin(), mbc.alpha[i].end(), 0.);
+            std::fill(mbc.alphaD[i].begin(), mbc.alphaD[i].end(), 0.);
+            std::fill(mbc.jointTorque[i].begin(), mbc.jointTorque[i].end(), 0.);
+        }
+        for (size_t i = 0; i < mbc.force.size(); i++)
+            mbc.force[i] = sva::ForceVecd(Eigen::Vector3d::Zero(), Eigen::Vector3d::Zero());
+    }
+
+    void IiwaTools::_get_ee_state(const rbd::MultiBodyConfig& mbc, EefState& ee_state) const
+    {
+        const sva::PTransformd& tf = mbc.bodyPosW[_ef_index];
+
+        ee_state.translation = tf.translation();
+        // PTransformd stores the transposed rotation
+        ee_state.orientation = Eigen::Quaterniond(Eigen::Matrix3d(tf.rotation().transpose())).normalized();
+    }
+
+    Eigen::Vector6d IiwaTools::_pose_error(const rbd::MultiBodyConfig& mbc, const sva::PTransformd& target_tf) const
+    {
+        Eigen::Vector6d error;
+        error << sva::rotationError(mbc.bodyPosW[_ef_index].rotation(), target_tf.rotation()),
+            target_tf.translation() - mbc.bodyPosW[_ef_index].translation();
+        return error;
+    }
+
+    double IiwaTools::_joint_in_limits(size_t i, double q) const
+    {
+        // wrap in [-pi,pi]
+        q = wrap_angle(q);
+        // enforce limits
+        if (q < _q_low(i))
+            q = _q_low(i);
+        if (q > _q_high(i))
+            q = _q_high(i);
+        return q;
+    }
+
+    bool IiwaTools::_init_analytic()
+    {
+        const rbd::MultiBody& mb = _rbdyn_urdf.mb;
+
+        // 7 revolute joints, all on the path of the end-effector (in the order of the joint vectors)
+        if (_rbd_indices.size() != 7)
+            return false;
+        std::vector<size_t> path;
+        for (int b = static_cast<int>(_ef_index); b >= 0; b = mb.parent(b)) {
+            if (mb.joint(b).dof() > 0)
+                path.insert(path.begin(), b);
+        }
+        if (path != _rbd_indices)
+            return false;
+
+        // The fixed transformations are read from the zero configuration (the frame of a joint at zero is the one of its body)
+        rbd::MultiBodyConfig mbc(mb);
+        mbc.zero(mb);
+        rbd::forwardKinematics(mb, mbc);
+        auto world = [&mbc](size_t b) {
+            Eigen::Isometry3d tf = Eigen::Isometry3d::Identity();
+            tf.linear() = mbc.bodyPosW[b].rotation().transpose();
+            tf.translation() = mbc.bodyPosW[b].translation();
+            return tf;
+        };
+
+        std::unique_ptr<SerialChain<7>> chain(new SerialChain<7>);
+        Eigen::Isometry3d previous = Eigen::Isometry3d::Identity();
+        for (size_t i = 0; i < 7; i++) {
+            const rbd::Joint& joint = mb.joint(_rbd_indices[i]);
+            if (joint.type() != rbd::Joint::Rev)
+                return false;
+
+            Eigen::Isometry3d frame = world(_rbd_indices[i]);
+            Eigen::Isometry3d local = previous.inverse() * frame;
+            SerialChain<7>::Link& link = chain->link(i);
+            link.rotation = local.linear();
+            link.translation = local.translation();
+
+            // The axis (and direction) of the joint, from its motion at q = 1
+            Eigen::AngleAxisd motion(Eigen::Matrix3d(joint.pose(std::vector<double>{1.}).rotation().transpose()));
+            if (std::abs(motion.angle() - 1.) > 1e-9)
+                return false;
+            link.axis = motion.axis();
+
+            previous = frame;
+        }
+        Eigen::Isometry3d ee = previous.inverse() * world(_ef_index);
+        chain->set_end_effector(ee.linear(), ee.translation());
+
+        // Every body with a mass moves with the link it is rigidly attached to (if any)
+        for (size_t b = 0; b < mb.nrBodies(); b++) {
+            const sva::RBInertiad& inertia = mb.body(b).inertia();
+            if (inertia.mass() <= 0.)
+                continue;
+
+            int link_index = -1;
+            for (int a = static_cast<int>(b); a >= 0 && link_index < 0; a = mb.parent(a)) {
+                auto it = std::find(_rbd_indices.begin(), _rbd_indices.end(), static_cast<size_t>(a));
+                if (it != _rbd_indices.end())
+                    link_index = it - _rbd_indices.begin();
+            }
+            if (link_index < 0)
+                continue;
+
+            // RBDyn's inertia is about the origin of the body: move it to the center of mass, then to the frame of the link
+            Eigen::Isometry3d local = world(_rbd_indices[link_index]).inverse() * world(b);
+            double mass = inertia.mass();
+            Eigen::Vector3d com = inertia.momentum() / mass;
+            Eigen::Matrix3d com_inertia = inertia.inertia() - mass * (com.squaredNorm() * Eigen::Matrix3d::Identity() - com * com.transpose());
+            com = local * com;
+            com_inertia = local.linear() * com_inertia * local.linear().transpose();
+
+            // Combine with what the link already has (parallel axis theorem about the new center of mass)
+            SerialChain<7>::Link& link = chain->link(link_index);
+            double total = link.mass + mass;
+            Eigen::Vector3d total_com = (link.mass * link.com + mass * com) / total;
+            Eigen::Vector3d d1 = link.com - total_com, d2 = com - total_com;
+            link.inertia += link.mass * (d1.squaredNorm() * Eigen::Matrix3d::Identity() - d1 * d1.transpose())
+                + com_inertia + mass * (d2.squaredNorm() * Eigen::Matrix3d::Identity() - d2 * d2.transpose());
+            link.mass = total;
+            link.com = total_com;
+        }
+
+        _chain = std::move(chain);
+        _analytic_ik.reset(new AnalyticIk(*_chain));
+        if (!_analytic_ik->valid())
+            _analytic_ik.reset();
+
+        return true;
+    }
+
+    void IiwaTools::_update_chain_state(SerialChain<7>::Workspace& ws, const RobotState& robot_state) const
+    {
+        // Same as _update_urdf_state: missing values are zeros
+        for (int i = 0; i < 7; i++) {
+            ws.q[i] = (robot_state.position.size() > i) ? robot_state.position[i] : 0.;
+            ws.dq[i] = (robot_state.velocity.size() > i) ? robot_state.velocity[i] : 0.;
+        }
+    }
+
+    bool IiwaTools::_analytic_solution(Context& context, const EefState& ee_state, const RobotState& seed_state, const IkParams& params, IkResult& result) const
+    {
+        SerialChain<7>::Workspace& ws = *context.chain;
+        double tolerance = (params.tolerance > 0.) ? params.tolerance : 1e-5;
+
+        AnalyticIk::Vector7d seed = AnalyticIk::Vector7d::Zero();
+        if (seed_state.position.size() == 7) {
+            for (size_t i = 0; i < 7; i++)
+                seed[i] = _joint_in_limits(i, seed_state.position[i]);
+        }
+
+        Eigen::Matrix3d rotation = ee_state.orientation.normalized().toRotationMatrix();
+        double arm_angle = std::isnan(params.arm_angle) ? _analytic_ik->arm_angle(seed) : params.arm_angle;
+
+        // The solution closest to the seed within the limits, at the arm angle or as close to it as possible (in steps of 10 degrees)
+        AnalyticIk::Solutions solutions;
+        double best = std::numeric_limits<double>::max();
+        for (int step = 0; step <= 18 && best == std::numeric_limits<double>::max(); step++) {
+            for (int side = (step == 0) ? 1 : -1; side <= 1; side += 2) {
+                int count = _analytic_ik->solve(rotation, ee_state.translation, arm_angle + side * step * M_PI / 18., solutions);
+                for (int k = 0; k < count; k++) {
+                    const AnalyticIk::Vector7d& q = solutions[k];
+                    if ((q.array() < _q_low.array()).any() || (q.array() > _q_high.array()).any())
+                        continue;
+                    double distance = (q - seed).squaredNorm();
+                    if (distance < best) {
+                        best = distance;
+                        ws.q = q;
+                    }
+                }
+            }
+        }
+        if (best == std::numeric_limits<double>::max())
+            return false;
+
+        // Closed-form, but check it like the QP solutions
+        _chain->forward_kinematics(ws);
+        Eigen::AngleAxisd rotation_error(rotation * ws.ee_rotation.transpose());
+        Eigen::Vector6d error;
+        error << rotation_error.angle() * rotation_error.axis(), ee_state.translation - ws.ee_position;
+
+        result.joints = ws.q;
+        result.error = error.norm();
+        result.iterations = 0;
+        result.is_valid = (result.error < tolerance);
+
+        return result.is_valid;
+    }
 } // namespace iiwa_tools
@@ -0,0 +1,395 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+// Benchmark of the IiwaTools queries (see usage() below)
+#include <iiwa_tools/iiwa_tools.h>
+
+// std headers
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Allocation counting: malloc and friends are interposed (glibc only), which also covers operator new and Eigen
+#ifdef __GLIBC__
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t n, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+}
+#endif
+
+namespace {
+    std::atomic<size_t> allocations(0);
+} // namespace
+
+#ifdef __GLIBC__
+extern "C" {
+void* malloc(size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr ? 0 : 12; // ENOMEM
+}
+}
+#endif
+
+namespace iiwa_tools {
+    struct BenchmarkResult {
+        std::string urdf, name;
+        double ns_per_op, allocs_per_op;
+        double iterations, success_rate; // IK only (0 otherwise)
+    };
+
+    struct BenchmarkSettings {
+        std::string end_effector = "iiwa_link_ee";
+        size_t ops = 2000; // per repetition
+        size_t repetitions = 5; // the median is reported
+        size_t configurations = 200; // random joint configurations (and their poses for the IK)
+        unsigned int seed = 42;
+        double validation_tolerance = 1e-8; // of the analytic model against RBDyn
+        std::string baseline, output;
+    };
+
+    // Median time of the repetitions (after a warm-up) and the allocations of one repetition, per op
+    BenchmarkResult measure(const std::string& urdf, const std::string& name, const BenchmarkSettings& settings, const std::function<void(size_t)>& op)
+    {
+        for (size_t i = 0; i < std::min<size_t>(settings.ops, 100); i++)
+            op(i);
+
+        std::vector<double> times;
+        size_t allocs = 0;
+        for (size_t r = 0; r < settings.repetitions; r++) {
+            size_t allocs_start = allocations.load();
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < settings.ops; i++)
+                op(i);
+            auto end = std::chrono::steady_clock::now();
+            allocs = allocations.load() - allocs_start;
+            times.push_back(std::chrono::duration<double, std::nano>(end - start).count() / settings.ops);
+        }
+        std::sort(times.begin(), times.end());
+
+        BenchmarkResult result;
+        result.urdf = urdf;
+        result.name = name;
+        result.ns_per_op = times[times.size() / 2];
+        result.allocs_per_op = static_cast<double>(allocs) / settings.ops;
+        result.iterations = result.success_rate = 0.;
+        return result;
+    }
+
+    // Benchmarks of one backend, named "<backend>/<method>"
+    void benchmark_backend(const std::string& urdf_file, const std::string& backend, IiwaTools& tools, bool analytic_ik, const std::vector<RobotState>& states, const std::vector<EefState>& poses,
+        const BenchmarkSettings& settings, std::vector<BenchmarkResult>& results)
+    {
+        std::unique_ptr<IiwaTools::Context> context = tools.create_context();
+        auto state = [&](size_t i) -> const RobotState& { return states[i % states.size()]; };
+        std::vector<double> gravity = {0., 0., -9.81};
+        ModelState model;
+        std::string prefix = backend + "/";
+
+        results.push_back(measure(urdf_file, prefix + "perform_fk", settings, [&](size_t i) { tools.perform_fk(*context, state(i)); }));
+        results.push_back(measure(urdf_file, prefix + "jacobian", settings, [&](size_t i) { tools.jacobian(*context, state(i)); }));
+        results.push_back(measure(urdf_file, prefix + "jacobians", settings, [&](size_t i) { tools.jacobians(*context, state(i)); }));
+        results.push_back(measure(urdf_file, prefix + "gravity", settings, [&](size_t i) { tools.gravity(*context, gravity, state(i)); }));
+        results.push_back(measure(urdf_file, prefix + "compute_no_mass", settings, [&](size_t i) {
+            tools.compute(*context, state(i), COMPUTE_FK | COMPUTE_JACOBIAN | COMPUTE_JACOBIAN_DERIV | COMPUTE_GRAVITY, model);
+        }));
+        results.push_back(measure(urdf_file, prefix + "compute_all", settings, [&](size_t i) {
+            tools.compute(*context, state(i), COMPUTE_FK | COMPUTE_JACOBIAN | COMPUTE_JACOBIAN_DERIV | COMPUTE_GRAVITY | COMPUTE_MASS_MATRIX, model);
+        }));
+        // The methods without a context (allocating copies, behind a mutex)
+        results.push_back(measure(urdf_file, prefix + "perform_fk_compat", settings, [&](size_t i) { tools.perform_fk(state(i)); }));
+        results.push_back(measure(urdf_file, prefix + "gravity_compat", settings, [&](size_t i) { tools.gravity(gravity, state(i)); }));
+
+        // IK: every pose once per repetition, without seed
+        BenchmarkSettings ik_settings = settings;
+        ik_settings.ops = poses.size();
+        size_t solved = 0, iterations = 0, calls = 0;
+        IkParams params;
+        params.analytic = analytic_ik;
+        RobotState no_seed;
+        BenchmarkResult ik = measure(urdf_file, prefix + "perform_ik", ik_settings, [&](size_t i) {
+            IkResult result = tools.perform_ik(*context, poses[i % poses.size()], no_seed, params);
+            solved += result.is_valid;
+            iterations += result.iterations;
+            calls++;
+        });
+        ik.iterations = static_cast<double>(iterations) / calls;
+        ik.success_rate = static_cast<double>(solved) / calls;
+        results.push_back(ik);
+    }
+
+    // Largest deviation of the analytic model from RBDyn over the configurations
+    double validate(IiwaTools& rbdyn, IiwaTools& analytic, const std::vector<RobotState>& states)
+    {
+        std::unique_ptr<IiwaTools::Context> rbdyn_context = rbdyn.create_context(), analytic_context = analytic.create_context();
+        std::vector<double> gravity = {0., 0., -9.81};
+        double fk = 0., jac = 0., jac_deriv = 0., grav = 0.;
+
+        for (auto& state : states) {
+            EefState a = analytic.perform_fk(*analytic_context, state), r = rbdyn.perform_fk(*rbdyn_context, state);
+            fk = std::max(fk, (a.translation - r.translation).norm() + a.orientation.angularDistance(r.orientation));
+
+            auto ja = analytic.jacobians(*analytic_context, state);
+            auto jr = rbdyn.jacobians(*rbdyn_context, state);
+            jac = std::max(jac, (ja.first - jr.first).cwiseAbs().maxCoeff());
+            jac_deriv = std::max(jac_deriv, (ja.second - jr.second).cwiseAbs().maxCoeff());
+
+            grav = std::max(grav, (analytic.gravity(*analytic_context, gravity, state) - rbdyn.gravity(*rbdyn_context, gravity, state)).cwiseAbs().maxCoeff());
+        }
+
+        std::cout << std::scientific << std::setprecision(2) << "analytic vs RBDyn (max abs deviation): fk " << fk << ", jacobian " << jac << ", jacobian_deriv " << jac_deriv << ", gravity " << grav << std::defaultfloat << std::endl;
+        return std::max(std::max(fk, jac), std::max(jac_deriv, grav));
+    }
+
+    std::vector<BenchmarkResult> benchmark(const std::string& urdf_file, const BenchmarkSettings& settings, bool& valid)
+    {
+        std::vector<BenchmarkResult> results;
+
+        std::ifstream file(urdf_file);
+        if (!file) {
+            std::cerr << "Could not read " << urdf_file << std::endl;
+            valid = false;
+            return results;
+        }
+        std::stringstream urdf_string;
+        urdf_string << file.rdbuf();
+
+        IiwaTools rbdyn, analytic;
+        rbdyn.init_rbdyn(urdf_string.str(), settings.end_effector, false);
+        analytic.init_rbdyn(urdf_string.str(), settings.end_effector, true);
+        std::unique_ptr<IiwaTools::Context> context = rbdyn.create_context();
+        size_t n = rbdyn.get_indices().size();
+
+        // The same random configurations (within the joint limits) and poses for every run
+        std::mt19937 gen(settings.seed);
+        std::vector<RobotState> states(settings.configurations);
+        std::vector<EefState> poses(settings.configurations);
+        for (size_t i = 0; i < settings.configurations; i++) {
+            states[i].position.resize(n);
+            states[i].velocity.resize(n);
+            for (size_t j = 0; j < n; j++) {
+                std::uniform_real_distribution<double> position(rbdyn.get_lower_limits()[j], rbdyn.get_upper_limits()[j]);
+                std::uniform_real_distribution<double> velocity(-1., 1.);
+                states[i].position[j] = position(gen);
+                states[i].velocity[j] = velocity(gen);
+            }
+            poses[i] = rbdyn.perform_fk(*context, states[i]);
+        }
+
+        benchmark_backend(urdf_file, "rbdyn", rbdyn, false, states, poses, settings, results);
+
+        if (!analytic.has_analytic_model()) {
+            std::cout << urdf_file << ": no analytic model (not a chain of 7 revolute joints to " << settings.end_effector << ")" << std::endl;
+            return results;
+        }
+
+        std::cout << urdf_file << ": ";
+        if (validate(rbdyn, analytic, states) > settings.validation_tolerance) {
+            std::cerr << "The analytic model of " << urdf_file << " deviates from RBDyn by more than " << settings.validation_tolerance << std::endl;
+            valid = false;
+        }
+        benchmark_backend(urdf_file, "analytic", analytic, analytic.has_analytic_ik(), states, poses, settings, results);
+
+        return results;
+    }
+
+    std::map<std::string, BenchmarkResult> read_results(const std::string& file_name)
+    {
+        std::map<std::string, BenchmarkResult> results;
+        std::ifstream file(file_name);
+        std::string line;
+        std::getline(file, line); // header
+        while (std::getline(file, line)) {
+            std::stringstream row(line);
+            BenchmarkResult result;
+            std::string value;
+            std::getline(row, result.urdf, ',');
+            std::getline(row, result.name, ',');
+            row >> result.ns_per_op;
+            row.ignore();
+            row >> result.allocs_per_op;
+            row.ignore();
+            row >> result.iterations;
+            row.ignore();
+            row >> result.success_rate;
+            if (row)
+                results[result.urdf + "/" + result.name] = result;
+        }
+        return results;
+    }
+
+    bool write_results(const std::string& file_name, const std::vector<BenchmarkResult>& results)
+    {
+        std::ofstream file(file_name);
+        if (!file)
+            return false;
+        file << "urdf,benchmark,ns_per_op,allocs_per_op,iterations,success_rate\n";
+        for (auto& r : results)
+            file << r.urdf << "," << r.name << "," << r.ns_per_op << "," << r.allocs_per_op << "," << r.iterations << "," << r.success_rate << "\n";
+        return true;
+    }
+
+    void print_results(const std::vector<BenchmarkResult>& results, const std::map<std::string, BenchmarkResult>& baseline)
+    {
+        std::cout << std::left << std::setw(28) << "benchmark" << std::right << std::setw(12) << "ns/op" << std::setw(12) << "allocs/op" << std::setw(12) << "iterations" << std::setw(10) << "success";
+        if (!baseline.empty())
+            std::cout << std::setw(14) << "base ns/op" << std::setw(10) << "change" << std::setw(12) << "base allocs";
+        std::cout << std::endl;
+
+        std::string urdf;
+        for (auto& r : results) {
+            if (r.urdf != urdf) {
+                urdf = r.urdf;
+                std::cout << "# " << urdf << std::endl;
+            }
+
+            std::cout << std::left << std::setw(28) << r.name << std::right << std::fixed << std::setprecision(1) << std::setw(12) << r.ns_per_op
+                      << std::setprecision(2) << std::setw(12) << r.allocs_per_op << std::setw(12) << r.iterations << std::setw(10) << r.success_rate;
+
+            auto it = baseline.find(r.urdf + "/" + r.name);
+            if (it != baseline.end()) {
+                double change = 100. * (r.ns_per_op - it->second.ns_per_op) / it->second.ns_per_op;
+                std::cout << std::setprecision(1) << std::setw(14) << it->second.ns_per_op << std::setw(9) << std::showpos << change << "%" << std::noshowpos
+                          << std::setprecision(2) << std::setw(12) << it->second.allocs_per_op;
+            }
+            std::cout << std::endl;
+        }
+    }
+} // namespace iiwa_tools
+
+namespace {
+    void usage(const char* name)
+    {
+        std::cout << "Usage: " << name << " [options] <urdf>...\n"
+                  << "  The URDFs can be generated from iiwa_description, e.g.:\n"
+                  << "    rosrun xacro xacro `rospack find iiwa_description`/urdf/iiwa14.urdf.xacro > iiwa14.urdf\n"
+                  << "Options:\n"
+                  << "  --end-effector <body>   end-effector body (default: iiwa_link_ee)\n"
+                  << "  --ops <n>               operations per repetition (default: 2000)\n"
+                  << "  --repetitions <n>       repetitions, the median is reported (default: 5)\n"
+                  << "  --configurations <n>    random configurations/poses (default: 200)\n"
+                  << "  --seed <n>              seed of the configurations (default: 42)\n"
+                  << "  --validation-tolerance <x>  max deviation of the analytic model from RBDyn (default: 1e-8, exit code 2 above)\n"
+                  << "  --output <csv>          write the results (e.g. to use as a baseline later)\n"
+                  << "  --baseline <csv>        compare with previous results" << std::endl;
+    }
+} // namespace
+
+int main(int argc, char** argv)
+{
+    iiwa_tools::BenchmarkSettings settings;
+    std::vector<std::string> urdfs;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = (i + 1 < argc);
+        if (arg == "--help" || arg == "-h") {
+            usage(argv[0]);
+            return 0;
+        }
+        else if (arg == "--end-effector" && has_value)
+            settings.end_effector = argv[++i];
+        else if (arg == "--ops" && has_value)
+            settings.ops = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--repetitions" && has_value)
+            settings.repetitions = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--configurations" && has_value)
+            settings.configurations = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--seed" && has_value)
+            settings.seed = std::atoi(argv[++i]);
+        else if (arg == "--validation-tolerance" && has_value)
+            settings.validation_tolerance = std::atof(argv[++i]);
+        else if (arg == "--output" && has_value)
+            settings.output = argv[++i];
+        else if (arg == "--baseline" && has_value)
+            settings.baseline = argv[++i];
+        else if (arg.compare(0, 2, "--") == 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        else
+            urdfs.push_back(arg);
+    }
+
+    if (urdfs.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::map<std::string, iiwa_tools::BenchmarkResult> baseline;
+    if (!settings.baseline.empty()) {
+        baseline = iiwa_tools::read_results(settings.baseline);
+        if (baseline.empty())
+            std::cerr << "No results in the baseline " << settings.baseline << std::endl;
+    }
+
+    std::vector<iiwa_tools::BenchmarkResult> results;
+    bool valid = true;
+    for (auto& urdf : urdfs) {
+        std::vector<iiwa_tools::BenchmarkResult> urdf_results = iiwa_tools::benchmark(urdf, settings, valid);
+        results.insert(results.end(), urdf_results.begin(), urdf_results.end());
+    }
+
+    iiwa_tools::print_results(results, baseline);
+
+    if (!settings.output.empty() && !iiwa_tools::write_results(settings.output, results)) {
+        std::cerr << "Could not write " << settings.output << std::endl;
+        return 1;
+    }
+
+    return valid ? 0 : 2;
+}
@@ -0,0 +1,357 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#include <iiwa_tools/ik_cache.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace iiwa_tools {
+    namespace {
+        // Unit quaternion with w >= 0 (q and -q are the same rotation)
+        Eigen::Quaterniond canonical(const Eigen::Quaterniond& orientation)
+        {
+            Eigen::Quaterniond q = orientation.normalized();
+            if (q.w() < 0.)
+                q.coeffs() = -q.coeffs();
+            return q;
+        }
+    } // namespace
+
+    bool IkCache::Key::operator==(const Key& other) const
+    {
+        return std::equal(cell, cell + DIM, other.cell) && branch == other.branch;
+    }
+
+    size_t IkCache::KeyHash::operator()(const Key& key) const
+    {
+        size_t h = std::hash<int32_t>()(key.branch);
+        for (int i = 0; i < DIM; i++)
+            h ^= std::hash<int32_t>()(key.cell[i]) + 0x9e3779b9 + (h << 6) + (h >> 2);
+        return h;
+    }
+
+    IkCache::IkCache(size_t num_joints, const IkCacheSettings& settings)
+        : _num_joints(num_joints), _settings(settings), _head(NONE), _tail(NONE), _stale_items(0)
+    {
+        _capacity = std::max<size_t>(1, _settings.memory_limit / entry_size(_num_joints));
+        _statistics.capacity = _capacity;
+
+        _slots.resize(_capacity);
+        _joints.resize(_capacity * _num_joints);
+        _free.reserve(_capacity);
+        for (size_t i = _capacity; i > 0; i--)
+            _free.push_back(i - 1);
+        for (auto& slot : _slots)
+            slot.generation = 0;
+        _map.reserve(_capacity);
+        _tree.reserve(_capacity);
+        _pending.reserve(_capacity);
+        _split.reserve(_capacity);
+    }
+
+    size_t IkCache::entry_size(size_t num_joints)
+    {
+        size_t map_node = sizeof(Key) + sizeof(uint32_t) + 2 * sizeof(void*); // node and bucket of the hash map
+        return sizeof(Slot) + num_joints * sizeof(double) + sizeof(uint32_t) + map_node + 2 * sizeof(Item) + sizeof(int);
+    }
+
+    int IkCache::branch(const Eigen::VectorXd& seed)
+    {
+        if (seed.size() == 0)
+            return NO_SEED;
+        int branch = 0;
+        for (int i = 1, bit = 0; i < seed.size(); i += 2, bit++)
+            if (seed(i) < 0.)
+                branch |= 1 << bit;
+        return branch;
+    }
+
+    bool IkCache::find(const Eigen::Vector3d& position, const Eigen::Quaterniond& orientation, int branch, Eigen::VectorXd& joints)
+    {
+        Key key = _key(position, orientation, branch);
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _map.find(key);
+        if (it == _map.end()) {
+            _statistics.misses++;
+            return false;
+        }
+
+        uint32_t slot = it->second;
+        _unlink(slot);
+        _push_front(slot);
+        joints = Eigen::VectorXd::Map(&_joints[slot * _num_joints], _num_joints);
+        _statistics.hits++;
+        return true;
+    }
+
+    bool IkCache::nearest(const Eigen::Vector3d& position, const Eigen::Quaterniond& orientation, Eigen::VectorXd& joints)
+    {
+        if (_settings.max_seed_distance <= 0.)
+            return false;
+
+        // The stored quaternions have w >= 0: look for both signs of the query
+        Point point = _point(position, orientation);
+        Point opposite = point;
+        for (int i = 3; i < DIM; i++)
+            opposite[i] = -opposite[i];
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        uint32_t best = NONE;
+        double best_distance = _settings.max_seed_distance * _settings.max_seed_distance;
+        for (const Point& query : {point, opposite}) {
+            _search(0, _tree.size(), query, best, best_distance);
+            for (auto& item : _pending) {
+                if (_stale(item))
+                    continue;
+                double distance = _distance(query, item.point);
+                if (distance < best_distance) {
+                    best_distance = distance;
+                    best = item.slot;
+                }
+            }
+        }
+
+        if (best == NONE)
+            return false;
+
+        joints = Eigen::VectorXd::Map(&_joints[best * _num_joints], _num_joints);
+        _statistics.seeds++;
+        return true;
+    }
+
+    void IkCache::insert(const Eigen::Vector3d& position, const Eigen::Quaterniond& orientation, int branch, const Eigen::VectorXd& joints)
+    {
+        if (static_cast<size_t>(joints.size()) != _num_joints)
+            return;
+
+        Key key = _key(position, orientation, branch);
+        Point point = _point(position, orientation);
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        uint32_t slot;
+        auto it = _map.find(key);
+        if (it != _map.end()) {
+            // Refresh: the point moves within its cell, so the index gets a new reference
+            slot = it->second;
+            _unlink(slot);
+            _slots[slot].generation++;
+            _stale_items++;
+        }
+        else {
+            if (_free.empty()) {
+                _evict();
+            }
+            slot = _free.back();
+            _free.pop_back();
+            _map.emplace(key, slot);
+            _statistics.insertions++;
+        }
+
+        Slot& s = _slots[slot];
+        s.key = key;
+        Eigen::VectorXd::Map(&_joints[slot * _num_joints], _num_joints) = joints;
+        _push_front(slot);
+
+        _pending.push_back({point, slot, s.generation});
+        if (_pending.size() > std::max<size_t>(64, _tree.size() / 8) || _stale_items > _tree.size() / 2 + 64)
+            _rebuild();
+    }
+
+    void IkCache::clear()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _map.clear();
+        _free.clear();
+        for (size_t i = _capacity; i > 0; i--)
+            _free.push_back(i - 1);
+        for (auto& slot : _slots)
+            slot.generation++;
+        _head = _tail = NONE;
+        _tree.clear();
+        _pending.clear();
+        _split.clear();
+        _stale_items = 0;
+    }
+
+    IkCacheStatistics IkCache::statistics() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        IkCacheStatistics statistics = _statistics;
+        statistics.size = _map.size();
+        return statistics;
+    }
+
+    IkCache::Key IkCache::_key(const Eigen::Vector3d& position, const Eigen::Quaterniond& orientation, int branch) const
+    {
+        Eigen::Quaterniond q = canonical(orientation);
+        Key key;
+        for (int i = 0; i < 3; i++)
+            key.cell[i] = static_cast<int32_t>(std::floor(position(i) / _settings.position_resolution));
+        for (int i = 0; i < 4; i++)
+            key.cell[3 + i] = static_cast<int32_t>(std::floor(q.coeffs()(i) / _settings.orientation_resolution));
+        key.branch = branch;
+        return key;
+    }
+
+    IkCache::Point IkCache::_point(const Eigen::Vector3d& position, const Eigen::Quaterniond& orientation) const
+    {
+        Eigen::Quaterniond q = canonical(orientation);
+        Point point;
+        for (int i = 0; i < 3; i++)
+            point[i] = position(i);
+        for (int i = 0; i < 4; i++)
+            point[3 + i] = _settings.orientation_weight * q.coeffs()(i);
+        return point;
+    }
+
+    void IkCache::_unlink(uint32_t slot)
+    {
+        Slot& s = _slots[slot];
+        if (s.prev != NONE)
+            _slots[s.prev].next = s.next;
+        else
+            _head = s.next;
+        if (s.next != NONE)
+            _slots[s.next].prev = s.prev;
+        else
+            _tail = s.prev;
+    }
+
+    void IkCache::_push_front(uint32_t slot)
+    {
+        Slot& s = _slots[slot];
+        s.prev = NONE;
+        s.next = _head;
+        if (_head != NONE)
+            _slots[_head].prev = slot;
+        _head = slot;
+        if (_tail == NONE)
+            _tail = slot;
+    }
+
+    uint32_t IkCache::_evict()
+    {
+        uint32_t slot = _tail;
+        _unlink(slot);
+        _map.erase(_slots[slot].key);
+        _slots[slot].generation++;
+        _free.push_back(slot);
+        _stale_items++;
+        _statistics.evictions++;
+        return slot;
+    }
+
+    void IkCache::_rebuild()
+    {
+        size_t n = 0;
+        for (size_t i = 0; i < _tree.size(); i++)
+            if (!_stale(_tree[i]))
+                _tree[n++] = _tree[i];
+        _tree.resize(n);
+        for (auto& item : _pending)
+            if (!_stale(item))
+                _tree.push_back(item);
+        _pending.clear();
+        _stale_items = 0;
+
+        _split.resize(_tree.size());
+        _build(0, _tree.size());
+    }
+
+    void IkCache::_build(size_t begin, size_t end)
+    {
+        if (end - begin < 2) {
+            if (end > begin)
+                _split[begin] = 0;
+            return;
+        }
+
+        // Split along the axis of largest extent
+        Point low, high;
+        low.fill(std::numeric_limits<double>::max());
+        high.fill(std::numeric_limits<double>::lowest());
+        for (size_t i = begin; i < end; i++) {
+            const Point& p = _tree[i].point;
+            for (int d = 0; d < DIM; d++) {
+                low[d] = std::min(low[d], p[d]);
+                high[d] = std::max(high[d], p[d]);
+            }
+        }
+        int axis = 0;
+        for (int d = 1; d < DIM; d++)
+            if (high[d] - low[d] > high[axis] - low[axis])
+                axis = d;
+
+        size_t mid = begin + (end - begin) / 2;
+        std::nth_element(_tree.begin() + begin, _tree.begin() + mid, _tree.begin() + end, [&](const Item& a, const Item& b) {
+            return a.point[axis] < b.point[axis];
+        });
+        _split[mid] = axis;
+
+        _build(begin, mid);
+        _build(mid + 1, end);
+    }
+
+    void IkCache::_search(size_t begin, size_t end, const Point& point, uint32_t& best, double& best_distance) const
+    {
+        if (begin >= end)
+            return;
+
+        size_t mid = begin + (end - begin) / 2;
+        const Item& item = _tree[mid];
+        const Point& node = item.point;
+        // Stale items (evicted or refreshed since the build) still split the space, they are just never returned
+        if (!_stale(item)) {
+            double distance = _distance(point, node);
+            if (distance < best_distance) {
+                best_distance = distance;
+                best = item.slot;
+            }
+        }
+
+        int axis = _split[mid];
+        double diff = point[axis] - node[axis];
+        if (diff < 0.) {
+            _search(begin, mid, point, best, best_distance);
+            if (diff * diff < best_distance)
+                _search(mid + 1, end, point, best, best_distance);
+        }
+        else {
+            _search(mid + 1, end, point, best, best_distance);
+            if (diff * diff < best_distance)
+                _search(begin, mid, point, best, best_distance);
+        }
+    }
+
+    double IkCache::_distance(const Point& a, const Point& b)
+    {
+        double distance = 0.;
+        for (int d = 0; d < DIM; d++)
+            distance += (a[d] - b[d]) * (a[d] - b[d]);
+        return distance;
+    }
+} // namespace iiwa_tools
@@ -0,0 +1,123 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#include <iiwa_tools/model_loader.h>
+
+namespace iiwa_tools {
+    namespace {
+        std::shared_ptr<const urdf::Model> parse_urdf(const std::string& xml)
+        {
+            std::shared_ptr<urdf::Model> model = std::make_shared<urdf::Model>();
+            if (!model->initString(xml)) {
+                ROS_ERROR_STREAM_NAMED("ModelLoader", "Could not parse the URDF.");
+                return nullptr;
+            }
+            return model;
+        }
+
+        std::shared_ptr<const mc_rbdyn_urdf::URDFParserResult> parse_rbdyn(const std::string& xml)
+        {
+            try {
+                return std::make_shared<mc_rbdyn_urdf::URDFParserResult>(mc_rbdyn_urdf::rbdyn_from_urdf(xml));
+            }
+            catch (const std::exception& e) {
+                ROS_ERROR_STREAM_NAMED("ModelLoader", "Could not convert the URDF to RBDyn: " << e.what());
+                return nullptr;
+            }
+        }
+    } // namespace
+
+    ModelLoader& ModelLoader::instance()
+    {
+        static ModelLoader loader;
+        return loader;
+    }
+
+    std::string ModelLoader::urdf_string(const ros::NodeHandle& nh, const std::string& param, double timeout)
+    {
+        std::string xml;
+        ros::WallTime start = ros::WallTime::now();
+        bool waiting = false;
+
+        // The first lookup subscribes to the parameter, the next ones only read the local cache
+        while (!nh.getParamCached(param, xml) || xml.empty()) {
+            if (!ros::ok() || (timeout >= 0. && (ros::WallTime::now() - start).toSec() > timeout)) {
+                ROS_ERROR_STREAM_NAMED("ModelLoader", "No URDF in parameter [" << nh.resolveName(param) << "].");
+                return "";
+            }
+
+            if (!waiting) {
+                ROS_INFO_STREAM_NAMED("ModelLoader", "Waiting for model URDF in parameter [" << nh.resolveName(param) << "] on the ROS param server.");
+                waiting = true;
+            }
+
+            ros::WallDuration(0.01).sleep();
+        }
+
+        return xml;
+    }
+
+    std::shared_ptr<const urdf::Model> ModelLoader::urdf_model(const ros::NodeHandle& nh, const std::string& param, double timeout)
+    {
+        std::shared_ptr<Entry> entry = _entry(nh, param, timeout, true, false);
+        return entry ? entry->urdf.get() : nullptr;
+    }
+
+    std::shared_ptr<const mc_rbdyn_urdf::URDFParserResult> ModelLoader::rbdyn_model(const ros::NodeHandle& nh, const std::string& param, double timeout)
+    {
+        std::shared_ptr<Entry> entry = _entry(nh, param, timeout, false, true);
+        return entry ? entry->rbdyn.get() : nullptr;
+    }
+
+    void ModelLoader::prefetch(const ros::NodeHandle& nh, const std::string& param, double timeout)
+    {
+        _entry(nh, param, timeout, true, true);
+    }
+
+    std::shared_ptr<ModelLoader::Entry> ModelLoader::_entry(const ros::NodeHandle& nh, const std::string& param, double timeout, bool urdf, bool rbdyn)
+    {
+        // Wait outside of the lock, the other parameters (and the cached models) stay available
+        std::string xml = urdf_string(nh, param, timeout);
+        if (xml.empty())
+            return nullptr;
+
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        // A new XML (e.g. another robot_description) replaces the entry, the models already handed out stay valid
+        std::shared_ptr<Entry>& entry = _entries[nh.resolveName(param)];
+        if (!entry || *entry->xml != xml) {
+            entry = std::make_shared<Entry>();
+            entry->xml = std::make_shared<const std::string>(std::move(xml));
+        }
+
+        // Parsed in the background; the parse itself never holds the lock
+        std::shared_ptr<const std::string> entry_xml = entry->xml;
+        if (urdf && !entry->urdf.valid())
+            entry->urdf = std::async(std::launch::async, [entry_xml]() { return parse_urdf(*entry_xml); }).share();
+        if (rbdyn && !entry->rbdyn.valid())
+            entry->rbdyn = std::async(std::launch::async, [entry_xml]() { return parse_rbdyn(*entry_xml); }).share();
+
+        return entry;
+    }
+} // namespace iiwa_tools
@@ -0,0 +1,135 @@
+//|
+//|    Copyright (C) 2019 Learning Algorithms and Systems Laboratory, EPFL, Switzerland
+//|    Authors:  Konstantinos Chatzilygeroudis (maintainer)
+//|              Bernardo Fichera
+//|              Walid Amanhoud
+//|    email:    costashatz@gmail.com
+//|              bernardo.fichera@epfl.ch
+//|              walid.amanhoud@epfl.ch
+//|    Other contributors:
+//|              Yoan Mollard (yoan@aubrune.eu)
+//|    website:  lasa.epfl.ch
+//|
+//|    This file is part of iiwa_ros.
+//|
+//|    iiwa_ros is free software: you can redistribute it and/or modify
+//|    it under the terms of the GNU General Public License as published by
+//|    the Free Software Foundation, either version 3 of the License, or
+//|    (at your option) any later version.
+//|
+//|    iiwa_ros is distributed in the hope that it will be useful,
+//|    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//|    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//|    GNU General Public License for more details.
+//|
+#include <iiwa_tools/param_tree.h>
+
+namespace iiwa_tools {
+    bool ParamTree::load(const ros::NodeHandle& nh, const std::string& ns)
+    {
+        _root = XmlRpc::XmlRpcValue();
+        return nh.getParam(ns.empty() ? nh.getNamespace() : ns, _root);
+    }
+
+    std::vector<std::string> ParamTree::members(const std::string& path) const
+    {
+        std::vector<std::string> names;
+        XmlRpc::XmlRpcValue* node = _find(path);
+        if (node && node->getType() == XmlRpc::XmlRpcValue::TypeStruct) {
+            for (XmlRpc::XmlRpcValue::iterator i = node->begin(); i != node->end(); ++i)
+                names.push_back(i->first);
+        }
+        return names;
+    }
+
+    ParamTree ParamTree::subtree(const std::string& path) const
+    {
+        XmlRpc::XmlRpcValue* node = _find(path);
+        return node ? ParamTree(*node) : ParamTree();
+    }
+
+    XmlRpc::XmlRpcValue* ParamTree::_find(const std::string& path) const
+    {
+        XmlRpc::XmlRpcValue* node = &_root;
+        size_t begin = 0;
+        while (begin < path.size()) {
+            size_t end = path.find('/', begin);
+            if (end == std::string::npos)
+                end = path.size();
+
+            if (end > begin) {
+                std::string name = path.substr(begin, end - begin);
+                if (node->getType() != XmlRpc::XmlRpcValue::TypeStruct || !node->hasMember(name))
+                    return nullptr;
+                node = &(*node)[name];
+            }
+
+            begin = end + 1;
+        }
+
+        return node->valid() ? node : nullptr;
+    }
+
+    bool ParamTree::_convert(XmlRpc::XmlRpcValue& node, bool& value)
+    {
+        if (node.getType() != XmlRpc::XmlRpcValue::TypeBoolean)
+            return false;
+        value = static_cast<bool>(node);
+        return true;
+    }
+
+    bool ParamTree::_convert(XmlRpc::XmlRpcValue& node, int& value)
+    {
+        if (node.getType() != XmlRpc::XmlRpcValue::TypeInt)
+            return false;
+        value = static_cast<int>(node);
+        return true;
+    }
+
+    bool ParamTree::_convert(XmlRpc::XmlRpcValue& node, double& value)
+    {
+        if (node.getType() == XmlRpc::XmlRpcValue::TypeInt)
+            value = static_cast<int>(node);
+        else if (node.getType() == XmlRpc::XmlRpcValue::TypeDouble)
+            value = static_cast<double>(node);
+        else
+            return false;
+        return true;
+    }
+
+    bool ParamTree::_convert(XmlRpc::XmlRpcValue& node, std::string& value)
+    {
+        if (node.getType() != XmlRpc::XmlRpcValue::TypeString)
+            return false;
+        value = static_cast<std::string&>(node);
+        return true;
+    }
+
+    bool ParamTree::_convert(XmlRpc::XmlRpcValue& node, std::vector<double>& value)
+    {
+        if (node.getType() != XmlRpc::XmlRpcValue::TypeArray)
+            return false;
+
+        std::vector<double> values(node.size());
+        for (int i = 0; i < node.size(); i++) {
+            if (!_convert(node[i], values[i]))
+                return false;
+        }
+        value.swap(values);
+        return true;
+    }
+
+    bool ParamTree::_convert(XmlRpc::XmlRpcValue& node, std::vector<std::string>& value)
+    {
+        if (node.getType() != XmlRpc::XmlRpcValue::TypeArray)
+            return false;
+
+        std::vector<std::string> values(node.size());
+        for (int i = 0; i < node.size(); i++) {
+            if (!_convert(node[i], values[i]))
+                return false;
+        }
+        value.swap(values);
+        return true;
+    }
+} // namespace iiwa_tools